@@ -0,0 +1,153 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "bmp.h"
+#include "threadpool.h"
+#include "bounded_queue.h"
+#include "uring.h"
+
+static const char *Batch_Error_Not_Enough_Memory =
+                    "Not enough memory to queue the image",
+                  *Batch_Error_Failed_to_Open_Image =
+                    "Failed to open the image",
+                  *Batch_Error_Failed_to_Create_Image =
+                    "Failed to create the image",
+                  *Batch_Error_Failed_to_Open_Directory =
+                    "Failed to open the source directory",
+                  *Batch_Error_Failed_to_Create_Directory =
+                    "Failed to create the destination directory",
+                  *Batch_Error_Failed_to_Start_Thread =
+                    "Failed to start the reader or writer thread",
+                  *Batch_Error_Failed_to_Submit_IO =
+                    "Failed to submit the asynchronous I/O";
+
+/* Images read ahead of the one being filtered and filtered ones waiting for the writer. */
+#define BATCH_QUEUE_CAPACITY 2
+
+/* Images each io_uring stage reads or writes at the same time. */
+#define BATCH_IMAGES_IN_FLIGHT 8
+
+#define BATCH_STAGE_OPEN         0
+#define BATCH_STAGE_READ_HEADERS 1
+#define BATCH_STAGE_READ_DATA    2
+#define BATCH_STAGE_WRITE_DATA   3
+
+typedef struct _batch_job
+{
+    int filter_id;
+    float brightness, contrast;
+    size_t radius;
+    char *source_file_name;
+    char *destination_file_name;
+    const char *error_message;      /* set when the job failed                      */
+    const char *error_file_name;    /* the source or destination the error is about */
+    struct _batch_job *awaited_job; /* the last earlier job using one of its files  */
+    bool finished;                  /* set once the job's output is closed          */
+} batch_job_t;
+
+/* A source or destination of a job, files that do not exist yet are told apart by name. */
+typedef struct _batch_file_use
+{
+    bool exists;
+    dev_t device;
+    ino_t inode;
+    const char *file_name;
+    size_t job_index;
+} batch_file_use_t;
+
+typedef struct _batch_options
+{
+    bool map_source;
+    bool widen_pixels;
+    bool planar_pixels;
+    bool tiled_pixels;
+    bool use_uring;                 /* falls back to blocking I/O when io_uring is not available */
+} batch_options_t;
+
+typedef struct _batch_item
+{
+    batch_job_t *job;
+    bmp_image image;
+    int pixel_filter_id;
+} batch_item_t;
+
+/* An image on its way through one of the io_uring stages. */
+typedef struct _batch_transfer
+{
+    batch_item_t *item;
+    int stage;
+    int file_number;
+    uint8_t headers[BMP_HEADERS_SIZE];
+    struct iovec input_vectors[2];  /* the rest of the headers and the payload                  */
+    bmp_image_output output;
+    struct iovec *vectors;          /* the vectors not transferred yet                          */
+    size_t vector_count;
+    uint64_t offset;                /* the file offset of `vectors`                             */
+} batch_transfer_t;
+
+typedef struct _batch_context
+{
+    batch_job_t *jobs;
+    size_t job_count;
+    const batch_options_t *options;
+    bounded_queue_t *read_items;
+    bounded_queue_t *processed_items;
+    batch_item_t end_of_jobs;       /* queued after the last item, queues do not take NULL */
+    size_t failed_job_count;
+    pthread_mutex_t job_mutex;
+    pthread_cond_t job_finished_condition;
+} batch_context_t;
+
+static bool batch_add_job(
+                batch_job_t **jobs,
+                size_t *job_count,
+                size_t *job_capacity,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                const char *source_file_name,
+                const char *destination_file_name
+            );
+
+static void batch_destroy_jobs(
+                batch_job_t *jobs,
+                size_t job_count
+            );
+
+static void batch_list_directory(
+                const char *source_directory_name,
+                const char *destination_directory_name,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                batch_job_t **jobs,
+                size_t *job_count,
+                const char **error_message
+            );
+
+/*
+    Jobs run in list order as far as their files are concerned: a job whose
+    source or destination an earlier job also reads or writes is not read
+    before that job's output is closed. Other jobs are read ahead.
+*/
+static size_t batch_process_jobs(
+                  batch_job_t *jobs,
+                  size_t job_count,
+                  const batch_options_t *options,
+                  threadpool_t *threadpool,
+                  size_t pool_size,
+                  const char **error_message
+              );
+
+#include "batch.impl.h.c"
+
+#endif /* BATCH_H */
@@ -0,0 +1,1129 @@
+#include "batch.h"
+#include "filters.h"
+#include "filters_threading.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static char *_batch_duplicate_string(const char *string)
+{
+    size_t length =
+        strlen(string);
+
+    char *duplicate =
+        (char *) malloc(length + 1);
+    if (NULL != duplicate) {
+        memcpy(duplicate, string, length + 1);
+    }
+
+    return duplicate;
+}
+
+static bool batch_add_job(
+                batch_job_t **jobs,
+                size_t *job_count,
+                size_t *job_capacity,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                const char *source_file_name,
+                const char *destination_file_name
+            )
+{
+    if (*job_count == *job_capacity) {
+        size_t capacity =
+            UTILS_MAX(*job_capacity * 2, 16);
+
+        batch_job_t *grown_jobs =
+            (batch_job_t *) realloc(*jobs, capacity * sizeof(**jobs));
+        if (NULL == grown_jobs) {
+            return false;
+        }
+
+        *jobs = grown_jobs;
+        *job_capacity = capacity;
+    }
+
+    batch_job_t *job =
+        &(*jobs)[*job_count];
+    memset(job, 0, sizeof(*job));
+
+    job->filter_id =
+        filter_id;
+    job->brightness =
+        brightness;
+    job->contrast =
+        contrast;
+    job->radius =
+        radius;
+    job->source_file_name =
+        _batch_duplicate_string(source_file_name);
+    job->destination_file_name =
+        _batch_duplicate_string(destination_file_name);
+    if (NULL == job->source_file_name || NULL == job->destination_file_name) {
+        free(job->source_file_name);
+        free(job->destination_file_name);
+
+        return false;
+    }
+
+    ++*job_count;
+
+    return true;
+}
+
+static void batch_destroy_jobs(
+                batch_job_t *jobs,
+                size_t job_count
+            )
+{
+    if (NULL == jobs) {
+        return;
+    }
+
+    for (size_t i = 0; i < job_count; ++i) {
+        free(jobs[i].source_file_name);
+        free(jobs[i].destination_file_name);
+    }
+
+    free(jobs);
+}
+
+static char *_batch_join_path(const char *directory_name, const char *file_name)
+{
+    size_t directory_length =
+        strlen(directory_name);
+    size_t file_length =
+        strlen(file_name);
+
+    char *path =
+        (char *) malloc(directory_length + 1 + file_length + 1);
+    if (NULL != path) {
+        memcpy(path, directory_name, directory_length);
+        path[directory_length] = '/';
+        memcpy(path + directory_length + 1, file_name, file_length + 1);
+    }
+
+    return path;
+}
+
+static int _batch_compare_file_names(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/*
+    Creates a job for every `.bmp` file in the source directory, writing to a
+    file with the same name in the destination directory. The destination
+    directory is created if it does not exist. Jobs are sorted by file name.
+*/
+static void batch_list_directory(
+                const char *source_directory_name,
+                const char *destination_directory_name,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                batch_job_t **jobs,
+                size_t *job_count,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+    *jobs = NULL;
+    *job_count = 0;
+
+    char **file_names =
+        NULL;
+    size_t file_count =
+        0,
+           file_capacity =
+        0;
+    size_t job_capacity =
+        0;
+
+    DIR *directory =
+        opendir(source_directory_name);
+    if (NULL == directory) {
+        *error_message = Batch_Error_Failed_to_Open_Directory;
+
+        goto cleanup;
+    }
+
+    if (0 != mkdir(destination_directory_name, 0777) && EEXIST != errno) {
+        *error_message = Batch_Error_Failed_to_Create_Directory;
+
+        goto cleanup;
+    }
+
+    struct dirent *entry;
+    while (NULL != (entry = readdir(directory))) {
+        size_t length =
+            strlen(entry->d_name);
+        if (4 >= length || 0 != strcasecmp(entry->d_name + length - 4, ".bmp")) {
+            continue;
+        }
+
+        char *source_file_name =
+            _batch_join_path(source_directory_name, entry->d_name);
+        if (NULL == source_file_name) {
+            *error_message = Batch_Error_Not_Enough_Memory;
+
+            goto cleanup;
+        }
+
+        struct stat source_status;
+        bool is_regular_file =
+            0 == stat(source_file_name, &source_status) && S_ISREG(source_status.st_mode);
+        free(source_file_name);
+        if (!is_regular_file) {
+            continue;
+        }
+
+        if (file_count == file_capacity) {
+            file_capacity =
+                UTILS_MAX(file_capacity * 2, 16);
+
+            char **grown_file_names =
+                (char **) realloc(file_names, file_capacity * sizeof(*file_names));
+            if (NULL == grown_file_names) {
+                *error_message = Batch_Error_Not_Enough_Memory;
+
+                goto cleanup;
+            }
+            file_names = grown_file_names;
+        }
+
+        file_names[file_count] =
+            _batch_duplicate_string(entry->d_name);
+        if (NULL == file_names[file_count]) {
+            *error_message = Batch_Error_Not_Enough_Memory;
+
+            goto cleanup;
+        }
+        ++file_count;
+    }
+
+    qsort(file_names, file_count, sizeof(*file_names), _batch_compare_file_names);
+
+    for (size_t i = 0; i < file_count; ++i) {
+        char *source_file_name =
+            _batch_join_path(source_directory_name, file_names[i]);
+        char *destination_file_name =
+            _batch_join_path(destination_directory_name, file_names[i]);
+
+        bool added =
+            NULL != source_file_name && NULL != destination_file_name &&
+            batch_add_job(
+                jobs, job_count, &job_capacity,
+                filter_id,
+                brightness, contrast,
+                radius,
+                source_file_name,
+                destination_file_name
+            );
+
+        free(source_file_name);
+        free(destination_file_name);
+
+        if (!added) {
+            *error_message = Batch_Error_Not_Enough_Memory;
+
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    if (NULL != *error_message) {
+        batch_destroy_jobs(*jobs, *job_count);
+        *jobs = NULL;
+        *job_count = 0;
+    }
+
+    for (size_t i = 0; i < file_count; ++i) {
+        free(file_names[i]);
+    }
+    free(file_names);
+
+    if (NULL != directory) {
+        closedir(directory);
+    }
+}
+
+/* Orders file uses by file, existing files by device and inode and the others by name. */
+static int _batch_compare_files(
+               const batch_file_use_t *first,
+               const batch_file_use_t *second
+           )
+{
+    if (first->exists != second->exists) {
+        return first->exists ? -1 : 1;
+    }
+
+    if (!first->exists) {
+        return strcmp(first->file_name, second->file_name);
+    }
+
+    return first->device != second->device ? (first->device < second->device ? -1 : 1) :
+           first->inode  != second->inode  ? (first->inode  < second->inode  ? -1 : 1) :
+                                             0;
+}
+
+static int _batch_compare_file_uses(const void *a, const void *b)
+{
+    const batch_file_use_t *first =
+        (const batch_file_use_t *) a;
+    const batch_file_use_t *second =
+        (const batch_file_use_t *) b;
+
+    int order =
+        _batch_compare_files(first, second);
+    if (0 != order) {
+        return order;
+    }
+
+    return first->job_index < second->job_index ? -1 :
+           first->job_index > second->job_index ?  1 :
+                                                   0;
+}
+
+static void _batch_describe_file_use(
+                batch_file_use_t *use,
+                const char *file_name,
+                size_t job_index
+            )
+{
+    struct stat file_status;
+
+    use->exists =
+        0 == stat(file_name, &file_status);
+    use->device =
+        use->exists ? file_status.st_dev : 0;
+    use->inode =
+        use->exists ? file_status.st_ino : 0;
+    use->file_name =
+        file_name;
+    use->job_index =
+        job_index;
+}
+
+/*
+    Points every job at the last earlier job that reads or writes one of its
+    files. The sources and destinations of all jobs are sorted by file, so
+    the uses of one file end up next to each other in job order.
+*/
+static bool _batch_find_awaited_jobs(batch_job_t *jobs, size_t job_count)
+{
+    if (0 == job_count) {
+        return true;
+    }
+
+    batch_file_use_t *uses =
+        (batch_file_use_t *) malloc(2 * job_count * sizeof(*uses));
+    if (NULL == uses) {
+        return false;
+    }
+
+    for (size_t i = 0; i < job_count; ++i) {
+        jobs[i].awaited_job =
+            NULL;
+        jobs[i].finished =
+            false;
+
+        _batch_describe_file_use(&uses[2 * i],     jobs[i].source_file_name,      i);
+        _batch_describe_file_use(&uses[2 * i + 1], jobs[i].destination_file_name, i);
+    }
+
+    qsort(uses, 2 * job_count, sizeof(*uses), _batch_compare_file_uses);
+
+    for (size_t i = 1; i < 2 * job_count; ++i) {
+        const batch_file_use_t *previous_use =
+            &uses[i - 1];
+        const batch_file_use_t *use =
+            &uses[i];
+        if (previous_use->job_index == use->job_index ||
+            0 != _batch_compare_files(previous_use, use)) {
+            continue;
+        }
+
+        batch_job_t *job =
+            &jobs[use->job_index];
+        batch_job_t *earlier_job =
+            &jobs[previous_use->job_index];
+        if (NULL == job->awaited_job || job->awaited_job < earlier_job) {
+            job->awaited_job =
+                earlier_job;
+        }
+    }
+
+    free(uses);
+
+    return true;
+}
+
+static void _batch_finish_job(batch_context_t *context, batch_job_t *job)
+{
+    pthread_mutex_lock(&context->job_mutex);
+    job->finished =
+        true;
+    pthread_cond_broadcast(&context->job_finished_condition);
+    pthread_mutex_unlock(&context->job_mutex);
+}
+
+/* Tells whether the job a job waits for is done, jobs without one never wait. */
+static bool _batch_awaited_job_is_finished(batch_context_t *context, const batch_job_t *job)
+{
+    if (NULL == job->awaited_job) {
+        return true;
+    }
+
+    pthread_mutex_lock(&context->job_mutex);
+    bool finished =
+        job->awaited_job->finished;
+    pthread_mutex_unlock(&context->job_mutex);
+
+    return finished;
+}
+
+static void _batch_wait_for_awaited_job(batch_context_t *context, const batch_job_t *job)
+{
+    if (NULL == job->awaited_job) {
+        return;
+    }
+
+    pthread_mutex_lock(&context->job_mutex);
+    while (!job->awaited_job->finished) {
+        pthread_cond_wait(&context->job_finished_condition, &context->job_mutex);
+    }
+    pthread_mutex_unlock(&context->job_mutex);
+}
+
+static batch_item_t *_batch_create_item(batch_context_t *context, batch_job_t *job)
+{
+    batch_item_t *item =
+        (batch_item_t *) malloc(sizeof(*item));
+    if (NULL == item) {
+        job->error_message = Batch_Error_Not_Enough_Memory;
+        job->error_file_name = job->source_file_name;
+        __sync_add_and_fetch(&context->failed_job_count, 1);
+        _batch_finish_job(context, job);
+
+        return NULL;
+    }
+
+    item->job =
+        job;
+    item->pixel_filter_id =
+        job->filter_id;
+    bmp_init_image_structure(&item->image);
+
+    return item;
+}
+
+/* Applies the pixel format options once the headers are known. */
+static void _batch_prepare_image(batch_context_t *context, batch_item_t *item)
+{
+    if (context->options->widen_pixels) {
+        item->image.bytes_per_pixel =
+            4;
+    }
+    item->image.planar =
+        context->options->planar_pixels;
+    item->image.tiled =
+        context->options->tiled_pixels;
+
+    item->pixel_filter_id =
+        filters_prepare_indexed_image(
+            &item->image,
+            item->job->filter_id,
+            item->job->brightness, item->job->contrast
+        );
+}
+
+static void _batch_finish_item(batch_context_t *context, batch_item_t *item)
+{
+    batch_job_t *job =
+        item->job;
+
+    if (NULL != job->error_message) {
+        __sync_add_and_fetch(&context->failed_job_count, 1);
+    }
+
+    bmp_free_image_structure(&item->image);
+    free(item);
+
+    _batch_finish_job(context, job);
+}
+
+static void _batch_advance_vectors(batch_transfer_t *transfer, size_t byte_count)
+{
+    transfer->offset += byte_count;
+
+    while (0 < transfer->vector_count && byte_count >= transfer->vectors->iov_len) {
+        byte_count -= transfer->vectors->iov_len;
+        ++transfer->vectors;
+        --transfer->vector_count;
+    }
+
+    if (0 < transfer->vector_count) {
+        transfer->vectors->iov_base = (uint8_t *) transfer->vectors->iov_base + byte_count;
+        transfer->vectors->iov_len -= byte_count;
+    }
+}
+
+static bool _batch_is_same_file(
+                FILE *file_descriptor,
+                const char *file_name
+            )
+{
+    struct stat file_status, named_file_status;
+
+    return 0 == fstat(fileno(file_descriptor), &file_status) &&
+           0 == stat(file_name, &named_file_status) &&
+           file_status.st_dev == named_file_status.st_dev &&
+           file_status.st_ino == named_file_status.st_ino;
+}
+
+static void _batch_read_images_synchronously(batch_context_t *context, size_t first_job)
+{
+    for (size_t i = first_job; i < context->job_count; ++i) {
+        batch_job_t *job =
+            &context->jobs[i];
+
+        _batch_wait_for_awaited_job(context, job);
+
+        batch_item_t *item =
+            _batch_create_item(context, job);
+        if (NULL == item) {
+            continue;
+        }
+
+        FILE *source_descriptor =
+            fopen(job->source_file_name, "r");
+        if (NULL == source_descriptor) {
+            job->error_message = Batch_Error_Failed_to_Open_Image;
+        } else {
+            bmp_open_image_headers(source_descriptor, &item->image, &job->error_message);
+        }
+
+        if (NULL == job->error_message) {
+            _batch_prepare_image(context, item);
+
+            // Writing truncates the destination, a source that is the same
+            // file is read whole instead of mapped.
+            if (context->options->map_source &&
+                !_batch_is_same_file(source_descriptor, job->destination_file_name)) {
+                bmp_map_image_data(source_descriptor, &item->image, &job->error_message);
+            } else {
+                bmp_read_image_data(source_descriptor, &item->image, &job->error_message);
+            }
+        }
+
+        if (NULL != job->error_message) {
+            job->error_file_name = job->source_file_name;
+        } else {
+            bmp_release_image_payload(&item->image);
+        }
+
+        if (NULL != source_descriptor) {
+            fclose(source_descriptor);
+        }
+
+        bounded_queue_enqueue(context->read_items, item);
+    }
+}
+
+/*
+    Moves a read to its next step after a completion. Returns true once the
+    image is read or the read failed. Every transfer has at most one
+    operation in flight, so the ring never runs out of submission entries.
+*/
+static bool _batch_continue_reading(
+                batch_context_t *context,
+                uring_t *ring,
+                batch_transfer_t *transfer,
+                int32_t result
+            )
+{
+    batch_item_t *item =
+        transfer->item;
+    batch_job_t *job =
+        item->job;
+    bmp_image *image =
+        &item->image;
+
+    switch (transfer->stage) {
+        case BATCH_STAGE_OPEN:
+            if (0 > result) {
+                job->error_message = Batch_Error_Failed_to_Open_Image;
+
+                return true;
+            }
+
+            transfer->file_number =
+                result;
+            transfer->stage =
+                BATCH_STAGE_READ_HEADERS;
+            uring_queue_read(
+                ring,
+                transfer->file_number,
+                transfer->headers, sizeof(transfer->headers),
+                0,
+                (uint64_t) (uintptr_t) transfer
+            );
+
+            return false;
+        case BATCH_STAGE_READ_HEADERS:
+            bmp_parse_image_headers(
+                transfer->headers, 0 > result ? 0 : (size_t) result,
+                image,
+                &job->error_message
+            );
+            if (NULL != job->error_message) {
+                return true;
+            }
+
+            bmp_allocate_image_payload(image, &job->error_message);
+            if (NULL != job->error_message) {
+                return true;
+            }
+
+            transfer->input_vectors[0] =
+                (struct iovec) { .iov_base = image->extra_header_data, .iov_len = image->extra_header_size };
+            transfer->input_vectors[1] =
+                (struct iovec) { .iov_base = image->payload,           .iov_len = image->payload_size      };
+            transfer->vectors =
+                transfer->input_vectors;
+            transfer->vector_count =
+                UTILS_COUNT_OF(transfer->input_vectors);
+            transfer->offset =
+                BMP_HEADERS_SIZE;
+            transfer->stage =
+                BATCH_STAGE_READ_DATA;
+            uring_queue_readv(
+                ring,
+                transfer->file_number,
+                transfer->vectors, (unsigned) transfer->vector_count,
+                transfer->offset,
+                (uint64_t) (uintptr_t) transfer
+            );
+
+            return false;
+        case BATCH_STAGE_READ_DATA:
+            if (0 >= result) {
+                job->error_message =
+                    transfer->offset < image->file_header.pixel_array_offset ?
+                        BMP_Error_Failed_to_Read_Rest_of_Headers :
+                        BMP_Error_Failed_to_Read_Image_Data;
+
+                return true;
+            }
+
+            /* Large reads may come back short, the rest is read from where they stopped. */
+            _batch_advance_vectors(transfer, (size_t) result);
+            if (0 < transfer->vector_count) {
+                uring_queue_readv(
+                    ring,
+                    transfer->file_number,
+                    transfer->vectors, (unsigned) transfer->vector_count,
+                    transfer->offset,
+                    (uint64_t) (uintptr_t) transfer
+                );
+
+                return false;
+            }
+
+            bmp_parse_extra_headers(image, &job->error_message);
+            if (NULL != job->error_message) {
+                return true;
+            }
+
+            _batch_prepare_image(context, item);
+
+            bmp_prepare_image_data(image, &job->error_message);
+            if (NULL != job->error_message) {
+                return true;
+            }
+
+            bmp_release_image_payload(image);
+
+            return true;
+    }
+
+    return true;
+}
+
+/*
+    Keeps up to BATCH_IMAGES_IN_FLIGHT images opening and reading at once,
+    each completion moves its image one step further. Images are passed on
+    in the order their reads finish, a job that waits for an earlier one is
+    not started before that one is written. Returns the number of jobs started, all
+    of them unless the ring failed.
+*/
+static size_t _batch_read_images_asynchronously(batch_context_t *context, uring_t *ring)
+{
+    batch_transfer_t transfers[BATCH_IMAGES_IN_FLIGHT];
+    memset(transfers, 0, sizeof(transfers));
+
+    size_t next_job =
+        0,
+           transfers_in_flight =
+        0;
+    while (next_job < context->job_count || 0 < transfers_in_flight) {
+        for (size_t i = 0; i < BATCH_IMAGES_IN_FLIGHT && next_job < context->job_count; ++i) {
+            batch_transfer_t *transfer =
+                &transfers[i];
+            if (NULL != transfer->item) {
+                continue;
+            }
+
+            // A job waiting for an earlier one is started once every image
+            // in flight went on, so the one it waits for can be written.
+            batch_job_t *job =
+                &context->jobs[next_job];
+            if (!_batch_awaited_job_is_finished(context, job)) {
+                if (0 < transfers_in_flight) {
+                    break;
+                }
+
+                _batch_wait_for_awaited_job(context, job);
+            }
+            ++next_job;
+
+            batch_item_t *item =
+                _batch_create_item(context, job);
+            if (NULL == item) {
+                continue;
+            }
+
+            memset(transfer, 0, sizeof(*transfer));
+            transfer->item =
+                item;
+            transfer->file_number =
+                -1;
+            transfer->stage =
+                BATCH_STAGE_OPEN;
+            ++transfers_in_flight;
+
+            uring_queue_openat(
+                ring,
+                job->source_file_name,
+                O_RDONLY, 0,
+                (uint64_t) (uintptr_t) transfer
+            );
+        }
+
+        if (0 == transfers_in_flight) {
+            continue;
+        }
+
+        uring_completion_t completion;
+        bool ring_failed =
+            !uring_wait_completion(ring, &completion);
+
+        for (size_t i = 0; i < BATCH_IMAGES_IN_FLIGHT; ++i) {
+            batch_transfer_t *transfer =
+                &transfers[i];
+            if (NULL == transfer->item) {
+                continue;
+            }
+
+            batch_job_t *job =
+                transfer->item->job;
+            if (ring_failed) {
+                job->error_message = Batch_Error_Failed_to_Submit_IO;
+            } else if ((uint64_t) (uintptr_t) transfer != completion.user_data ||
+                       !_batch_continue_reading(context, ring, transfer, completion.result)) {
+                continue;
+            }
+
+            if (NULL != job->error_message) {
+                job->error_file_name = job->source_file_name;
+            }
+
+            if (0 <= transfer->file_number) {
+                close(transfer->file_number);
+            }
+
+            bounded_queue_enqueue(context->read_items, transfer->item);
+            transfer->item = NULL;
+            --transfers_in_flight;
+        }
+
+        if (ring_failed) {
+            break;
+        }
+    }
+
+    return next_job;
+}
+
+/*
+    Reader stage: parses the headers and reads the pixels of the next images
+    while the current one is filtered. Failed jobs are passed on as well, so
+    the writer sees every job.
+*/
+static void *_batch_read_images(void *arguments)
+{
+    batch_context_t *context =
+        (batch_context_t *) arguments;
+
+    size_t first_job =
+        0;
+
+    uring_t ring;
+    if (context->options->use_uring && uring_init(&ring, BATCH_IMAGES_IN_FLIGHT)) {
+        first_job =
+            _batch_read_images_asynchronously(context, &ring);
+        uring_destroy(&ring);
+    }
+
+    _batch_read_images_synchronously(context, first_job);
+
+    bounded_queue_enqueue(context->read_items, &context->end_of_jobs);
+
+    return NULL;
+}
+
+static void _batch_write_image_synchronously(batch_item_t *item)
+{
+    batch_job_t *job =
+        item->job;
+
+    FILE *destination_descriptor =
+        fopen(job->destination_file_name, "w");
+    if (NULL == destination_descriptor) {
+        job->error_message = Batch_Error_Failed_to_Create_Image;
+    } else {
+        bmp_write_image(destination_descriptor, &item->image, &job->error_message);
+        if (0 != fclose(destination_descriptor) && NULL == job->error_message) {
+            job->error_message = BMP_Error_Failed_to_Write_Image_Data;
+        }
+    }
+}
+
+/* Moves a write to its next step after a completion, returns true once it is done. */
+static bool _batch_continue_writing(
+                uring_t *ring,
+                batch_transfer_t *transfer,
+                int32_t result
+            )
+{
+    batch_job_t *job =
+        transfer->item->job;
+
+    switch (transfer->stage) {
+        case BATCH_STAGE_OPEN:
+            if (0 > result) {
+                job->error_message = Batch_Error_Failed_to_Create_Image;
+
+                return true;
+            }
+
+            transfer->file_number =
+                result;
+            transfer->vectors =
+                transfer->output.vectors;
+            transfer->vector_count =
+                transfer->output.vector_count;
+            transfer->offset =
+                0;
+            transfer->stage =
+                BATCH_STAGE_WRITE_DATA;
+
+            break;
+        case BATCH_STAGE_WRITE_DATA:
+            if (0 >= result) {
+                job->error_message = BMP_Error_Failed_to_Write_Image_Data;
+
+                return true;
+            }
+
+            _batch_advance_vectors(transfer, (size_t) result);
+            if (0 == transfer->vector_count) {
+                return true;
+            }
+
+            break;
+        default:
+            return true;
+    }
+
+    uring_queue_writev(
+        ring,
+        transfer->file_number,
+        transfer->vectors, (unsigned) UTILS_MIN(transfer->vector_count, (size_t) IOV_MAX),
+        transfer->offset,
+        (uint64_t) (uintptr_t) transfer
+    );
+
+    return false;
+}
+
+static void _batch_write_item(batch_context_t *context, batch_item_t *item)
+{
+    batch_job_t *job =
+        item->job;
+
+    if (NULL == job->error_message) {
+        _batch_write_image_synchronously(item);
+        if (NULL != job->error_message) {
+            job->error_file_name = job->destination_file_name;
+        }
+    }
+
+    _batch_finish_item(context, item);
+}
+
+/*
+    Keeps up to BATCH_IMAGES_IN_FLIGHT images writing at once. New images are
+    only waited for when nothing is in flight, otherwise completions are
+    handled while the compute stage catches up. Once the ring fails, the
+    remaining images are written with blocking I/O.
+*/
+static void _batch_write_images_asynchronously(batch_context_t *context, uring_t *ring)
+{
+    batch_transfer_t transfers[BATCH_IMAGES_IN_FLIGHT];
+    memset(transfers, 0, sizeof(transfers));
+
+    size_t transfers_in_flight =
+        0;
+    bool ring_failed =
+        false;
+    bool last_item_seen =
+        false;
+    while (!last_item_seen || 0 < transfers_in_flight) {
+        if (!last_item_seen && BATCH_IMAGES_IN_FLIGHT > transfers_in_flight) {
+            batch_item_t *item =
+                0 == transfers_in_flight ?
+                    (batch_item_t *) bounded_queue_deque(context->processed_items) :
+                    (batch_item_t *) bounded_queue_try_deque(context->processed_items);
+            if (&context->end_of_jobs == item) {
+                last_item_seen =
+                    true;
+
+                continue;
+            }
+
+            if (NULL != item) {
+                batch_job_t *job =
+                    item->job;
+
+                if (NULL != job->error_message || ring_failed) {
+                    _batch_write_item(context, item);
+
+                    continue;
+                }
+
+                batch_transfer_t *transfer =
+                    transfers;
+                while (NULL != transfer->item) {
+                    ++transfer;
+                }
+
+                memset(transfer, 0, sizeof(*transfer));
+                transfer->file_number =
+                    -1;
+                transfer->stage =
+                    BATCH_STAGE_OPEN;
+
+                bmp_prepare_image_output(&item->image, &transfer->output, &job->error_message);
+                if (NULL != job->error_message) {
+                    job->error_file_name = job->destination_file_name;
+                    _batch_finish_item(context, item);
+
+                    continue;
+                }
+
+                transfer->item =
+                    item;
+                ++transfers_in_flight;
+
+                // The reader passes an image on only once its pixels are in
+                // memory, so truncating a destination that is also the
+                // job's source loses nothing.
+                uring_queue_openat(
+                    ring,
+                    job->destination_file_name,
+                    O_WRONLY | O_CREAT | O_TRUNC, 0666,
+                    (uint64_t) (uintptr_t) transfer
+                );
+
+                continue;
+            }
+        }
+
+        uring_completion_t completion;
+        ring_failed =
+            !uring_wait_completion(ring, &completion);
+
+        for (size_t i = 0; i < BATCH_IMAGES_IN_FLIGHT; ++i) {
+            batch_transfer_t *transfer =
+                &transfers[i];
+            if (NULL == transfer->item) {
+                continue;
+            }
+
+            batch_job_t *job =
+                transfer->item->job;
+            if (ring_failed) {
+                job->error_message = Batch_Error_Failed_to_Submit_IO;
+            } else if ((uint64_t) (uintptr_t) transfer != completion.user_data ||
+                       !_batch_continue_writing(ring, transfer, completion.result)) {
+                continue;
+            }
+
+            if (0 <= transfer->file_number &&
+                0 != close(transfer->file_number) &&
+                NULL == job->error_message) {
+                job->error_message = BMP_Error_Failed_to_Write_Image_Data;
+            }
+            if (NULL != job->error_message) {
+                job->error_file_name = job->destination_file_name;
+            }
+
+            bmp_free_image_output(&transfer->output);
+            _batch_finish_item(context, transfer->item);
+            transfer->item = NULL;
+            --transfers_in_flight;
+        }
+    }
+}
+
+/* Writer stage: stores the filtered images and releases them. */
+static void *_batch_write_images(void *arguments)
+{
+    batch_context_t *context =
+        (batch_context_t *) arguments;
+
+    uring_t ring;
+    if (context->options->use_uring && uring_init(&ring, BATCH_IMAGES_IN_FLIGHT)) {
+        _batch_write_images_asynchronously(context, &ring);
+        uring_destroy(&ring);
+
+        return NULL;
+    }
+
+    batch_item_t *item;
+    while (&context->end_of_jobs != (item = (batch_item_t *) bounded_queue_deque(context->processed_items))) {
+        _batch_write_item(context, item);
+    }
+
+    return NULL;
+}
+
+/*
+    Runs the jobs through a reader, compute and writer pipeline connected by
+    bounded queues, so reading and writing of neighbouring images overlaps
+    with filtering. Filtering happens on the calling thread with the shared
+    pool. Returns the number of failed jobs, their errors are left in the jobs.
+*/
+static size_t batch_process_jobs(
+                  batch_job_t *jobs,
+                  size_t job_count,
+                  const batch_options_t *options,
+                  threadpool_t *threadpool,
+                  size_t pool_size,
+                  const char **error_message
+              )
+{
+    *error_message = NULL;
+
+    batch_context_t context;
+    memset(&context, 0, sizeof(context));
+
+    pthread_t reader_thread, writer_thread;
+    bool writer_started = false;
+
+    context.jobs =
+        jobs;
+    context.job_count =
+        job_count;
+    context.options =
+        options;
+
+    pthread_mutex_init(&context.job_mutex, NULL);
+    pthread_cond_init(&context.job_finished_condition, NULL);
+
+    if (!_batch_find_awaited_jobs(jobs, job_count)) {
+        *error_message = Batch_Error_Not_Enough_Memory;
+
+        goto cleanup;
+    }
+
+    context.read_items =
+        bounded_queue_create(BATCH_QUEUE_CAPACITY);
+    context.processed_items =
+        bounded_queue_create(BATCH_QUEUE_CAPACITY);
+    if (NULL == context.read_items ||
+        NULL == context.processed_items) {
+        *error_message = Batch_Error_Not_Enough_Memory;
+
+        goto cleanup;
+    }
+
+    if (0 != pthread_create(&writer_thread, NULL, _batch_write_images, &context)) {
+        *error_message = Batch_Error_Failed_to_Start_Thread;
+
+        goto cleanup;
+    }
+    writer_started = true;
+
+    if (0 != pthread_create(&reader_thread, NULL, _batch_read_images, &context)) {
+        *error_message = Batch_Error_Failed_to_Start_Thread;
+
+        goto cleanup;
+    }
+
+    batch_item_t *item;
+    while (&context.end_of_jobs != (item = (batch_item_t *) bounded_queue_deque(context.read_items))) {
+        batch_job_t *job =
+            item->job;
+
+        if (NULL == job->error_message) {
+            filters_process_image(
+                threadpool,
+                pool_size,
+                item->pixel_filter_id,
+                job->brightness, job->contrast,
+                job->radius,
+                &item->image,
+                NULL,
+                NULL,
+                NULL,
+                &job->error_message
+            );
+
+            if (NULL != job->error_message) {
+                job->error_file_name = job->source_file_name;
+            }
+        }
+
+        bounded_queue_enqueue(context.processed_items, item);
+    }
+
+    pthread_join(reader_thread, NULL);
+
+cleanup:
+    if (writer_started) {
+        bounded_queue_enqueue(context.processed_items, &context.end_of_jobs);
+        pthread_join(writer_thread, NULL);
+    }
+
+    bounded_queue_destroy(context.read_items);
+    bounded_queue_destroy(context.processed_items);
+
+    pthread_cond_destroy(&context.job_finished_condition);
+    pthread_mutex_destroy(&context.job_mutex);
+
+    return context.failed_job_count;
+}
@@ -4,7 +4,9 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 static const char *BMP_Error_Invalid_File_Descriptor =
                     "Invalid file descriptor",
@@ -15,10 +17,16 @@ static const char *BMP_Error_Invalid_File_Descriptor =
                     "Invalid bitmap file signature",
                   *BMP_Error_Failed_to_Read_DIB_Header =
                     "Failed to read the DIB header",
-                  *BMP_Error_Failed_to_Seek_Inside_DIB_Header =
-                    "Failed to seek inside of the DIB header",
+                  *BMP_Error_Invalid_DIB_Header_Size =
+                    "Invalid DIB header size",
+                  *BMP_Error_Failed_to_Read_Rest_of_Headers =
+                    "Failed to read the rest of the DIB header and the color information",
                   *BMP_Error_Unsupported_Color_Depth =
-                    "Invalid color depth (not 24 bits per pixel)",
+                    "Invalid color depth (not 1, 4, 8, 24 or 32 bits per pixel)",
+                  *BMP_Error_Unsupported_Compression =
+                    "Unsupported compression method or color masks",
+                  *BMP_Error_Invalid_Color_Table =
+                    "Invalid color table",
                   *BMP_Error_Invalid_Size_Information =
                     "The bitmap image containes invalid size information",
 
@@ -28,10 +36,16 @@ static const char *BMP_Error_Invalid_File_Descriptor =
                     "Not enough memory to read the image",
                   *BMP_Error_Failed_to_Read_Image_Data =
                     "Failed to read the image data",
+                  *BMP_Error_Failed_to_Map_Image_Data =
+                    "Failed to map the image data into memory",
                   *BMP_Error_Invalid_Pixel_Offset_or_DIB_Header_Size =
                     "Invalid pixel offset or DIB header size",
                   *BMP_Error_Failed_to_Calculate_Padding =
                     "Failed to calculate padding information",
+                  *BMP_Error_Unsupported_Row_Streaming =
+                    "Rows with less than 8 bits per pixel can not be streamed",
+                  *BMP_Error_Invalid_Region =
+                    "The region is empty or does not lie within the image",
 
                   *BMP_Error_Failed_to_Write_File_Header =
                     "Failed to write the bitmap file header",
@@ -39,11 +53,23 @@ static const char *BMP_Error_Invalid_File_Descriptor =
                     "Failed to write the DIB header",
 
                   *BMP_Error_Failed_to_Write_Image_Data =
-                    "Failed to write the image data";
+                    "Failed to write the image data",
+                  *BMP_Error_Not_Enough_Memory_to_Write =
+                    "Not enough memory to write the image",
+                  *BMP_Error_Failed_to_Map_Output =
+                    "Failed to map the destination file into memory";
 
 static const int BMP_First_Magic_Byte  = 0x42,
                  BMP_Second_Magic_Byte = 0x4D;
 
+static const uint32_t BMP_Compression_RGB       = 0,
+                      BMP_Compression_Bitfields = 3;
+
+/* The only channel layout accepted for BI_BITFIELDS, BGRA in memory. */
+static const uint32_t BMP_Bitfields_Color_Masks[3] = {
+    0x00FF0000, 0x0000FF00, 0x000000FF
+};
+
 struct _bmp_file_header
 {
     uint8_t  signature[2];
@@ -71,56 +97,291 @@ struct _bmp_dib_header
 
 typedef struct _bmp_dib_header bmp_dib_header;
 
+/* The file header and the 40-byte part of the DIB header, read before anything else. */
+#define BMP_HEADERS_SIZE (sizeof(bmp_file_header) + sizeof(bmp_dib_header))
+
+/*
+    Tiled images keep their pixels in square tiles stored one after another,
+    row by row. Every tile is surrounded by a halo of copied neighbour pixels,
+    or of edge pixels at the image border, so a neighbourhood of up to
+    BMP_TILE_HALO pixels never leaves the tile.
+*/
+#define BMP_TILE_SIZE 64
+#define BMP_TILE_HALO 1
+#define BMP_TILE_STRIDE (BMP_TILE_SIZE + 2 * BMP_TILE_HALO)
+
 typedef struct _bmp_image
 {
     bmp_file_header file_header;
     bmp_dib_header dib_header;
+    size_t extra_header_size;
+    uint8_t *extra_header_data;     /* the rest of the DIB header, color masks and the color table       */
     size_t payload_size;
     uint8_t *payload;
+    uint8_t *mapping;
+    size_t mapping_size;
 
     /* Convenience Variables */
     uint8_t *raw_pixels;            /* start of pixel array in the payload                               */
-    uint8_t *pixels;                /* start of pixel array without padding aligned on a 64-bit boundary */
+    uint8_t *pixels;                /* start of pixel array, in the payload if the file's format is kept */
+    size_t row_stride;              /* the distance between the rows of `pixels` or of a plane in bytes  */
+    size_t bytes_per_pixel;         /* 1, 3 or 4 bytes, set to 4 to widen 24 bpp or 3 to expand indices  */
+    bool planar;                    /* set to keep each channel of `pixels` in a separate plane          */
+    size_t plane_size;              /* the aligned size of one channel plane in planar images            */
+    bool tiled;                     /* set to keep `pixels` in tiles with a halo                         */
+    size_t tile_size;               /* the size of one tile including its halo in tiled images           */
+    size_t tile_columns, tile_rows; /* the number of tiles across and down in tiled images               */
+    uint8_t *color_table;           /* BGRX entries of indexed images inside `extra_header_data`         */
+    size_t color_count;             /* the number of entries in `color_table`                            */
     size_t absolute_image_width;    /* abs(dib_header.image_width)                                       */
     size_t absolute_image_height;   /* abs(dib_header.image_height)                                      */
     size_t pixel_row_padding;       /* the padding after each row of pixels                              */
     size_t image_size;              /* the total size of the image part in bytes                         */
-    size_t aligned_image_size;      /* the total size of the aligned image part without padding          */
+    size_t aligned_image_size;      /* the size of `pixels` with room for one vector past the image      */
 } bmp_image;
 
+/*
+    A rectangle of pixels, `y` counts rows from the top of the image as it is
+    displayed, whatever the order of the rows in the file.
+*/
+typedef struct _bmp_region
+{
+    size_t x, y;
+    size_t width, height;
+} bmp_region;
+
+typedef struct _bmp_image_output
+{
+    bmp_file_header file_header;
+    bmp_dib_header dib_header;
+    struct iovec *vectors;          /* the headers followed by the rows and their padding                */
+    size_t vector_count;
+    uint8_t *staging;               /* rows packed again for widened, planar, tiled and sub-byte pixels  */
+    size_t size;                    /* the total number of bytes in `vectors`                            */
+} bmp_image_output;
+
+/* O_DIRECT writes cover whole blocks of this size at offsets aligned to it. */
+#define BMP_DIRECT_ALIGNMENT 4096
+#define BMP_DIRECT_CHUNK_SIZE (1024 * 1024)
+
+/*
+    Writes rows of an image filtered in place to their offsets in a regular
+    destination file as soon as they are finished, from any thread. Rows
+    finished by several callers are written by the last one.
+*/
+typedef struct _bmp_row_writer
+{
+    bmp_image *image;
+    int file_number;                /* the destination, written with pwrite                              */
+    int direct_file_number;         /* the destination opened again with O_DIRECT, -1 if not used         */
+    size_t pixel_array_offset;      /* the offset of the first row in the destination                    */
+    size_t row_size;                /* the bytes of pixels in a row                                      */
+    size_t file_row_size;           /* the bytes of a row and its padding in the destination             */
+    volatile size_t *row_progress;  /* the bytes of each row finished so far                             */
+    volatile bool failed;
+} bmp_row_writer;
+
+/*
+    The destination file mapped into memory with its headers written, so
+    filters can write their results straight into the page cache.
+*/
+typedef struct _bmp_mapped_output
+{
+    uint8_t *mapping;
+    size_t mapping_size;            /* the file size plus anonymous slack for the vector kernels         */
+    uint8_t *pixels;                /* the pixel array in the mapping, rows `image->row_stride` apart     */
+} bmp_mapped_output;
+
+/*
+    Reads bands of rows of a regular source file straight into their place
+    in the payload from any thread, so the threads filtering a band do not
+    wait for the rest of the image. Bands of different threads must not
+    overlap.
+*/
+typedef struct _bmp_row_reader
+{
+    bmp_image *image;
+    int file_number;                /* the source, read with pread                                       */
+    size_t pixel_array_offset;      /* the offset of the first row in the source                         */
+    size_t row_size;                /* the bytes of pixels in a row                                      */
+    size_t file_row_size;           /* the bytes of a row and its padding in the source                  */
+    volatile bool failed;
+} bmp_row_reader;
+
 static inline void bmp_init_image_structure(bmp_image *image);
 static inline void bmp_free_image_structure(bmp_image *image);
 
+static void bmp_parse_image_headers(
+                const uint8_t *data,
+                size_t size,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void bmp_parse_extra_headers(
+                bmp_image *image,
+                const char **error_message
+            );
+
 static void bmp_open_image_headers(
                 FILE *file_descriptor,
                 bmp_image *image,
                 const char **error_message
             );
 
+static void bmp_allocate_image_payload(
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void bmp_prepare_image_data(
+                bmp_image *image,
+                const char **error_message
+            );
+
 static void bmp_read_image_data(
                 FILE *file_descriptor,
                 bmp_image *image,
                 const char **error_message
             );
 
+static void bmp_map_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
 static void bmp_write_image_headers(
                 FILE *file_descriptor,
                 bmp_image *image,
                 const char **error_message
             );
 
-static void bmp_write_image_data(
+static void bmp_write_image(
                 FILE *file_descriptor,
                 bmp_image *image,
                 const char **error_message
             );
 
+static void bmp_splice_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void bmp_prepare_image_output(
+                bmp_image *image,
+                bmp_image_output *output,
+                const char **error_message
+            );
+
+static bool bmp_can_write_rows_at(
+                FILE *file_descriptor,
+                bmp_image *image
+            );
+
+static void bmp_open_row_writer(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bool direct,
+                bmp_row_writer *writer,
+                const char **error_message
+            );
+
+static void bmp_write_finished_rows(
+                bmp_row_writer *writer,
+                size_t first_byte,
+                size_t byte_count
+            );
+
+static void bmp_close_row_writer(
+                bmp_row_writer *writer,
+                const char **error_message
+            );
+
+static void bmp_map_image_output(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bmp_mapped_output *output,
+                const char **error_message
+            );
+
+static void bmp_unmap_image_output(bmp_mapped_output *output);
+
+static bool bmp_can_read_rows_at(
+                FILE *file_descriptor,
+                bmp_image *image
+            );
+
+static void bmp_open_row_reader(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bmp_row_reader *reader,
+                const char **error_message
+            );
+
+static void bmp_read_rows(
+                bmp_row_reader *reader,
+                size_t first_byte,
+                size_t byte_count
+            );
+
+static void bmp_close_row_reader(
+                bmp_row_reader *reader,
+                const char **error_message
+            );
+
+static void bmp_free_image_output(bmp_image_output *output);
+
+static void bmp_release_image_payload(bmp_image *image);
+
+static void bmp_begin_image_rows(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void bmp_read_image_rows(
+                FILE *file_descriptor,
+                bmp_image *image,
+                uint8_t *pixels,
+                size_t row_count,
+                const char **error_message
+            );
+
+static void bmp_write_image_rows(
+                FILE *file_descriptor,
+                bmp_image *image,
+                uint8_t *pixels,
+                size_t row_count,
+                const char **error_message
+            );
+
+static void bmp_read_image_region(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const bmp_region *region,
+                size_t halo,
+                bmp_region *inner_region,
+                const char **error_message
+            );
+
+static void bmp_crop_image(
+                bmp_image *image,
+                const bmp_region *inner_region,
+                const char **error_message
+            );
+
+static bool bmp_is_grayscale(bmp_image *image);
+
 static inline uint8_t *bmp_sample_pixel(
                            uint8_t *pixels,
                            ssize_t x,
                            ssize_t y,
                            size_t absolute_image_width,
-                           size_t absolute_image_height
+                           size_t absolute_image_height,
+                           size_t bytes_per_pixel,
+                           size_t row_stride
                        );
 
 static inline uint8_t *bmp_sample_raw_pixel(
@@ -129,7 +390,8 @@ static inline uint8_t *bmp_sample_raw_pixel(
                            ssize_t y,
                            size_t absolute_image_width,
                            size_t absolute_image_height,
-                           size_t row_padding
+                           size_t bytes_per_pixel,
+                           size_t row_stride
                        );
 
 #include "bmp.impl.h.c"
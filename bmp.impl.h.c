@@ -1,40 +1,2412 @@
 #include "bmp.h"
 #include "utils.h"
+#include "image_buffer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#ifndef O_DIRECT
+#define O_DIRECT 040000
+#endif
+
+static uint8_t BMP_Row_Padding[4] = { 0 };
 
 static inline void bmp_init_image_structure(bmp_image *image)
 {
-    if (NULL != image) {
-        memset(image, 0, sizeof(*image));
+    if (NULL != image) {
+        memset(image, 0, sizeof(*image));
+    }
+}
+
+static bool _bmp_pixels_are_in_payload(bmp_image *image);
+static void _bmp_unmap_image(bmp_image *image);
+
+static inline void bmp_free_image_structure(bmp_image *image)
+{
+    if (NULL != image) {
+        if (NULL != image->pixels) {
+            if (!_bmp_pixels_are_in_payload(image)) {
+                image_buffer_free(image->pixels);
+            }
+            image->pixels = NULL;
+        }
+        if (NULL != image->mapping) {
+            _bmp_unmap_image(image);
+        } else if (NULL != image->payload) {
+            image_buffer_free(image->payload);
+            image->payload = NULL;
+        }
+        if (NULL != image->extra_header_data) {
+            free(image->extra_header_data);
+            image->extra_header_data = NULL;
+        }
+    }
+}
+
+static void bmp_parse_image_headers(
+                const uint8_t *data,
+                size_t size,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    size_t bmp_header_size =
+        sizeof(image->file_header);
+    size_t dib_header_size =
+        sizeof(image->dib_header);
+    size_t total_header_size =
+        bmp_header_size + dib_header_size;
+
+    if (size < bmp_header_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Read_File_Header;
+        }
+
+        goto end;
+    }
+    memcpy(&image->file_header, data, bmp_header_size);
+
+    if (image->file_header.signature[0] != BMP_First_Magic_Byte ||
+        image->file_header.signature[1] != BMP_Second_Magic_Byte) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Signature;
+        }
+
+        goto end;
+    }
+
+    if (size < total_header_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Read_DIB_Header;
+        }
+
+        goto end;
+    }
+    memcpy(&image->dib_header, data + bmp_header_size, dib_header_size);
+
+    if (image->dib_header.dib_header_size < dib_header_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_DIB_Header_Size;
+        }
+
+        goto end;
+    }
+
+    /* Rows, bands and tiles are all sized from the dimensions, none of them can be empty. */
+    if (0 == image->dib_header.image_width || 0 == image->dib_header.image_height) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (image->file_header.pixel_array_offset < total_header_size ||
+        image->file_header.pixel_array_offset < bmp_header_size + image->dib_header.dib_header_size ||
+        image->file_header.pixel_array_offset >= image->file_header.file_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Pixel_Offset_or_DIB_Header_Size;
+        }
+
+        goto end;
+    }
+
+    /*
+        Everything up to the pixel array is read instead of skipped: BI_BITFIELDS
+        masks live right after the 40-byte part of the DIB header, whether they
+        belong to a larger header or follow a BITMAPINFOHEADER.
+    */
+    size_t extra_header_size =
+        (size_t) image->file_header.pixel_array_offset - total_header_size;
+    if (0 < extra_header_size) {
+        image->extra_header_data = (uint8_t *) malloc(extra_header_size);
+        if (NULL == image->extra_header_data) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Not_Enough_Memory_to_Read;
+            }
+
+            goto end;
+        }
+        image->extra_header_size = extra_header_size;
+    }
+
+end:
+    return;
+}
+
+static void bmp_parse_extra_headers(
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    size_t dib_header_size =
+        sizeof(image->dib_header);
+    size_t total_header_size =
+        sizeof(image->file_header) + dib_header_size;
+    size_t extra_header_size =
+        image->extra_header_size;
+
+    uint16_t bits_per_pixel =
+        image->dib_header.bits_per_pixel;
+    if (1  != bits_per_pixel && 4  != bits_per_pixel && 8 != bits_per_pixel &&
+        24 != bits_per_pixel && 32 != bits_per_pixel) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Unsupported_Color_Depth;
+        }
+
+        goto end;
+    }
+
+    /* The color table follows the whole DIB header, an empty count means a full table. */
+    if (8 >= bits_per_pixel) {
+        size_t color_count =
+            0 == image->dib_header.colors_in_color_table ?
+                (size_t) 1 << bits_per_pixel :
+                (size_t) image->dib_header.colors_in_color_table;
+        size_t color_table_offset =
+            (size_t) image->dib_header.dib_header_size - dib_header_size;
+
+        if (color_count > ((size_t) 1 << bits_per_pixel) ||
+            color_table_offset + color_count * 4 > extra_header_size) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Invalid_Color_Table;
+            }
+
+            goto end;
+        }
+
+        image->color_table =
+            image->extra_header_data + color_table_offset;
+        image->color_count =
+            color_count;
+    }
+
+    if (BMP_Compression_Bitfields == image->dib_header.compression) {
+        if (32 != image->dib_header.bits_per_pixel ||
+            sizeof(BMP_Bitfields_Color_Masks) > extra_header_size ||
+            0 != memcmp(
+                     image->extra_header_data,
+                     BMP_Bitfields_Color_Masks,
+                     sizeof(BMP_Bitfields_Color_Masks)
+                 )) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Unsupported_Compression;
+            }
+
+            goto end;
+        }
+    } else if (BMP_Compression_RGB != image->dib_header.compression) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Unsupported_Compression;
+        }
+
+        goto end;
+    }
+
+    if (image->file_header.file_size <= total_header_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Size_Information;
+        }
+
+        goto end;
+    }
+
+end:
+    return;
+}
+
+static void bmp_open_image_headers(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    uint8_t headers[BMP_HEADERS_SIZE];
+    size_t headers_size =
+        fread(headers, 1, sizeof(headers), file_descriptor);
+
+    bmp_parse_image_headers(headers, headers_size, image, error_message);
+    if (NULL != *error_message) {
+        goto end;
+    }
+
+    if (0 < image->extra_header_size &&
+        !fread(image->extra_header_data, image->extra_header_size, 1, file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Read_Rest_of_Headers;
+        }
+
+        goto end;
+    }
+
+    bmp_parse_extra_headers(image, error_message);
+
+end:
+    return;
+}
+
+/* Pixels kept in the file's format are used in place and go away with the payload. */
+static bool _bmp_pixels_are_in_payload(bmp_image *image)
+{
+    return NULL != image->pixels &&
+           image->pixels == image->raw_pixels;
+}
+
+/*
+    Pixels in a mapping of their own, the source file's or an image buffer's,
+    keep their pages until it is unmapped. Heap pixels do not.
+*/
+static bool _bmp_pixels_are_mapped(bmp_image *image)
+{
+    if (!_bmp_pixels_are_in_payload(image)) {
+        return image_buffer_is_mapped(image->pixels);
+    }
+
+    return NULL != image->mapping || image_buffer_is_mapped(image->payload);
+}
+
+static void _bmp_unmap_image(bmp_image *image)
+{
+    if (NULL != image->mapping) {
+        munmap(image->mapping, image->mapping_size);
+        image->mapping = NULL;
+        image->mapping_size = 0;
+        image->payload = NULL;
+    }
+}
+
+/* Rounds up to whole 64-byte blocks and adds one more for the vector kernels reading past the end. */
+static inline size_t _bmp_aligned_payload_size(size_t size)
+{
+    return (size + 63) / 64 * 64 + 64;
+}
+
+static void _bmp_calculate_layout(bmp_image *image)
+{
+    size_t width =
+        image->dib_header.image_width < 0 ?
+            (size_t) -image->dib_header.image_width :
+            (size_t)  image->dib_header.image_width;
+
+    size_t height =
+        image->dib_header.image_height < 0 ?
+            (size_t) -image->dib_header.image_height :
+            (size_t)  image->dib_header.image_height;
+
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t file_bytes_per_pixel =
+        bits_per_pixel < 8 ? 1 : bits_per_pixel / 8;
+
+    /*
+        On request 24 bpp data is widened into the 4-byte layout and color
+        indices are expanded into 24 bpp colors, otherwise `pixels` keeps the
+        pixel size of the file with one byte per color index. Planes are never
+        widened, color indices already form a single plane.
+    */
+    bool widen =
+        4 == image->bytes_per_pixel && 24 == bits_per_pixel && !image->planar;
+    bool expand =
+        3 == image->bytes_per_pixel && 8 >= bits_per_pixel;
+    if (8 >= bits_per_pixel) {
+        image->planar = false;
+    }
+    /* Tiles hold whole bytes per pixel in the file's format or expanded colors. */
+    if (widen || image->planar || (8 > bits_per_pixel && !expand)) {
+        image->tiled = false;
+    }
+    if (!widen && !expand) {
+        image->bytes_per_pixel = file_bytes_per_pixel;
+    }
+
+    size_t file_row_size =
+        (width * bits_per_pixel + 7) / 8;
+
+    size_t padding = bits_per_pixel;
+    padding = (padding * width + 31) / 32 * 4 - file_row_size;
+
+    image->absolute_image_width  =
+        width;
+    image->absolute_image_height =
+        height;
+    image->pixel_row_padding =
+        padding;
+    image->row_stride =
+        image->planar ? width : width * image->bytes_per_pixel;
+    image->image_size =
+        height * (file_row_size + padding);
+
+    size_t alignment = 64;
+    size_t packed_image_size = height * width * image->bytes_per_pixel;
+    size_t aligned_image_size = packed_image_size == 0 ? 0 :
+        (((packed_image_size - 1) / alignment) + 1) * alignment;
+    aligned_image_size += 64;
+
+    /* Every plane starts on a 64-byte boundary and has room for one vector past its end. */
+    if (image->planar) {
+        size_t plane_size = height * width;
+        plane_size = plane_size == 0 ? 0 :
+            (((plane_size - 1) / alignment) + 1) * alignment;
+        plane_size += 64;
+
+        image->plane_size = plane_size;
+        aligned_image_size = plane_size * image->bytes_per_pixel;
+    } else {
+        image->plane_size = 0;
+    }
+
+    if (image->tiled) {
+        image->tile_columns = (width + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE;
+        image->tile_rows = (height + BMP_TILE_SIZE - 1) / BMP_TILE_SIZE;
+        image->tile_size = BMP_TILE_STRIDE * BMP_TILE_STRIDE * image->bytes_per_pixel;
+
+        size_t tiled_image_size = image->tile_columns * image->tile_rows * image->tile_size;
+        aligned_image_size = tiled_image_size == 0 ? 0 :
+            (((tiled_image_size - 1) / alignment) + 1) * alignment;
+        aligned_image_size += 64;
+    } else {
+        image->tile_columns = 0;
+        image->tile_rows = 0;
+        image->tile_size = 0;
+    }
+
+    image->aligned_image_size = aligned_image_size;
+}
+
+/*
+    Byte permutations for 64 pixels of 24 bpp data spread over three 64-byte
+    vectors. `deinterleave[c]` picks channel `c` of every pixel out of the
+    192 packed bytes, `interleave[k]` builds the k-th 64 bytes of packed data
+    out of the B, G and R planes. Lanes set in the masks come from the third
+    vector, the rest from the first two. They are only used when the
+    processor supports AVX-512 VBMI.
+*/
+typedef struct _bmp_shuffle_tables
+{
+    uint8_t deinterleave[3][64];
+    uint8_t interleave[3][64];
+    uint64_t deinterleave_masks[3];
+    uint64_t interleave_masks[3];
+    bool vbmi;
+} __attribute__((aligned(64))) bmp_shuffle_tables;
+
+static void _bmp_build_shuffle_tables(bmp_shuffle_tables *tables)
+{
+#if defined x86_64_CPU
+    __builtin_cpu_init();
+    tables->vbmi =
+        __builtin_cpu_supports("avx512vbmi");
+#else
+    tables->vbmi =
+        false;
+#endif
+
+    for (size_t k = 0; k < 3; ++k) {
+        tables->deinterleave_masks[k] = 0;
+        tables->interleave_masks[k] = 0;
+
+        for (size_t lane = 0; lane < 64; ++lane) {
+            size_t source =
+                lane * 3 + k;
+            tables->deinterleave[k][lane] =
+                (uint8_t) source;
+            if (source >= 128) {
+                tables->deinterleave_masks[k] |= (uint64_t) 1 << lane;
+            }
+
+            size_t destination =
+                k * 64 + lane;
+            size_t channel =
+                destination % 3;
+            tables->interleave[k][lane] =
+                (uint8_t) (channel * 64 + destination / 3);
+            if (2 == channel) {
+                tables->interleave_masks[k] |= (uint64_t) 1 << lane;
+            }
+        }
+    }
+}
+
+#if defined x86_64_CPU
+
+/*
+    Splits the leading runs of 64 pixels of a 24 bpp row into the planes
+    with two-source byte permutations (AVX-512 VBMI) and returns how many
+    pixels it split.
+*/
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t _bmp_deinterleave_row_vbmi(
+                  uint8_t *blue,
+                  size_t plane_size,
+                  const uint8_t *source,
+                  size_t width,
+                  const bmp_shuffle_tables *tables
+              )
+{
+    size_t x =
+        0;
+
+    for (; x + 64 <= width; x += 64, source += 192, blue += 64) {
+        __asm__ __volatile__ (
+            "vmovdqu8 (%0), %%zmm0\n\t"
+            "vmovdqu8 0x40(%0), %%zmm1\n\t"
+            "vmovdqu8 0x80(%0), %%zmm2\n\t"
+
+            "vmovdqa64 (%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq (%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, (%1)\n\t"
+
+            "vmovdqa64 0x40(%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq 0x8(%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, (%1,%3)\n\t"
+
+            "vmovdqa64 0x80(%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq 0x10(%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, (%1,%3,2)\n\t"
+        ::
+            "r"(source), "r"(blue), "r"(tables->deinterleave), "r"(plane_size),
+            "r"(tables->deinterleave_masks)
+        :
+            "%zmm0", "%zmm1", "%zmm2", "%zmm3", "%zmm4", "%k1", "memory"
+        );
+    }
+
+    return x;
+}
+
+/* The reverse of `_bmp_deinterleave_row_vbmi`. */
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static size_t _bmp_interleave_row_vbmi(
+                  uint8_t *destination,
+                  const uint8_t *blue,
+                  size_t plane_size,
+                  size_t width,
+                  const bmp_shuffle_tables *tables
+              )
+{
+    size_t x =
+        0;
+
+    for (; x + 64 <= width; x += 64, destination += 192, blue += 64) {
+        __asm__ __volatile__ (
+            "vmovdqu8 (%1), %%zmm0\n\t"
+            "vmovdqu8 (%1,%3), %%zmm1\n\t"
+            "vmovdqu8 (%1,%3,2), %%zmm2\n\t"
+
+            "vmovdqa64 (%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq (%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, (%0)\n\t"
+
+            "vmovdqa64 0x40(%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq 0x8(%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, 0x40(%0)\n\t"
+
+            "vmovdqa64 0x80(%2), %%zmm3\n\t"
+            "vmovdqa64 %%zmm3, %%zmm4\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "kmovq 0x10(%4), %%k1\n\t"
+            "vpermb %%zmm2, %%zmm3, %%zmm4%{%%k1%}\n\t"
+            "vmovdqu8 %%zmm4, 0x80(%0)\n\t"
+        ::
+            "r"(destination), "r"(blue), "r"(tables->interleave), "r"(plane_size),
+            "r"(tables->interleave_masks)
+        :
+            "%zmm0", "%zmm1", "%zmm2", "%zmm3", "%zmm4", "%k1", "memory"
+        );
+    }
+
+    return x;
+}
+
+#endif
+
+/* Splits one row of packed pixels into the planes starting at `position`. */
+static inline void _bmp_deinterleave_row(
+                       uint8_t *pixels,
+                       size_t plane_size,
+                       size_t position,
+                       const uint8_t *source,
+                       size_t width,
+                       size_t bytes_per_pixel,
+                       const bmp_shuffle_tables *tables
+                   )
+{
+    size_t x =
+        0;
+
+#if defined x86_64_CPU
+    if (tables->vbmi && 3 == bytes_per_pixel) {
+        x =
+            _bmp_deinterleave_row_vbmi(pixels + position, plane_size, source, width, tables);
+        source += x * 3;
+    }
+#endif
+
+    for (; x < width; ++x, source += bytes_per_pixel) {
+        for (size_t channel = 0; channel < bytes_per_pixel; ++channel) {
+            pixels[channel * plane_size + position + x] = source[channel];
+        }
+    }
+}
+
+/* Packs one row of pixels starting at `position` in the planes. */
+static inline void _bmp_interleave_row(
+                       uint8_t *destination,
+                       const uint8_t *pixels,
+                       size_t plane_size,
+                       size_t position,
+                       size_t width,
+                       size_t bytes_per_pixel,
+                       const bmp_shuffle_tables *tables
+                   )
+{
+    size_t x =
+        0;
+
+#if defined x86_64_CPU
+    if (tables->vbmi && 3 == bytes_per_pixel) {
+        x =
+            _bmp_interleave_row_vbmi(destination, pixels + position, plane_size, width, tables);
+        destination += x * 3;
+    }
+#endif
+
+    for (; x < width; ++x, destination += bytes_per_pixel) {
+        for (size_t channel = 0; channel < bytes_per_pixel; ++channel) {
+            destination[channel] = pixels[channel * plane_size + position + x];
+        }
+    }
+}
+
+static inline void _bmp_widen_row(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       size_t width
+                   )
+{
+    for (size_t x = 0; x < width; ++x, destination += 4, source += 3) {
+        destination[0] = source[0];
+        destination[1] = source[1];
+        destination[2] = source[2];
+        destination[3] = 0;
+    }
+}
+
+static inline void _bmp_narrow_row(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       size_t width
+                   )
+{
+    for (size_t x = 0; x < width; ++x, destination += 3, source += 4) {
+        destination[0] = source[0];
+        destination[1] = source[1];
+        destination[2] = source[2];
+    }
+}
+
+/*
+    Unpacks one row of color indices into a byte per pixel or, when
+    `bytes_per_pixel` is 3, into the BGR colors of the color table. The
+    leftmost pixel is in the most significant bits. Indices past the end of
+    the color table are black.
+*/
+static inline void _bmp_unpack_row(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       size_t width,
+                       size_t bits_per_pixel,
+                       const uint8_t *color_table,
+                       size_t color_count,
+                       size_t bytes_per_pixel
+                   )
+{
+    static const uint8_t Black[4] = { 0 };
+
+    size_t pixels_per_byte =
+        8 / bits_per_pixel;
+    uint8_t mask =
+        (uint8_t) ((1u << bits_per_pixel) - 1u);
+
+    for (size_t x = 0; x < width; ++x, destination += bytes_per_pixel) {
+        size_t shift =
+            (pixels_per_byte - 1 - x % pixels_per_byte) * bits_per_pixel;
+        uint8_t index =
+            (uint8_t) ((source[x / pixels_per_byte] >> shift) & mask);
+
+        if (1 == bytes_per_pixel) {
+            destination[0] = index;
+        } else {
+            const uint8_t *color =
+                index < color_count ? color_table + index * 4 : Black;
+
+            destination[0] = color[0];
+            destination[1] = color[1];
+            destination[2] = color[2];
+        }
+    }
+}
+
+/* Packs one row of byte-sized color indices into `bits_per_pixel` bits each. */
+static inline void _bmp_pack_row(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       size_t width,
+                       size_t bits_per_pixel
+                   )
+{
+    size_t pixels_per_byte =
+        8 / bits_per_pixel;
+    uint8_t mask =
+        (uint8_t) ((1u << bits_per_pixel) - 1u);
+
+    memset(destination, 0, (width * bits_per_pixel + 7) / 8);
+    for (size_t x = 0; x < width; ++x) {
+        size_t shift =
+            (pixels_per_byte - 1 - x % pixels_per_byte) * bits_per_pixel;
+
+        destination[x / pixels_per_byte] |= (uint8_t) ((source[x] & mask) << shift);
+    }
+}
+
+/*
+    Copies the BMP_TILE_STRIDE pixels of a tile row starting at `first_x` out
+    of an image row. Pixels left and right of the image repeat its edge.
+*/
+static inline void _bmp_tile_row(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       ssize_t first_x,
+                       size_t width,
+                       size_t bytes_per_pixel
+                   )
+{
+    for (size_t x = 0; x < BMP_TILE_STRIDE;) {
+        ssize_t source_x =
+            first_x + (ssize_t) x;
+
+        if (0 <= source_x && (size_t) source_x < width) {
+            size_t run =
+                UTILS_MIN(BMP_TILE_STRIDE - x, width - (size_t) source_x);
+
+            memcpy(
+                destination + x * bytes_per_pixel,
+                source + (size_t) source_x * bytes_per_pixel,
+                run * bytes_per_pixel
+            );
+            x += run;
+        } else {
+            size_t edge_x =
+                0 > source_x ? 0 : width - 1;
+
+            memcpy(
+                destination + x * bytes_per_pixel,
+                source + edge_x * bytes_per_pixel,
+                bytes_per_pixel
+            );
+            ++x;
+        }
+    }
+}
+
+/*
+    Fills the tiles of `image->pixels` from the rows of the payload, rows
+    above and below the image repeat its edge. Color indices are expanded
+    into a scratch row first, every other format is copied as it is.
+*/
+static bool _bmp_tile_pixels(bmp_image *image)
+{
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t bytes_per_pixel =
+        image->bytes_per_pixel;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t padded_row_size =
+        (width * bits_per_pixel + 7) / 8 + image->pixel_row_padding;
+    size_t tile_row_size =
+        BMP_TILE_STRIDE * bytes_per_pixel;
+
+    uint8_t *scratch_row =
+        NULL;
+    if (bytes_per_pixel * 8 != bits_per_pixel) {
+        scratch_row = (uint8_t *) malloc(width * bytes_per_pixel);
+        if (NULL == scratch_row) {
+            return false;
+        }
+    }
+
+    for (size_t tile_y = 0; tile_y < image->tile_rows; ++tile_y) {
+        for (size_t row = 0; row < BMP_TILE_STRIDE; ++row) {
+            ssize_t y =
+                (ssize_t) (tile_y * BMP_TILE_SIZE + row) - BMP_TILE_HALO;
+            y = UTILS_CLAMP(y, 0, (ssize_t) height - 1);
+
+            const uint8_t *source =
+                image->raw_pixels + (size_t) y * padded_row_size;
+            if (NULL != scratch_row) {
+                _bmp_unpack_row(
+                    scratch_row,
+                    source,
+                    width,
+                    bits_per_pixel,
+                    image->color_table,
+                    image->color_count,
+                    bytes_per_pixel
+                );
+                source = scratch_row;
+            }
+
+            uint8_t *tile =
+                image->pixels + tile_y * image->tile_columns * image->tile_size;
+            for (size_t tile_x = 0; tile_x < image->tile_columns; ++tile_x, tile += image->tile_size) {
+                _bmp_tile_row(
+                    tile + row * tile_row_size,
+                    source,
+                    (ssize_t) (tile_x * BMP_TILE_SIZE) - BMP_TILE_HALO,
+                    width,
+                    bytes_per_pixel
+                );
+            }
+        }
+    }
+
+    free(scratch_row);
+
+    size_t tiled_image_size =
+        image->tile_columns * image->tile_rows * image->tile_size;
+    memset(image->pixels + tiled_image_size, 0, image->aligned_image_size - tiled_image_size);
+
+    return true;
+}
+
+/* Copies the pixels of row `y` out of the tiles of `image->pixels`, leaving the halos behind. */
+static void _bmp_untile_row(
+                uint8_t *destination,
+                bmp_image *image,
+                size_t y
+            )
+{
+    size_t width =
+        image->absolute_image_width;
+    size_t bytes_per_pixel =
+        image->bytes_per_pixel;
+
+    const uint8_t *tile =
+        image->pixels +
+            (y / BMP_TILE_SIZE) * image->tile_columns * image->tile_size +
+            ((y % BMP_TILE_SIZE + BMP_TILE_HALO) * BMP_TILE_STRIDE + BMP_TILE_HALO) * bytes_per_pixel;
+    for (size_t x = 0; x < width; x += BMP_TILE_SIZE, tile += image->tile_size) {
+        memcpy(
+            destination + x * bytes_per_pixel,
+            tile,
+            UTILS_MIN(width - x, (size_t) BMP_TILE_SIZE) * bytes_per_pixel
+        );
+    }
+}
+
+/* Expanded colors are written back as a 24 bpp image without a color table. */
+static void _bmp_finish_expanded_colors(bmp_image *image)
+{
+    if (8 < image->dib_header.bits_per_pixel || 3 != image->bytes_per_pixel) {
+        return;
+    }
+
+    image->dib_header.bits_per_pixel =
+        24;
+    image->dib_header.colors_in_color_table =
+        0;
+    image->dib_header.important_color_count =
+        0;
+    image->color_table =
+        NULL;
+    image->color_count =
+        0;
+
+    _bmp_calculate_layout(image);
+}
+
+static void _bmp_prepare_pixels(
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    image->raw_pixels =
+        image->payload;
+
+    _bmp_calculate_layout(image);
+
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t padding =
+        image->pixel_row_padding;
+    size_t bytes_per_pixel =
+        image->bytes_per_pixel;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t row_size =
+        width * bytes_per_pixel;
+    size_t file_row_size =
+        (width * bits_per_pixel + 7) / 8;
+    size_t aligned_image_size =
+        image->aligned_image_size;
+
+    if (image->image_size > image->payload_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Calculate_Padding;
+        }
+
+        goto end;
+    }
+
+    /*
+        Pixels in the file's format are used in place, the filters step over
+        the row padding. The payload has room for one vector past the image.
+    */
+    if (bytes_per_pixel * 8 == bits_per_pixel && !image->planar && !image->tiled) {
+        image->pixels = image->raw_pixels;
+        image->row_stride = file_row_size + padding;
+        image->aligned_image_size = _bmp_aligned_payload_size(image->image_size);
+
+        goto end;
+    }
+
+    image->pixels = (uint8_t *) image_buffer_allocate(aligned_image_size, true);
+    if (NULL == image->pixels) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Not_Enough_Memory_to_Read;
+        }
+
+        goto end;
+    }
+
+    if (image->planar) {
+        bmp_shuffle_tables tables;
+        _bmp_build_shuffle_tables(&tables);
+
+        memset(image->pixels, 0, aligned_image_size);
+        for (size_t y = 0; y < height; ++y) {
+            _bmp_deinterleave_row(
+                image->pixels,
+                image->plane_size,
+                y * width,
+                image->raw_pixels + y * (file_row_size + padding),
+                width,
+                bytes_per_pixel,
+                &tables
+            );
+        }
+
+        goto end;
+    }
+
+    if (image->tiled) {
+        if (!_bmp_tile_pixels(image)) {
+            image_buffer_free(image->pixels);
+            image->pixels = NULL;
+
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Not_Enough_Memory_to_Read;
+            }
+
+            goto end;
+        }
+
+        _bmp_finish_expanded_colors(image);
+
+        goto end;
+    }
+
+    for (
+        size_t y = 0,
+               src_linear_position  = 0,
+               dest_linear_position = 0;
+        y < height;
+        ++y,
+        src_linear_position += file_row_size + padding,
+        dest_linear_position += row_size
+    ) {
+        if (bytes_per_pixel * 8 == bits_per_pixel) {
+            memcpy(
+                image->pixels + dest_linear_position,
+                image->raw_pixels + src_linear_position,
+                row_size
+            );
+        } else if (8 < bits_per_pixel) {
+            _bmp_widen_row(
+                image->pixels + dest_linear_position,
+                image->raw_pixels + src_linear_position,
+                width
+            );
+        } else {
+            _bmp_unpack_row(
+                image->pixels + dest_linear_position,
+                image->raw_pixels + src_linear_position,
+                width,
+                bits_per_pixel,
+                image->color_table,
+                image->color_count,
+                bytes_per_pixel
+            );
+        }
+    }
+
+    for (size_t linear_position = height * row_size; linear_position < aligned_image_size; ++linear_position) {
+        image->pixels[linear_position] = 0;
+    }
+
+    _bmp_finish_expanded_colors(image);
+
+end:
+    return;
+}
+
+static void bmp_allocate_image_payload(
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    size_t payload_size =
+        ((size_t) image->file_header.file_size) -
+            (size_t) image->file_header.pixel_array_offset;
+
+    /* The pixels may be filtered in place, the vector kernels need the room past the payload. */
+    size_t aligned_payload_size =
+        _bmp_aligned_payload_size(payload_size);
+
+    image->payload_size = payload_size;
+    image->payload = (uint8_t *) image_buffer_allocate(aligned_payload_size, false);
+    if (NULL == image->payload) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Not_Enough_Memory_to_Read;
+        }
+
+        goto end;
+    }
+
+    memset(image->payload + payload_size, 0, aligned_payload_size - payload_size);
+
+end:
+    return;
+}
+
+/* Turns a payload filled by the caller into `image->pixels`. */
+static void bmp_prepare_image_data(
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image || NULL == image->payload) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    _bmp_prepare_pixels(image, error_message);
+    if (NULL != *error_message) {
+        goto cleanup;
+    }
+
+end:
+    return;
+
+cleanup:
+    if (NULL != image->pixels && !_bmp_pixels_are_in_payload(image))
+    {
+        image_buffer_free(image->pixels);
+    }
+    image->pixels = NULL;
+
+    image_buffer_free(image->payload);
+    image->payload = NULL;
+}
+
+static void bmp_read_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    bmp_allocate_image_payload(image, error_message);
+    if (NULL != *error_message) {
+        goto end;
+    }
+
+    if (!fread(image->payload, image->payload_size, 1, file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Read_Image_Data;
+        }
+
+        image_buffer_free(image->payload);
+        image->payload = NULL;
+
+        goto end;
+    }
+
+    bmp_prepare_image_data(image, error_message);
+
+end:
+    return;
+}
+
+static void bmp_map_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    int file_number =
+        fileno(file_descriptor);
+
+    struct stat file_status;
+    if (-1 == file_number || -1 == fstat(file_number, &file_status)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    /* Pipes and other streams can not be mapped, they are read instead. */
+    if (!S_ISREG(file_status.st_mode)) {
+        bmp_read_image_data(file_descriptor, image, error_message);
+
+        goto end;
+    }
+
+    size_t pixel_array_offset =
+        (size_t) image->file_header.pixel_array_offset;
+    size_t file_size =
+        (size_t) image->file_header.file_size;
+    if (file_size > (size_t) file_status.st_size) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Read_Image_Data;
+        }
+
+        goto end;
+    }
+
+    /*
+        Reserve the file size plus slack for the over-reads of the vector
+        kernels and the aligned image size, then put the file on top of the
+        reservation. Pages past the end of the file stay anonymous and zeroed
+        instead of raising SIGBUS.
+    */
+    size_t page_size =
+        (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapping_size =
+        ((file_size + 128 - 1) / page_size + 1) * page_size;
+
+    uint8_t *mapping =
+        mmap(
+            NULL, mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0
+        );
+    if (MAP_FAILED == mapping) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Map_Image_Data;
+        }
+
+        goto end;
+    }
+
+    image->mapping = mapping;
+    image->mapping_size = mapping_size;
+
+    if (MAP_FAILED == mmap(
+                          mapping, file_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED | MAP_POPULATE,
+                          file_number, 0
+                      )) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Map_Image_Data;
+        }
+
+        goto cleanup;
+    }
+
+    madvise(mapping, file_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    image->payload_size =
+        file_size - pixel_array_offset;
+    image->payload =
+        mapping + pixel_array_offset;
+
+    _bmp_prepare_pixels(image, error_message);
+    if (NULL != *error_message) {
+        goto cleanup;
+    }
+
+end:
+    return;
+
+cleanup:
+    if (NULL != image->pixels && !_bmp_pixels_are_in_payload(image)) {
+        image_buffer_free(image->pixels);
+    }
+    image->pixels = NULL;
+
+    _bmp_unmap_image(image);
+}
+
+/*
+    Output files always get a plain BITMAPINFOHEADER followed by the color
+    masks for BI_BITFIELDS and then the pixel array. Extended DIB header
+    fields and anything else between the headers and the pixel array of the
+    source are not carried over.
+*/
+static void _bmp_prepare_output_headers(
+                bmp_image *image,
+                bmp_file_header *file_header,
+                bmp_dib_header *dib_header,
+                const uint8_t **extra_header_data,
+                size_t *extra_header_size
+            )
+{
+    *file_header = image->file_header;
+    *dib_header = image->dib_header;
+
+    *extra_header_data = NULL;
+    *extra_header_size = 0;
+    if (BMP_Compression_Bitfields == dib_header->compression) {
+        *extra_header_data = (const uint8_t *) BMP_Bitfields_Color_Masks;
+        *extra_header_size = sizeof(BMP_Bitfields_Color_Masks);
+    } else if (NULL != image->color_table) {
+        *extra_header_data = image->color_table;
+        *extra_header_size = image->color_count * 4;
+
+        dib_header->colors_in_color_table =
+            (uint32_t) image->color_count;
+    }
+
+    size_t total_header_size =
+        sizeof(*file_header) + sizeof(*dib_header) + *extra_header_size;
+
+    dib_header->dib_header_size =
+        (uint32_t) sizeof(*dib_header);
+    dib_header->image_size =
+        (uint32_t) image->image_size;
+    file_header->pixel_array_offset =
+        (uint32_t) total_header_size;
+    file_header->file_size =
+        (uint32_t) (total_header_size + image->image_size);
+}
+
+static void bmp_write_image_headers(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    bmp_file_header file_header;
+    bmp_dib_header dib_header;
+    const uint8_t *extra_header_data;
+    size_t extra_header_size;
+    _bmp_prepare_output_headers(
+        image,
+        &file_header, &dib_header,
+        &extra_header_data, &extra_header_size
+    );
+
+    size_t bmp_header_size =
+        sizeof(file_header);
+
+    if (!fwrite(&file_header, bmp_header_size, 1, file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Write_File_Header;
+        }
+
+        goto end;
+    }
+
+    size_t dib_header_size =
+        sizeof(dib_header);
+
+    if (!fwrite(&dib_header, dib_header_size, 1, file_descriptor) ||
+            (0 < extra_header_size &&
+                !fwrite(extra_header_data, extra_header_size, 1, file_descriptor))) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Write_DIB_Header;
+        }
+
+        goto end;
+    }
+
+end:
+    return;
+}
+
+static inline ssize_t _bmp_vmsplice(
+                          int file_number,
+                          const struct iovec *vectors,
+                          int vector_count
+                      )
+{
+    return (ssize_t) syscall(__NR_vmsplice, file_number, vectors, (unsigned long) vector_count, 0u);
+}
+
+/*
+    Writes all vectors, retrying after partial writes. With `splice`, the
+    pages of a pipe destination are taken from the vectors by reference, so
+    their memory must not change until the reader consumed it. Destinations
+    other than pipes are written with copies.
+*/
+static bool _bmp_write_vectors(
+                int file_number,
+                struct iovec *vectors,
+                int vector_count,
+                bool splice
+            )
+{
+    while (vector_count > 0) {
+        ssize_t bytes_written =
+            splice ?
+                _bmp_vmsplice(file_number, vectors, vector_count) :
+                writev(file_number, vectors, vector_count);
+        if (-1 == bytes_written) {
+            if (EINTR == errno) {
+                continue;
+            }
+            if (splice && (EBADF == errno || EINVAL == errno || ENOSYS == errno)) {
+                splice = false;
+
+                continue;
+            }
+
+            return false;
+        }
+
+        while (vector_count > 0 && (size_t) bytes_written >= vectors->iov_len) {
+            bytes_written -= (ssize_t) vectors->iov_len;
+            ++vectors;
+            --vector_count;
+        }
+
+        if (vector_count > 0) {
+            vectors->iov_base = (uint8_t *) vectors->iov_base + bytes_written;
+            vectors->iov_len -= (size_t) bytes_written;
+        }
+    }
+
+    return true;
+}
+
+/* Packs row `y` of widened, planar, tiled or sub-byte `image->pixels` back into the file format. */
+static void _bmp_pack_output_row(
+                uint8_t *destination,
+                bmp_image *image,
+                size_t y,
+                bmp_shuffle_tables *tables
+            )
+{
+    size_t width =
+        image->absolute_image_width;
+    size_t row_size =
+        width * image->bytes_per_pixel;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+
+    if (image->tiled) {
+        _bmp_untile_row(
+            destination,
+            image,
+            y
+        );
+    } else if (image->planar) {
+        _bmp_interleave_row(
+            destination,
+            image->pixels,
+            image->plane_size,
+            y * width,
+            width,
+            image->bytes_per_pixel,
+            tables
+        );
+    } else if (8 > bits_per_pixel) {
+        _bmp_pack_row(
+            destination,
+            image->pixels + y * row_size,
+            width,
+            bits_per_pixel
+        );
+    } else {
+        _bmp_narrow_row(
+            destination,
+            image->pixels + y * row_size,
+            width
+        );
+    }
+}
+
+/*
+    Writes the given header vectors followed by every packed row of
+    `image->pixels` and its padding, so neither the padded payload nor an
+    intermediate copy of the pixels is needed. Rows go out in batches of at
+    most IOV_MAX vectors. With `splice_pixels`, rows taken from
+    `image->pixels` as they are are spliced into pipes, the headers and
+    packed rows live in reused memory and are always copied.
+*/
+static bool _bmp_write_rows_vectored(
+                FILE *file_descriptor,
+                bmp_image *image,
+                struct iovec *header_vectors,
+                size_t header_vector_count,
+                bool splice_pixels
+            )
+{
+    if (0 != fflush(file_descriptor)) {
+        return false;
+    }
+
+    int file_number =
+        fileno(file_descriptor);
+    if (-1 == file_number) {
+        return false;
+    }
+
+    size_t padding =
+        image->pixel_row_padding;
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t row_size =
+        width * image->bytes_per_pixel;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t file_row_size =
+        (width * bits_per_pixel + 7) / 8;
+
+    struct iovec vectors[IOV_MAX];
+    size_t vector_count =
+        0;
+
+    for (size_t i = 0; i < header_vector_count; ++i) {
+        vectors[vector_count++] = header_vectors[i];
+    }
+
+    /* Widened, planar, tiled and sub-byte rows have to be packed again, they go through a small staging buffer. */
+    if (bits_per_pixel != image->bytes_per_pixel * 8 || image->planar || image->tiled) {
+        bmp_shuffle_tables tables;
+        _bmp_build_shuffle_tables(&tables);
+
+        size_t padded_row_size =
+            file_row_size + padding;
+        size_t rows_per_batch =
+            UTILS_MAX((size_t) (256 * 1024) / padded_row_size, 1);
+
+        uint8_t *batch =
+            (uint8_t *) calloc(rows_per_batch, padded_row_size);
+        if (NULL == batch) {
+            return false;
+        }
+
+        bool result =
+            true;
+        for (size_t y = 0; y < height && result; y += rows_per_batch) {
+            size_t batch_rows =
+                UTILS_MIN(rows_per_batch, height - y);
+            for (size_t row = 0; row < batch_rows; ++row) {
+                _bmp_pack_output_row(batch + row * padded_row_size, image, y + row, &tables);
+            }
+
+            vectors[vector_count].iov_base = batch;
+            vectors[vector_count].iov_len  = batch_rows * padded_row_size;
+            ++vector_count;
+
+            result =
+                _bmp_write_vectors(file_number, vectors, (int) vector_count, false);
+            vector_count = 0;
+        }
+
+        free(batch);
+
+        return result;
+    }
+
+    if (splice_pixels && 0 < vector_count) {
+        if (!_bmp_write_vectors(file_number, vectors, (int) vector_count, false)) {
+            return false;
+        }
+        vector_count = 0;
+    }
+
+    if (0 == padding) {
+        vectors[vector_count].iov_base = image->pixels;
+        vectors[vector_count].iov_len  = height * row_size;
+        ++vector_count;
+
+        return _bmp_write_vectors(file_number, vectors, (int) vector_count, splice_pixels);
+    }
+
+    for (size_t y = 0, linear_position = 0; y < height; ++y, linear_position += image->row_stride) {
+        if (vector_count + 2 > IOV_MAX) {
+            if (!_bmp_write_vectors(file_number, vectors, (int) vector_count, splice_pixels)) {
+                return false;
+            }
+            vector_count = 0;
+        }
+
+        vectors[vector_count].iov_base = image->pixels + linear_position;
+        vectors[vector_count].iov_len  = row_size;
+        ++vector_count;
+
+        vectors[vector_count].iov_base = BMP_Row_Padding;
+        vectors[vector_count].iov_len  = padding;
+        ++vector_count;
+    }
+
+    return _bmp_write_vectors(file_number, vectors, (int) vector_count, splice_pixels);
+}
+
+static void _bmp_write_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bool splice_pixels,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    bmp_file_header file_header;
+    bmp_dib_header dib_header;
+    const uint8_t *extra_header_data;
+    size_t extra_header_size;
+    _bmp_prepare_output_headers(
+        image,
+        &file_header, &dib_header,
+        &extra_header_data, &extra_header_size
+    );
+
+    struct iovec header_vectors[] = {
+        { .iov_base = &file_header,                .iov_len = sizeof(file_header) },
+        { .iov_base = &dib_header,                 .iov_len = sizeof(dib_header)  },
+        { .iov_base = (void *) extra_header_data,  .iov_len = extra_header_size   }
+    };
+
+    if (!_bmp_write_rows_vectored(
+            file_descriptor,
+            image,
+            header_vectors,
+            UTILS_COUNT_OF(header_vectors),
+            splice_pixels
+        )) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Write_Image_Data;
+        }
+
+        goto end;
+    }
+
+end:
+    return;
+}
+
+static void bmp_write_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    _bmp_write_image(file_descriptor, image, false, error_message);
+}
+
+/*
+    Writes the image like `bmp_write_image`, but pipes get the pages of
+    `image->pixels` handed over with vmsplice instead of copied when the
+    pixels live in a mapping of their own. The pipe references those pages
+    until the reader consumed them, which may be long after the call
+    returns, so the pixels must not be written to again. Unmapping them is
+    fine, the pages stay with the pipe and nothing else can reuse them.
+    Heap pixels are always copied, since freeing them would hand their
+    memory to the next allocation while the pipe may still read it.
+*/
+static void bmp_splice_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    bool splice_pixels =
+        NULL != image && NULL != image->pixels && _bmp_pixels_are_mapped(image);
+
+    _bmp_write_image(file_descriptor, image, splice_pixels, error_message);
+}
+
+/*
+    Describes the whole output file as one list of vectors for callers that
+    submit the writes themselves. Rows that have to be packed again go into
+    a staging buffer of the size of the file's pixel array, the others are
+    referenced in `image->pixels`, which has to outlive the output.
+*/
+static void bmp_prepare_image_output(
+                bmp_image *image,
+                bmp_image_output *output,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    memset(output, 0, sizeof(*output));
+
+    if (NULL == image || NULL == image->pixels) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    const uint8_t *extra_header_data;
+    size_t extra_header_size;
+    _bmp_prepare_output_headers(
+        image,
+        &output->file_header, &output->dib_header,
+        &extra_header_data, &extra_header_size
+    );
+
+    size_t padding =
+        image->pixel_row_padding;
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t row_size =
+        width * image->bytes_per_pixel;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t padded_row_size =
+        (width * bits_per_pixel + 7) / 8 + padding;
+    bool needs_staging =
+        bits_per_pixel != image->bytes_per_pixel * 8 || image->planar || image->tiled;
+
+    size_t vector_capacity =
+        3 + (needs_staging || 0 == padding ? 1 : 2 * height);
+    output->vectors = (struct iovec *) malloc(vector_capacity * sizeof(*output->vectors));
+    if (NULL == output->vectors) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Not_Enough_Memory_to_Write;
+        }
+
+        goto end;
+    }
+
+    struct iovec *vectors =
+        output->vectors;
+    vectors[0] = (struct iovec) { .iov_base = &output->file_header,          .iov_len = sizeof(output->file_header) };
+    vectors[1] = (struct iovec) { .iov_base = &output->dib_header,           .iov_len = sizeof(output->dib_header)  };
+    vectors[2] = (struct iovec) { .iov_base = (void *) extra_header_data,    .iov_len = extra_header_size           };
+    output->vector_count = 3;
+
+    if (needs_staging) {
+        output->staging = (uint8_t *) calloc(height, padded_row_size);
+        if (NULL == output->staging) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Not_Enough_Memory_to_Write;
+            }
+
+            goto cleanup;
+        }
+
+        bmp_shuffle_tables tables;
+        _bmp_build_shuffle_tables(&tables);
+
+        for (size_t y = 0; y < height; ++y) {
+            _bmp_pack_output_row(output->staging + y * padded_row_size, image, y, &tables);
+        }
+
+        vectors[output->vector_count].iov_base = output->staging;
+        vectors[output->vector_count].iov_len  = height * padded_row_size;
+        ++output->vector_count;
+    } else if (0 == padding) {
+        vectors[output->vector_count].iov_base = image->pixels;
+        vectors[output->vector_count].iov_len  = height * row_size;
+        ++output->vector_count;
+    } else {
+        for (size_t y = 0, linear_position = 0; y < height; ++y, linear_position += image->row_stride) {
+            vectors[output->vector_count].iov_base = image->pixels + linear_position;
+            vectors[output->vector_count].iov_len  = row_size;
+            ++output->vector_count;
+
+            vectors[output->vector_count].iov_base = BMP_Row_Padding;
+            vectors[output->vector_count].iov_len  = padding;
+            ++output->vector_count;
+        }
+    }
+
+    output->size =
+        (size_t) output->file_header.file_size;
+
+end:
+    return;
+
+cleanup:
+    bmp_free_image_output(output);
+}
+
+static void bmp_free_image_output(bmp_image_output *output)
+{
+    if (NULL == output) {
+        return;
+    }
+
+    free(output->vectors);
+    output->vectors = NULL;
+    output->vector_count = 0;
+
+    free(output->staging);
+    output->staging = NULL;
+}
+
+/*
+    Rows are written at their offsets, or into a mapped destination, only
+    while the pixels are used in place in the file's format, so they need no
+    packing, and only to files that can be written at any offset.
+*/
+static bool bmp_can_write_rows_at(
+                FILE *file_descriptor,
+                bmp_image *image
+            )
+{
+    if (NULL == file_descriptor || NULL == image || !_bmp_pixels_are_in_payload(image)) {
+        return false;
+    }
+
+    int file_number =
+        fileno(file_descriptor);
+
+    struct stat file_status;
+
+    return -1 != file_number &&
+           0 == fstat(file_number, &file_status) &&
+           S_ISREG(file_status.st_mode);
+}
+
+/* Writes `size` bytes at `offset`, retrying after partial writes. */
+static bool _bmp_pwrite(
+                int file_number,
+                const uint8_t *data,
+                size_t size,
+                size_t offset
+            )
+{
+    while (size > 0) {
+        ssize_t bytes_written =
+            pwrite(file_number, data, size, (off_t) offset);
+        if (-1 == bytes_written) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += bytes_written;
+        size -= (size_t) bytes_written;
+        offset += (size_t) bytes_written;
+    }
+
+    return true;
+}
+
+static bool _bmp_pwrite_vectors(
+                int file_number,
+                struct iovec *vectors,
+                int vector_count,
+                size_t offset
+            )
+{
+    while (vector_count > 0) {
+        ssize_t bytes_written =
+            pwritev(file_number, vectors, vector_count, (off_t) offset);
+        if (-1 == bytes_written) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        offset += (size_t) bytes_written;
+
+        while (vector_count > 0 && (size_t) bytes_written >= vectors->iov_len) {
+            bytes_written -= (ssize_t) vectors->iov_len;
+            ++vectors;
+            --vector_count;
+        }
+
+        if (vector_count > 0) {
+            vectors->iov_base = (uint8_t *) vectors->iov_base + bytes_written;
+            vectors->iov_len -= (size_t) bytes_written;
+        }
+    }
+
+    return true;
+}
+
+/* Copies `size` bytes of the destination's pixel array from `start` on, with zeroed row padding. */
+static void _bmp_copy_output_bytes(
+                bmp_row_writer *writer,
+                uint8_t *destination,
+                size_t start,
+                size_t size
+            )
+{
+    while (size > 0) {
+        size_t y =
+            start / writer->file_row_size;
+        size_t x =
+            start % writer->file_row_size;
+        size_t run =
+            UTILS_MIN(size, writer->file_row_size - x);
+        size_t pixel_bytes =
+            x < writer->row_size ? UTILS_MIN(run, writer->row_size - x) : 0;
+
+        memcpy(destination, writer->image->pixels + y * writer->image->row_stride + x, pixel_bytes);
+        memset(destination + pixel_bytes, 0, run - pixel_bytes);
+
+        destination += run;
+        start += run;
+        size -= run;
+    }
+}
+
+/* Writes the destination's bytes from `start` to `end` through `bounce`, a chunk at a time. */
+static bool _bmp_write_output_range(
+                bmp_row_writer *writer,
+                int file_number,
+                uint8_t *bounce,
+                size_t start,
+                size_t end
+            )
+{
+    for (size_t position = start; position < end; position += BMP_DIRECT_CHUNK_SIZE) {
+        size_t chunk_size =
+            UTILS_MIN(end - position, (size_t) BMP_DIRECT_CHUNK_SIZE);
+
+        _bmp_copy_output_bytes(writer, bounce, position - writer->pixel_array_offset, chunk_size);
+
+        // File systems without O_DIRECT support reject it on the first write.
+        bool written =
+            _bmp_pwrite(file_number, bounce, chunk_size, position) ||
+            (file_number == writer->direct_file_number && EINVAL == errno &&
+                _bmp_pwrite(writer->file_number, bounce, chunk_size, position));
+        if (!written) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    With O_DIRECT, the whole blocks of the rows go out through an aligned
+    bounce buffer. The partial blocks at either end are shared with the
+    neighbouring rows and the headers, they are written buffered.
+*/
+static bool _bmp_write_rows_direct(
+                bmp_row_writer *writer,
+                size_t start,
+                size_t end
+            )
+{
+    size_t file_start =
+        writer->pixel_array_offset + start;
+    size_t file_end =
+        writer->pixel_array_offset + end;
+    size_t direct_start =
+        (file_start + BMP_DIRECT_ALIGNMENT - 1) / BMP_DIRECT_ALIGNMENT * BMP_DIRECT_ALIGNMENT;
+    size_t direct_end =
+        file_end / BMP_DIRECT_ALIGNMENT * BMP_DIRECT_ALIGNMENT;
+    if (direct_end <= direct_start) {
+        direct_start = file_end;
+        direct_end = file_end;
+    }
+
+    uint8_t *bounce =
+        aligned_alloc(BMP_DIRECT_ALIGNMENT, BMP_DIRECT_CHUNK_SIZE);
+    if (NULL == bounce) {
+        return false;
+    }
+
+    bool written =
+        _bmp_write_output_range(writer, writer->file_number, bounce, file_start, direct_start) &&
+        _bmp_write_output_range(writer, writer->direct_file_number, bounce, direct_start, direct_end) &&
+        _bmp_write_output_range(writer, writer->file_number, bounce, direct_end, file_end);
+
+    free(bounce);
+
+    return written;
+}
+
+static bool _bmp_write_rows_at(
+                bmp_row_writer *writer,
+                size_t first_row,
+                size_t row_count
+            )
+{
+    size_t file_row_size =
+        writer->file_row_size;
+
+    if (-1 != writer->direct_file_number) {
+        return _bmp_write_rows_direct(
+                   writer,
+                   first_row * file_row_size,
+                   (first_row + row_count) * file_row_size
+               );
+    }
+
+    // Rows and their padding are written straight from the pixels.
+    size_t padding =
+        file_row_size - writer->row_size;
+    size_t vectors_per_row =
+        0 < padding ? 2 : 1;
+    size_t rows_per_write =
+        IOV_MAX / vectors_per_row;
+
+    struct iovec vectors[IOV_MAX];
+    for (size_t y = first_row; y < first_row + row_count; y += rows_per_write) {
+        size_t rows =
+            UTILS_MIN(first_row + row_count - y, rows_per_write);
+
+        int vector_count =
+            0;
+        for (size_t row = y; row < y + rows; ++row) {
+            vectors[vector_count].iov_base = writer->image->pixels + row * writer->image->row_stride;
+            vectors[vector_count].iov_len = writer->row_size;
+            ++vector_count;
+
+            if (0 < padding) {
+                vectors[vector_count].iov_base = BMP_Row_Padding;
+                vectors[vector_count].iov_len = padding;
+                ++vector_count;
+            }
+        }
+
+        if (!_bmp_pwrite_vectors(
+                writer->file_number,
+                vectors,
+                vector_count,
+                writer->pixel_array_offset + y * file_row_size
+            )) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+    Writes the headers right away, the rows follow from the threads
+    finishing them. With `direct`, the rows bypass the page cache where the
+    file system allows it.
+*/
+static void bmp_open_row_writer(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bool direct,
+                bmp_row_writer *writer,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image || NULL == writer || !_bmp_pixels_are_in_payload(image)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    writer->image = image;
+    writer->file_number = -1;
+    writer->direct_file_number = -1;
+    writer->row_progress = NULL;
+    writer->failed = false;
+
+    bmp_write_image_headers(file_descriptor, image, error_message);
+    if (NULL != *error_message) {
+        goto end;
+    }
+
+    if (0 != fflush(file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Write_DIB_Header;
+        }
+
+        goto end;
+    }
+
+    bmp_file_header file_header;
+    bmp_dib_header dib_header;
+    const uint8_t *extra_header_data;
+    size_t extra_header_size;
+    _bmp_prepare_output_headers(
+        image,
+        &file_header, &dib_header,
+        &extra_header_data, &extra_header_size
+    );
+
+    writer->row_progress = calloc(image->absolute_image_height, sizeof(*writer->row_progress));
+    if (NULL == writer->row_progress) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Not_Enough_Memory_to_Write;
+        }
+
+        goto end;
+    }
+
+    writer->file_number =
+        fileno(file_descriptor);
+    writer->pixel_array_offset =
+        (size_t) file_header.pixel_array_offset;
+    writer->row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
+    writer->file_row_size =
+        writer->row_size + image->pixel_row_padding;
+
+    // The descriptor is opened again through procfs, its flags are shared
+    // with the buffered one otherwise. Without O_DIRECT, rows stay buffered.
+    if (direct) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", writer->file_number);
+
+        writer->direct_file_number =
+            open(path, O_WRONLY | O_DIRECT);
+    }
+
+end:
+    return;
+}
+
+/*
+    Called with the range of bytes of packed rows a thread just finished.
+    Rows covered completely and rows finished by this range go out as one
+    write per run of consecutive rows. Failures are kept for
+    `bmp_close_row_writer`.
+*/
+static void bmp_write_finished_rows(
+                bmp_row_writer *writer,
+                size_t first_byte,
+                size_t byte_count
+            )
+{
+    size_t row_size =
+        writer->row_size;
+    size_t end =
+        first_byte + byte_count;
+    size_t run_start =
+        first_byte / row_size;
+
+    for (size_t y = first_byte / row_size; y * row_size < end; ++y) {
+        size_t row_start =
+            UTILS_MAX(y * row_size, first_byte);
+        size_t row_end =
+            UTILS_MIN((y + 1) * row_size, end);
+
+        bool finished =
+            row_end - row_start == row_size ||
+            row_size == __sync_add_and_fetch(&writer->row_progress[y], row_end - row_start);
+        if (finished) {
+            continue;
+        }
+
+        if (run_start < y && !_bmp_write_rows_at(writer, run_start, y - run_start)) {
+            writer->failed = true;
+        }
+        run_start =
+            y + 1;
+    }
+
+    size_t run_end =
+        (end + row_size - 1) / row_size;
+    if (run_start < run_end && !_bmp_write_rows_at(writer, run_start, run_end - run_start)) {
+        writer->failed = true;
+    }
+}
+
+static void bmp_close_row_writer(
+                bmp_row_writer *writer,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == writer) {
+        return;
+    }
+
+    if (writer->failed) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Write_Image_Data;
+        }
+    }
+
+    if (-1 != writer->direct_file_number) {
+        close(writer->direct_file_number);
+        writer->direct_file_number = -1;
+    }
+
+    free((void *) writer->row_progress);
+    writer->row_progress = NULL;
+}
+
+/*
+    Sizes the destination for the image, maps it shared and writes the
+    headers into the mapping. The pixel array is left to the caller, the
+    page cache writes it back once it is unmapped. Like the source mapping,
+    the file sits on top of an anonymous reservation, so the vector kernels
+    may store past its end.
+*/
+static void bmp_map_image_output(
+                FILE *file_descriptor,
+                bmp_image *image,
+                bmp_mapped_output *output,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image || NULL == output || !_bmp_pixels_are_in_payload(image)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    output->mapping = NULL;
+    output->mapping_size = 0;
+    output->pixels = NULL;
+
+    int file_number =
+        NULL != file_descriptor ? fileno(file_descriptor) : -1;
+    if (-1 == file_number) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    bmp_file_header file_header;
+    bmp_dib_header dib_header;
+    const uint8_t *extra_header_data;
+    size_t extra_header_size;
+    _bmp_prepare_output_headers(
+        image,
+        &file_header, &dib_header,
+        &extra_header_data, &extra_header_size
+    );
+
+    size_t pixel_array_offset =
+        (size_t) file_header.pixel_array_offset;
+    size_t file_size =
+        pixel_array_offset + image->image_size;
+
+    if (-1 == ftruncate(file_number, (off_t) file_size)) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Map_Output;
+        }
+
+        goto end;
+    }
+
+    size_t page_size =
+        (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapping_size =
+        ((file_size + 128 - 1) / page_size + 1) * page_size;
+
+    uint8_t *mapping =
+        mmap(
+            NULL, mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0
+        );
+    if (MAP_FAILED == mapping) {
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Map_Output;
+        }
+
+        goto end;
+    }
+
+    if (MAP_FAILED == mmap(
+                          mapping, file_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_FIXED,
+                          file_number, 0
+                      )) {
+        munmap(mapping, mapping_size);
+
+        if (NULL != error_message) {
+            *error_message = BMP_Error_Failed_to_Map_Output;
+        }
+
+        goto end;
+    }
+
+    memcpy(mapping, &file_header, sizeof(file_header));
+    memcpy(mapping + sizeof(file_header), &dib_header, sizeof(dib_header));
+    if (0 < extra_header_size) {
+        memcpy(mapping + sizeof(file_header) + sizeof(dib_header), extra_header_data, extra_header_size);
+    }
+
+    output->mapping = mapping;
+    output->mapping_size = mapping_size;
+    output->pixels = mapping + pixel_array_offset;
+
+end:
+    return;
+}
+
+/* Unmapping leaves the written pages to the page cache, nothing waits for them. */
+static void bmp_unmap_image_output(bmp_mapped_output *output)
+{
+    if (NULL != output && NULL != output->mapping) {
+        munmap(output->mapping, output->mapping_size);
+        output->mapping = NULL;
+        output->mapping_size = 0;
+        output->pixels = NULL;
     }
 }
 
-static inline void bmp_free_image_structure(bmp_image *image)
+/*
+    Rows can only be read into place while the pixels are used in place in
+    the file's format, and only from files that can be read at any offset.
+    Settles the layout requested through `image->bytes_per_pixel`,
+    `image->planar` and `image->tiled`.
+*/
+static bool bmp_can_read_rows_at(
+                FILE *file_descriptor,
+                bmp_image *image
+            )
 {
-    if (NULL != image) {
-        if (NULL != image->payload) {
-            free(image->payload);
-            image->payload = NULL;
+    if (NULL == file_descriptor || NULL == image) {
+        return false;
+    }
+
+    _bmp_calculate_layout(image);
+
+    if (image->bytes_per_pixel * 8 != (size_t) image->dib_header.bits_per_pixel ||
+            image->planar || image->tiled) {
+        return false;
+    }
+
+    int file_number =
+        fileno(file_descriptor);
+
+    struct stat file_status;
+
+    return -1 != file_number &&
+           0 == fstat(file_number, &file_status) &&
+           S_ISREG(file_status.st_mode);
+}
+
+/* Reads `size` bytes at `offset`, retrying after partial reads. Fails at the end of the file. */
+static bool _bmp_pread(
+                int file_number,
+                uint8_t *data,
+                size_t size,
+                size_t offset
+            )
+{
+    while (size > 0) {
+        ssize_t bytes_read =
+            pread(file_number, data, size, (off_t) offset);
+        if (-1 == bytes_read) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
         }
-        if (NULL != image->pixels) {
-            free(image->pixels);
-            image->pixels = NULL;
+        if (0 == bytes_read) {
+            return false;
         }
+
+        data += bytes_read;
+        size -= (size_t) bytes_read;
+        offset += (size_t) bytes_read;
     }
+
+    return true;
 }
 
-static void bmp_open_image_headers(
+/*
+    Sets up the payload and the pixels in it without reading anything, the
+    rows arrive through `bmp_read_rows`.
+*/
+static void bmp_open_row_reader(
                 FILE *file_descriptor,
                 bmp_image *image,
+                bmp_row_reader *reader,
                 const char **error_message
             )
 {
     *error_message = NULL;
 
-    if (NULL == image) {
+    if (NULL == image || NULL == reader) {
         if (NULL != error_message) {
             *error_message = BMP_Error_Invalid_Image_Structure;
         }
@@ -50,80 +2422,187 @@ static void bmp_open_image_headers(
         goto end;
     }
 
-    size_t bmp_header_size =
-        sizeof(image->file_header);
-    size_t dib_header_size =
-        sizeof(image->dib_header);
-    size_t total_header_size =
-        bmp_header_size + dib_header_size;
+    reader->image = image;
+    reader->file_number = -1;
+    reader->failed = false;
 
-    if (!fread(&image->file_header, bmp_header_size, 1, file_descriptor)) {
-        if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Read_File_Header;
-        }
+    bmp_allocate_image_payload(image, error_message);
+    if (NULL != *error_message) {
+        goto end;
+    }
 
+    bmp_prepare_image_data(image, error_message);
+    if (NULL != *error_message) {
         goto end;
     }
 
-    if (image->file_header.signature[0] != BMP_First_Magic_Byte ||
-        image->file_header.signature[1] != BMP_Second_Magic_Byte) {
+    if (!_bmp_pixels_are_in_payload(image)) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Invalid_File_Signature;
+            *error_message = BMP_Error_Invalid_Image_Structure;
         }
 
         goto end;
     }
 
-    if (!fread(&image->dib_header, dib_header_size, 1, file_descriptor)) {
+    /* Bytes past the pixel array are never read, the vector kernels may still load them. */
+    memset(image->payload + image->image_size, 0, image->payload_size - image->image_size);
+
+    reader->file_number =
+        fileno(file_descriptor);
+    reader->pixel_array_offset =
+        (size_t) image->file_header.pixel_array_offset;
+    reader->row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
+    reader->file_row_size =
+        image->row_stride;
+
+end:
+    return;
+}
+
+/*
+    Called with the range of bytes of packed rows a thread is about to
+    filter. The range is read with one call, together with the padding of
+    its last row if the range ends with it. Failures are kept for
+    `bmp_close_row_reader`.
+*/
+static void bmp_read_rows(
+                bmp_row_reader *reader,
+                size_t first_byte,
+                size_t byte_count
+            )
+{
+    if (0 == byte_count || reader->failed) {
+        return;
+    }
+
+    size_t row_size =
+        reader->row_size;
+    size_t file_row_size =
+        reader->file_row_size;
+    size_t end =
+        first_byte + byte_count;
+
+    size_t start_offset =
+        first_byte / row_size * file_row_size + first_byte % row_size;
+    size_t end_offset =
+        0 == end % row_size ?
+            end / row_size * file_row_size :
+            end / row_size * file_row_size + end % row_size;
+
+    if (!_bmp_pread(
+            reader->file_number,
+            reader->image->pixels + start_offset,
+            end_offset - start_offset,
+            reader->pixel_array_offset + start_offset
+        )) {
+        reader->failed = true;
+    }
+}
+
+static void bmp_close_row_reader(
+                bmp_row_reader *reader,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == reader) {
+        return;
+    }
+
+    if (reader->failed) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Read_DIB_Header;
+            *error_message = BMP_Error_Failed_to_Read_Image_Data;
         }
+    }
 
-        goto end;
+    reader->file_number = -1;
+}
+
+/*
+    Drops the payload once the pixels live in their own buffer. The writers
+    only need `image->pixels`, so this halves the memory held during
+    processing. Pixels used in place keep the payload.
+*/
+static void bmp_release_image_payload(bmp_image *image)
+{
+    if (NULL == image || NULL == image->pixels || _bmp_pixels_are_in_payload(image)) {
+        return;
+    }
+
+    if (NULL != image->mapping) {
+        _bmp_unmap_image(image);
+        image->raw_pixels = NULL;
+    } else if (NULL != image->payload) {
+        image_buffer_free(image->payload);
+        image->payload = NULL;
+        image->raw_pixels = NULL;
     }
+}
 
-    ssize_t temp =
-        image->dib_header.dib_header_size - dib_header_size;
-    size_t rest_dib_header_size =
-        temp > 0 ? temp : 0;
+static void bmp_begin_image_rows(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
 
-    if (-1 == fseek(file_descriptor, rest_dib_header_size, SEEK_CUR)) {
+    if (NULL == image) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Seek_Inside_DIB_Header;
+            *error_message = BMP_Error_Invalid_Image_Structure;
         }
 
         goto end;
     }
 
-    if (24 != image->dib_header.bits_per_pixel) {
+    if (NULL == file_descriptor) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Unsupported_Color_Depth;
+            *error_message = BMP_Error_Invalid_File_Descriptor;
         }
 
         goto end;
     }
 
-    if (image->file_header.file_size <= total_header_size) {
+    if (8 > image->dib_header.bits_per_pixel) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Invalid_Size_Information;
+            *error_message = BMP_Error_Unsupported_Row_Streaming;
         }
 
         goto end;
     }
 
+    /*
+        The headers already consumed everything up to the pixel array. Bands
+        keep the pixel layout of the file, they are never widened, split
+        into planes or tiled.
+    */
+    image->bytes_per_pixel = 0;
+    image->planar = false;
+    image->tiled = false;
+    _bmp_calculate_layout(image);
+
 end:
     return;
 }
 
-static void bmp_read_image_data(
+/*
+    Reads the next `row_count` rows of the pixel array and removes their
+    padding. The buffer must have room for the padded rows, they are read
+    in one go and compacted in place.
+*/
+static void bmp_read_image_rows(
                 FILE *file_descriptor,
                 bmp_image *image,
+                uint8_t *pixels,
+                size_t row_count,
                 const char **error_message
             )
 {
     *error_message = NULL;
 
-    if (NULL == image) {
+    if (NULL == image || NULL == pixels) {
         if (NULL != error_message) {
             *error_message = BMP_Error_Invalid_Image_Structure;
         }
@@ -139,133 +2618,140 @@ static void bmp_read_image_data(
         goto end;
     }
 
-    size_t bmp_header_size =
-        sizeof(image->file_header);
-    size_t dib_header_size =
-        image->dib_header.dib_header_size;
-    size_t total_header_size =
-        bmp_header_size + dib_header_size;
-
-    size_t payload_size =
-        ((size_t) image->file_header.file_size) - total_header_size;
-
-    image->payload_size = payload_size;
-    image->payload = (uint8_t *) malloc(payload_size);
-    if (NULL == image->payload) {
-        if (NULL != error_message) {
-            *error_message = BMP_Error_Not_Enough_Memory_to_Read;
-        }
+    size_t padding =
+        image->pixel_row_padding;
+    size_t row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
 
+    if (0 == row_count) {
         goto end;
     }
 
-    if (!fread(image->payload, payload_size, 1, file_descriptor)) {
+    if (!fread(pixels, (row_size + padding) * row_count, 1, file_descriptor)) {
         if (NULL != error_message) {
             *error_message = BMP_Error_Failed_to_Read_Image_Data;
         }
 
-        goto cleanup;
+        goto end;
     }
 
-    size_t first_pixel_index =
-        ((size_t) image->file_header.pixel_array_offset) -
-            (bmp_header_size + (size_t) image->dib_header.dib_header_size);
-
-    if (first_pixel_index >= payload_size) {
-        if (NULL != error_message) {
-            *error_message = BMP_Error_Invalid_Pixel_Offset_or_DIB_Header_Size;
-        }
-
-        goto cleanup;
+    for (
+        size_t y = 1,
+               src_linear_position  = row_size + padding,
+               dest_linear_position = row_size;
+        y < row_count && 0 != padding;
+        ++y,
+        src_linear_position += row_size + padding,
+        dest_linear_position += row_size
+    ) {
+        memmove(
+            pixels + dest_linear_position,
+            pixels + src_linear_position,
+            row_size
+        );
     }
 
-    image->raw_pixels =
-        &image->payload[first_pixel_index];
-
-    size_t width =
-        image->dib_header.image_width < 0 ?
-            (size_t) -image->dib_header.image_width :
-            (size_t)  image->dib_header.image_width;
-
-    size_t height =
-        image->dib_header.image_height < 0 ?
-            (size_t) -image->dib_header.image_height :
-            (size_t)  image->dib_header.image_height;
-
-    size_t row_size =
-        width * 3;
+end:
+    return;
+}
 
-    size_t padding = (size_t) image->dib_header.bits_per_pixel;
-    padding = (padding * width + 31) / 32 * 4 - row_size;
+static void bmp_write_image_rows(
+                FILE *file_descriptor,
+                bmp_image *image,
+                uint8_t *pixels,
+                size_t row_count,
+                const char **error_message
+            )
+{
+    static const uint8_t Padding[4] = { 0 };
 
-    image->absolute_image_width  =
-        width;
-    image->absolute_image_height =
-        height;
-    image->pixel_row_padding =
-        padding;
-    image->image_size =
-        height * (row_size + padding);
+    *error_message = NULL;
 
-    if (image->image_size > payload_size) {
+    if (NULL == image || NULL == pixels) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Calculate_Padding;
+            *error_message = BMP_Error_Invalid_Image_Structure;
         }
 
-        goto cleanup;
+        goto end;
     }
 
-    size_t alignment = 64;
-    size_t aligned_image_size = (((image->image_size - 1) / alignment) + 1) * alignment;
-    aligned_image_size += 64;
-
-    image->pixels = (uint8_t *) aligned_alloc(64, aligned_image_size);
-    if (NULL == image->payload) {
+    if (NULL == file_descriptor) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Not_Enough_Memory_to_Read;
+            *error_message = BMP_Error_Invalid_File_Descriptor;
         }
 
-        goto cleanup;
+        goto end;
     }
-    image->aligned_image_size = aligned_image_size;
 
-    for (size_t y = 0, linear_position = 0; y < height; ++y, linear_position += row_size + padding) {
-        memcpy(
-            image->pixels + linear_position,
-            image->raw_pixels + linear_position,
-            row_size
-        );
-    }
+    size_t padding =
+        image->pixel_row_padding;
+    size_t row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
 
-    for (size_t linear_position = image->image_size; linear_position < aligned_image_size; ++linear_position) {
-        image->pixels[linear_position] = 0;
+    for (size_t y = 0, linear_position = 0; y < row_count; ++y, linear_position += row_size) {
+        if (!fwrite(pixels + linear_position, row_size, 1, file_descriptor) ||
+                (0 != padding && !fwrite(Padding, padding, 1, file_descriptor))) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Failed_to_Write_Image_Data;
+            }
+
+            goto end;
+        }
     }
 
 end:
     return;
+}
 
-cleanup:
-    if (NULL != image->payload)
-    {
-        free(image->payload);
-        image->payload = NULL;
+/* Moves `size` bytes further into a stream, reading them if it can not seek. */
+static bool _bmp_skip_bytes(
+                FILE *file_descriptor,
+                size_t size,
+                bool seekable
+            )
+{
+    if (0 == size) {
+        return true;
     }
-    if (NULL != image->pixels)
-    {
-        free(image->pixels);
-        image->pixels = NULL;
+
+    if (seekable) {
+        return 0 == fseeko(file_descriptor, (off_t) size, SEEK_CUR);
+    }
+
+    uint8_t buffer[4096];
+    while (size > 0) {
+        size_t chunk_size =
+            UTILS_MIN(size, sizeof(buffer));
+
+        if (!fread(buffer, chunk_size, 1, file_descriptor)) {
+            return false;
+        }
+
+        size -= chunk_size;
     }
+
+    return true;
 }
 
-static void bmp_write_image_headers(
+/*
+    Reads only the rows and columns of `region` and `halo` pixels around it,
+    as far as the image reaches, and makes the image describe that part
+    alone. Skipped rows are seeked over. Pixels smaller than a byte are read
+    in whole bytes. On return, `inner_region` is where `region` lies in the
+    pixels, with rows counted in the order of the pixel array.
+*/
+static void bmp_read_image_region(
                 FILE *file_descriptor,
                 bmp_image *image,
+                const bmp_region *region,
+                size_t halo,
+                bmp_region *inner_region,
                 const char **error_message
             )
 {
     *error_message = NULL;
 
-    if (NULL == image) {
+    if (NULL == image || NULL == region || NULL == inner_region) {
         if (NULL != error_message) {
             *error_message = BMP_Error_Invalid_Image_Structure;
         }
@@ -281,41 +2767,137 @@ static void bmp_write_image_headers(
         goto end;
     }
 
-    size_t bmp_header_size =
-        sizeof(image->file_header);
+    _bmp_calculate_layout(image);
+
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
 
-    if (!fwrite(&image->file_header, bmp_header_size, 1, file_descriptor)) {
+    if (0 == region->width || 0 == region->height ||
+        region->x > width || region->width > width - region->x ||
+        region->y > height || region->height > height - region->y) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Write_File_Header;
+            *error_message = BMP_Error_Invalid_Region;
         }
 
         goto end;
     }
 
-    size_t dib_header_size =
-        sizeof(image->dib_header);
+    bool bottom_up =
+        0 < image->dib_header.image_height;
+    size_t bits_per_pixel =
+        (size_t) image->dib_header.bits_per_pixel;
+    size_t file_row_size =
+        (width * bits_per_pixel + 7) / 8 + image->pixel_row_padding;
+
+    // Rows are counted in file order from here on.
+    size_t y =
+        bottom_up ? height - region->y - region->height : region->y;
+
+    size_t left =
+        region->x > halo ? region->x - halo : 0;
+    size_t right =
+        UTILS_MIN(width, region->x + region->width + halo);
+    size_t top =
+        y > halo ? y - halo : 0;
+    size_t bottom =
+        UTILS_MIN(height, y + region->height + halo);
+
+    if (8 > bits_per_pixel) {
+        size_t pixels_per_byte =
+            8 / bits_per_pixel;
+
+        left =
+            left / pixels_per_byte * pixels_per_byte;
+        right =
+            UTILS_MIN(width, (right + pixels_per_byte - 1) / pixels_per_byte * pixels_per_byte);
+    }
 
-    if (!fwrite(&image->dib_header, dib_header_size, 1, file_descriptor)) {
-        if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Write_DIB_Header;
+    inner_region->x =
+        region->x - left;
+    inner_region->y =
+        y - top;
+    inner_region->width =
+        region->width;
+    inner_region->height =
+        region->height;
+
+    size_t region_width =
+        right - left;
+    size_t region_height =
+        bottom - top;
+    size_t region_span =
+        (region_width * bits_per_pixel + 7) / 8;
+    size_t region_row_size =
+        (region_width * bits_per_pixel + 31) / 32 * 4;
+    size_t region_image_size =
+        region_height * region_row_size;
+
+    image->dib_header.image_width =
+        0 > image->dib_header.image_width ? -(int32_t) region_width : (int32_t) region_width;
+    image->dib_header.image_height =
+        bottom_up ? (int32_t) region_height : -(int32_t) region_height;
+    image->dib_header.image_size =
+        (uint32_t) region_image_size;
+    image->file_header.file_size =
+        (uint32_t) (image->file_header.pixel_array_offset + region_image_size);
+
+    bmp_allocate_image_payload(image, error_message);
+    if (NULL != *error_message) {
+        goto end;
+    }
+
+    struct stat file_status;
+    bool seekable =
+        0 == fstat(fileno(file_descriptor), &file_status) &&
+        S_ISREG(file_status.st_mode);
+
+    // The headers already consumed everything up to the pixel array.
+    for (size_t row = 0, position = 0; row < region_height; ++row) {
+        size_t row_offset =
+            (top + row) * file_row_size + left * bits_per_pixel / 8;
+        uint8_t *destination =
+            image->payload + row * region_row_size;
+
+        if (!_bmp_skip_bytes(file_descriptor, row_offset - position, seekable) ||
+            !fread(destination, region_span, 1, file_descriptor)) {
+            if (NULL != error_message) {
+                *error_message = BMP_Error_Failed_to_Read_Image_Data;
+            }
+
+            image_buffer_free(image->payload);
+            image->payload = NULL;
+
+            goto end;
         }
 
-        goto end;
+        memset(destination + region_span, 0, region_row_size - region_span);
+        position =
+            row_offset + region_span;
     }
 
+    bmp_prepare_image_data(image, error_message);
+
 end:
     return;
 }
 
-static void bmp_write_image_data(
-                FILE *file_descriptor,
+/*
+    Cuts the filtered pixels of an image read with `bmp_read_image_region`
+    down to `inner_region`, in place, and makes the image describe the
+    result. Planar and tiled pixels can not be cropped.
+*/
+static void bmp_crop_image(
                 bmp_image *image,
+                const bmp_region *inner_region,
                 const char **error_message
             )
 {
     *error_message = NULL;
 
-    if (NULL == image) {
+    if (NULL == image || NULL == image->pixels || NULL == inner_region ||
+        image->planar || image->tiled) {
         if (NULL != error_message) {
             *error_message = BMP_Error_Invalid_Image_Structure;
         }
@@ -323,67 +2905,99 @@ static void bmp_write_image_data(
         goto end;
     }
 
-    if (NULL == file_descriptor) {
+    if (0 == inner_region->width || 0 == inner_region->height ||
+        inner_region->x > image->absolute_image_width ||
+        inner_region->width > image->absolute_image_width - inner_region->x ||
+        inner_region->y > image->absolute_image_height ||
+        inner_region->height > image->absolute_image_height - inner_region->y) {
         if (NULL != error_message) {
-            *error_message = BMP_Error_Invalid_File_Descriptor;
+            *error_message = BMP_Error_Invalid_Region;
         }
 
         goto end;
     }
 
-    size_t bmp_header_size =
-        sizeof(image->file_header);
-    size_t dib_header_size =
-        sizeof(image->dib_header);
-    size_t total_header_size =
-        bmp_header_size + dib_header_size;
-
-    size_t payload_size =
-        ((size_t) image->file_header.file_size) - total_header_size;
-    size_t padding =
-        image->pixel_row_padding;
-
-    size_t width =
-        image->absolute_image_width;
-    size_t height =
-        image->absolute_image_height;
+    bool in_place =
+        _bmp_pixels_are_in_payload(image);
+    size_t bytes_per_pixel =
+        image->bytes_per_pixel;
+    size_t row_stride =
+        image->row_stride;
     size_t row_size =
-        width * 3;
-
-    for (
-        size_t y = 0,
-               src_linear_position  = 0,
-               dest_linear_position = 0;
-        y < height;
-        ++y,
-        src_linear_position += row_size,
-        dest_linear_position += row_size + padding
-    ) {
-        memcpy(
-            image->raw_pixels + dest_linear_position,
-            image->pixels + src_linear_position,
+        inner_region->width * bytes_per_pixel;
+
+    image->dib_header.image_width =
+        0 > image->dib_header.image_width ?
+            -(int32_t) inner_region->width :
+             (int32_t) inner_region->width;
+    image->dib_header.image_height =
+        0 > image->dib_header.image_height ?
+            -(int32_t) inner_region->height :
+             (int32_t) inner_region->height;
+
+    _bmp_calculate_layout(image);
+
+    // Pixels used in place keep the padding of the file, rows only move forward.
+    size_t cropped_row_stride =
+        in_place ? row_size + image->pixel_row_padding : row_size;
+
+    for (size_t y = 0; y < inner_region->height; ++y) {
+        uint8_t *destination =
+            image->pixels + y * cropped_row_stride;
+
+        memmove(
+            destination,
+            image->pixels + (inner_region->y + y) * row_stride + inner_region->x * bytes_per_pixel,
             row_size
         );
+        memset(destination + row_size, 0, cropped_row_stride - row_size);
     }
 
-    if (!fwrite(image->payload, payload_size, 1, file_descriptor)) {
-        if (NULL != error_message) {
-            *error_message = BMP_Error_Failed_to_Write_Image_Data;
-        }
-
-        goto end;
+    image->row_stride =
+        cropped_row_stride;
+    image->dib_header.image_size =
+        (uint32_t) image->image_size;
+    if (in_place) {
+        image->aligned_image_size =
+            _bmp_aligned_payload_size(image->image_size);
     }
 
 end:
     return;
 }
 
+/*
+    True for indexed images whose color table only holds gray levels in
+    ascending order. The median of such indices is the index of the median
+    gray level, so they can be filtered without looking up the colors.
+*/
+static bool bmp_is_grayscale(bmp_image *image)
+{
+    if (NULL == image || NULL == image->color_table) {
+        return false;
+    }
+
+    for (size_t i = 0; i < image->color_count; ++i) {
+        const uint8_t *color =
+            image->color_table + i * 4;
+
+        if (color[0] != color[1] || color[0] != color[2] ||
+            (i > 0 && color[0] < color[-4])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static inline uint8_t *bmp_sample_pixel(
                            uint8_t *pixels,
                            ssize_t x,
                            ssize_t y,
                            size_t absolute_image_width,
-                           size_t absolute_image_height
+                           size_t absolute_image_height,
+                           size_t bytes_per_pixel,
+                           size_t row_stride
                        )
 {
     size_t ux =
@@ -391,7 +3005,7 @@ static inline uint8_t *bmp_sample_pixel(
     size_t uy =
         (size_t) (UTILS_CLAMP(y, 0, (ssize_t) absolute_image_height - 1));
 
-    return &pixels[uy * (absolute_image_width * 3) + ux * 3];
+    return &pixels[uy * row_stride + ux * bytes_per_pixel];
 }
 
 static inline uint8_t *bmp_sample_raw_pixel(
@@ -400,14 +3014,17 @@ static inline uint8_t *bmp_sample_raw_pixel(
                            ssize_t y,
                            size_t absolute_image_width,
                            size_t absolute_image_height,
-                           size_t row_padding
+                           size_t bytes_per_pixel,
+                           size_t row_stride
                        )
 {
-    size_t ux =
-        (size_t) (UTILS_CLAMP(x, 0, (ssize_t) absolute_image_width - 1));
-    size_t uy =
-        (size_t) (UTILS_CLAMP(y, 0, (ssize_t) absolute_image_height - 1));
-
-    return &raw_pixels[uy * (absolute_image_width * 3 + row_padding) + ux * 3];
+    return bmp_sample_pixel(
+               raw_pixels,
+               x, y,
+               absolute_image_width,
+               absolute_image_height,
+               bytes_per_pixel,
+               row_stride
+           );
 }
 
@@ -0,0 +1,37 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "queue.h"
+
+typedef struct _bounded_queue
+{
+    pthread_mutex_t access_mutex;
+    pthread_cond_t not_empty_condition;
+    pthread_cond_t not_full_condition;
+    size_t capacity;
+    queue_t implementation;
+} bounded_queue_t;
+
+static inline bounded_queue_t *bounded_queue_allocate(void);
+
+static inline bounded_queue_t *bounded_queue_init(bounded_queue_t *queue, size_t capacity);
+
+static inline bounded_queue_t *bounded_queue_create(size_t capacity);
+
+static inline void bounded_queue_destroy(bounded_queue_t *queue);
+
+static inline size_t bounded_queue_get_size(bounded_queue_t *queue);
+
+static bounded_queue_t *bounded_queue_enqueue(bounded_queue_t *queue, void *data);
+
+static void *bounded_queue_deque(bounded_queue_t *queue);
+
+static void *bounded_queue_try_deque(bounded_queue_t *queue);
+
+#include "bounded_queue.impl.h.c"
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,137 @@
+#include "bounded_queue.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+static inline bounded_queue_t *bounded_queue_allocate()
+{
+    return (bounded_queue_t *) malloc(sizeof(bounded_queue_t));
+}
+
+static inline bounded_queue_t *bounded_queue_init(bounded_queue_t *queue, size_t capacity)
+{
+    if (0 != pthread_mutex_init(&queue->access_mutex, NULL)) {
+        return NULL;
+    }
+
+    if (0 != pthread_cond_init(&queue->not_empty_condition, NULL)) {
+        pthread_mutex_destroy(&queue->access_mutex);
+
+        return NULL;
+    }
+
+    if (0 != pthread_cond_init(&queue->not_full_condition, NULL)) {
+        pthread_cond_destroy(&queue->not_empty_condition);
+        pthread_mutex_destroy(&queue->access_mutex);
+
+        return NULL;
+    }
+
+    queue->capacity = capacity > 0 ? capacity : 1;
+    queue_init(&queue->implementation);
+
+    return queue;
+}
+
+static inline bounded_queue_t *bounded_queue_create(size_t capacity)
+{
+    bounded_queue_t *queue = bounded_queue_allocate();
+    if (NULL == queue) {
+        return queue;
+    }
+
+    if (NULL == bounded_queue_init(queue, capacity)) {
+        free(queue);
+
+        return NULL;
+    }
+
+    return queue;
+}
+
+static inline void bounded_queue_destroy(bounded_queue_t *queue)
+{
+    if (NULL == queue) {
+        return;
+    }
+
+    pthread_mutex_destroy(&queue->access_mutex);
+    pthread_cond_destroy(&queue->not_empty_condition);
+    pthread_cond_destroy(&queue->not_full_condition);
+    queue_deinit(&queue->implementation);
+    free(queue);
+}
+
+static inline size_t bounded_queue_get_size(bounded_queue_t *queue)
+{
+    return (size_t) queue_get_size(&queue->implementation);
+}
+
+static bounded_queue_t *bounded_queue_enqueue(bounded_queue_t *queue, void *data)
+{
+    if (0 != pthread_mutex_lock(&queue->access_mutex)) {
+        return NULL;
+    }
+
+    while (queue_get_size(&queue->implementation) >= queue->capacity) {
+        if (0 != pthread_cond_wait(&queue->not_full_condition, &queue->access_mutex)) {
+            pthread_mutex_unlock(&queue->access_mutex);
+
+            return NULL;
+        }
+    }
+
+    queue_push(&queue->implementation, data);
+    pthread_cond_signal(&queue->not_empty_condition);
+
+    if (0 != pthread_mutex_unlock(&queue->access_mutex)) {
+        return NULL;
+    }
+
+    return queue;
+}
+
+static void *bounded_queue_deque(bounded_queue_t *queue)
+{
+    void *data = NULL;
+
+    if (0 != pthread_mutex_lock(&queue->access_mutex)) {
+        return data;
+    }
+
+    while (queue_is_empty(&queue->implementation)) {
+        if (0 != pthread_cond_wait(&queue->not_empty_condition, &queue->access_mutex)) {
+            pthread_mutex_unlock(&queue->access_mutex);
+
+            return data;
+        }
+    }
+
+    data = queue_deque(&queue->implementation);
+    pthread_cond_signal(&queue->not_full_condition);
+
+    if (0 != pthread_mutex_unlock(&queue->access_mutex)) {
+        return data;
+    }
+
+    return data;
+}
+
+/* Returns NULL instead of waiting when the queue is empty. */
+static void *bounded_queue_try_deque(bounded_queue_t *queue)
+{
+    void *data = NULL;
+
+    if (0 != pthread_mutex_lock(&queue->access_mutex)) {
+        return data;
+    }
+
+    if (!queue_is_empty(&queue->implementation)) {
+        data = queue_deque(&queue->implementation);
+        pthread_cond_signal(&queue->not_full_condition);
+    }
+
+    pthread_mutex_unlock(&queue->access_mutex);
+
+    return data;
+}
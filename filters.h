@@ -3,36 +3,197 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 #define FILTERS_BRIGHTNESS_CONTRAST_ID 0
 #define FILTERS_SEPIA_ID               1
 #define FILTERS_MEDIAN_ID              2
 
-#define FILTERS_MEDIAN_WINDOW_SIZE 3
-
-static inline void filters_apply_brightness_contrast(
-                       uint8_t *pixels,
-                       size_t position,
-                       float brightness,
-                       float contrast
-                   );
-
-static inline void filters_apply_sepia(
-                       uint8_t *pixels,
-                       size_t position
-                   );
-
-static inline void filters_apply_median(
-                       uint8_t *source_pixels,
-                       uint8_t *destination_pixels,
-                       size_t position,
-                       size_t x,
-                       size_t y,
-                       size_t width,
-                       size_t height
-                   );
+/*
+    Median windows reach `radius` pixels past their center in every direction.
+    Windows up to FILTERS_MEDIAN_NETWORK_RADIUS are sorted by exchange
+    networks, up to FILTERS_MEDIAN_SLIDING_RADIUS their medians are selected
+    from a histogram slid along the rows. Larger ones are built out of
+    histograms of the columns of a band of rows, at a cost per pixel that
+    does not depend on the radius. Counts of a window fit into 16 bits up to
+    the largest radius.
+*/
+#define FILTERS_MEDIAN_DEFAULT_RADIUS   1
+#define FILTERS_MEDIAN_MAX_RADIUS     127
+#define FILTERS_MEDIAN_NETWORK_RADIUS   2
+#define FILTERS_MEDIAN_SLIDING_RADIUS   9
+
+/*
+    Pointwise filters that treat every color channel alike are applied
+    through a table with an entry for every channel value. Tables have to be
+    aligned to FILTERS_LOOKUP_TABLE_ALIGNMENT bytes.
+*/
+#define FILTERS_LOOKUP_TABLE_SIZE      256
+#define FILTERS_LOOKUP_TABLE_ALIGNMENT 64
+
+static const char *Filters_Error_Unknown_Kernel_Set =
+                    "Unknown kernel set",
+                  *Filters_Error_Unsupported_Kernel_Set =
+                    "The processor does not support the kernel set";
+
+/*
+    The filters are compiled once for every kernel set, in C, with x87,
+    SSE4.1, AVX2 and AVX-512 instructions. The threading tasks hand whole segments of
+    rows to the set chosen at startup, so the kernels stay inlined within a
+    set and only one indirect call is paid per segment.
+
+    `channels_per_step` tells on which channels segments have to start.
+    Positions and segments are the ones of `filters_process_channels`, the
+    ends of `padded` rows must not be overrun by the vectors of a kernel.
+    `median` takes the windows `radius` pixels around every pixel, out of
+    the rows of the image. `median_tile` filters the inner `columns` by
+    `rows` pixels of a tile with windows of the default radius.
+    `lookup` maps the color channels through a table, alpha is kept and no
+    byte past `end` is touched. `prefers_lookup` tells whether brightness and
+    contrast run faster through a table than computed channel by channel.
+    `fixed_point_is_exact` adjusts tables of all channel values in fixed point
+    and in float and tells whether they agree, `brightness_contrast` takes
+    its fixed-point kernels only when passed `fixed_point`.
+*/
+typedef struct _filters_kernel_set
+{
+    const char *name;
+    bool (*is_supported)(void);
+    bool (*prefers_lookup)(void);
+    bool (*fixed_point_is_exact)(
+              float brightness,
+              float contrast
+          );
+    size_t (*channels_per_step)(
+                size_t bytes_per_pixel,
+                size_t plane_size
+            );
+    void (*brightness_contrast)(
+              uint8_t *pixels,
+              size_t position,
+              size_t end,
+              size_t bytes_per_pixel,
+              size_t plane_size,
+              bool padded,
+              float brightness,
+              float contrast,
+              bool fixed_point
+          );
+    void (*sepia)(
+              uint8_t *pixels,
+              size_t position,
+              size_t end,
+              size_t bytes_per_pixel,
+              size_t plane_size
+          );
+    void (*median)(
+              uint8_t *source_pixels,
+              uint8_t *destination_pixels,
+              size_t position,
+              size_t end,
+              size_t width,
+              size_t height,
+              size_t bytes_per_pixel,
+              size_t plane_size,
+              size_t row_stride,
+              size_t radius
+          );
+    void (*median_tile)(
+              uint8_t *source_tile,
+              uint8_t *destination_tile,
+              size_t columns,
+              size_t rows,
+              size_t bytes_per_pixel
+          );
+    void (*lookup)(
+              uint8_t *pixels,
+              size_t position,
+              size_t end,
+              size_t bytes_per_pixel,
+              size_t plane_size,
+              const uint8_t *table
+          );
+} filters_kernel_set;
+
+static const float Filters_Sepia_Coefficients[] = {
+    0.272f, 0.534f, 0.131f,
+    0.349f, 0.686f, 0.168f,
+    0.393f, 0.769f, 0.189f
+};
+
+/*
+    Binds the filters to the kernel set called `name`, or to the best one the
+    processor supports for NULL. Without a call, the best one is used.
+*/
+static const filters_kernel_set *filters_select_kernel_set(
+                                     const char *name,
+                                     const char **error_message
+                                 );
+
+static inline const filters_kernel_set *filters_get_kernel_set(void);
+
+/*
+    Fills a lookup table with the brightness and contrast adjustment of every
+    channel value, computed by the kernels in use.
+*/
+static void filters_build_brightness_contrast_table(
+                uint8_t *table,
+                float brightness,
+                float contrast
+            );
+
+/*
+    Tells whether the kernels in use may adjust brightness and contrast in
+    fixed point. The answer for the last pair of values is kept, so filtering
+    many images or bands with the same ones decides it once.
+*/
+static bool filters_brightness_contrast_takes_fixed_point(
+                float brightness,
+                float contrast
+            );
+
+/* Every kernel set is built from the same sources with one implementation defined. */
+
+#define FILTERS_C_IMPLEMENTATION
+#define FILTERS_KERNEL_SET_NAME(NAME) NAME##_c
+#define FILTERS_KERNEL_SET_TARGET
+#include "filters_kernels.h"
+#undef FILTERS_KERNEL_SET_TARGET
+#undef FILTERS_KERNEL_SET_NAME
+#undef FILTERS_C_IMPLEMENTATION
+
+#define FILTERS_X87_ASM_IMPLEMENTATION
+#define FILTERS_KERNEL_SET_NAME(NAME) NAME##_x87
+#define FILTERS_KERNEL_SET_TARGET
+#include "filters_kernels.h"
+#undef FILTERS_KERNEL_SET_TARGET
+#undef FILTERS_KERNEL_SET_NAME
+#undef FILTERS_X87_ASM_IMPLEMENTATION
+
+#define FILTERS_SSE41_ASM_IMPLEMENTATION
+#define FILTERS_KERNEL_SET_NAME(NAME) NAME##_sse41
+#define FILTERS_KERNEL_SET_TARGET __attribute__((target("sse4.1")))
+#include "filters_kernels.h"
+#undef FILTERS_KERNEL_SET_TARGET
+#undef FILTERS_KERNEL_SET_NAME
+#undef FILTERS_SSE41_ASM_IMPLEMENTATION
+
+#define FILTERS_AVX2_ASM_IMPLEMENTATION
+#define FILTERS_KERNEL_SET_NAME(NAME) NAME##_avx2
+#define FILTERS_KERNEL_SET_TARGET __attribute__((target("avx2")))
+#include "filters_kernels.h"
+#undef FILTERS_KERNEL_SET_TARGET
+#undef FILTERS_KERNEL_SET_NAME
+#undef FILTERS_AVX2_ASM_IMPLEMENTATION
+
+#define FILTERS_SIMD_ASM_IMPLEMENTATION
+#define FILTERS_KERNEL_SET_NAME(NAME) NAME##_avx512
+#define FILTERS_KERNEL_SET_TARGET __attribute__((target("avx512f,avx512bw")))
+#include "filters_kernels.h"
+#undef FILTERS_KERNEL_SET_TARGET
+#undef FILTERS_KERNEL_SET_NAME
+#undef FILTERS_SIMD_ASM_IMPLEMENTATION
 
 #include "filters.impl.h.c"
 
 #endif /* FILTERS_H */
-
@@ -0,0 +1,341 @@
+/*
+    Included by "filters.h" once per kernel set, with one of
+    FILTERS_C_IMPLEMENTATION, FILTERS_X87_ASM_IMPLEMENTATION,
+    FILTERS_SSE41_ASM_IMPLEMENTATION, FILTERS_AVX2_ASM_IMPLEMENTATION or
+    FILTERS_SIMD_ASM_IMPLEMENTATION defined, FILTERS_KERNEL_SET_NAME adding
+    the suffix of the set to every name and FILTERS_KERNEL_SET_TARGET
+    enabling the instructions the set needs. There is no include guard.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION  || \
+    defined FILTERS_AVX2_ASM_IMPLEMENTATION  || \
+    defined FILTERS_SSE41_ASM_IMPLEMENTATION
+#define FILTERS_VECTOR_IMPLEMENTATION
+#endif
+
+#define filters_apply_brightness_contrast         FILTERS_KERNEL_SET_NAME(filters_apply_brightness_contrast)
+#define filters_apply_sepia                       FILTERS_KERNEL_SET_NAME(filters_apply_sepia)
+#define filters_apply_median                      FILTERS_KERNEL_SET_NAME(filters_apply_median)
+#define filters_apply_brightness_contrast_bgrx    FILTERS_KERNEL_SET_NAME(filters_apply_brightness_contrast_bgrx)
+#define filters_apply_sepia_bgrx                  FILTERS_KERNEL_SET_NAME(filters_apply_sepia_bgrx)
+#define filters_apply_median_bgrx                 FILTERS_KERNEL_SET_NAME(filters_apply_median_bgrx)
+#define filters_apply_brightness_contrast_planar  FILTERS_KERNEL_SET_NAME(filters_apply_brightness_contrast_planar)
+#define filters_apply_sepia_planar                FILTERS_KERNEL_SET_NAME(filters_apply_sepia_planar)
+#define filters_apply_median_planar               FILTERS_KERNEL_SET_NAME(filters_apply_median_planar)
+#define filters_apply_sepia_bgr                   FILTERS_KERNEL_SET_NAME(filters_apply_sepia_bgr)
+#define filters_apply_median_bgr                  FILTERS_KERNEL_SET_NAME(filters_apply_median_bgr)
+#define filters_apply_median_run                  FILTERS_KERNEL_SET_NAME(filters_apply_median_run)
+#define filters_apply_median_network              FILTERS_KERNEL_SET_NAME(filters_apply_median_network)
+#define filters_apply_median_sliding              FILTERS_KERNEL_SET_NAME(filters_apply_median_sliding)
+#define filters_apply_median_columns              FILTERS_KERNEL_SET_NAME(filters_apply_median_columns)
+#define filters_apply_lookup                      FILTERS_KERNEL_SET_NAME(filters_apply_lookup)
+#define filters_kernels_are_supported             FILTERS_KERNEL_SET_NAME(filters_kernels_are_supported)
+#define filters_kernels_prefer_lookup             FILTERS_KERNEL_SET_NAME(filters_kernels_prefer_lookup)
+#define filters_kernels_fixed_point_is_exact      FILTERS_KERNEL_SET_NAME(filters_kernels_fixed_point_is_exact)
+#define filters_kernels_channels_per_step         FILTERS_KERNEL_SET_NAME(filters_kernels_channels_per_step)
+#define filters_kernels_brightness_contrast       FILTERS_KERNEL_SET_NAME(filters_kernels_brightness_contrast)
+#define filters_kernels_sepia                     FILTERS_KERNEL_SET_NAME(filters_kernels_sepia)
+#define filters_kernels_median                    FILTERS_KERNEL_SET_NAME(filters_kernels_median)
+#define filters_kernels_median_tile               FILTERS_KERNEL_SET_NAME(filters_kernels_median_tile)
+#define filters_kernels_lookup                    FILTERS_KERNEL_SET_NAME(filters_kernels_lookup)
+#define _filters_compare_color_channels           FILTERS_KERNEL_SET_NAME(_filters_compare_color_channels)
+#define _filters_brightness_contrast_vector       FILTERS_KERNEL_SET_NAME(_filters_brightness_contrast_vector)
+#define _filters_sepia_vector                     FILTERS_KERNEL_SET_NAME(_filters_sepia_vector)
+#define _filters_sepia_bgrx_vector                FILTERS_KERNEL_SET_NAME(_filters_sepia_bgrx_vector)
+#define _filters_shuffle_pixels_vector            FILTERS_KERNEL_SET_NAME(_filters_shuffle_pixels_vector)
+#define _filters_median_vector                    FILTERS_KERNEL_SET_NAME(_filters_median_vector)
+#define _filters_lookup_vector                    FILTERS_KERNEL_SET_NAME(_filters_lookup_vector)
+#define _filters_lookup_vbmi                      FILTERS_KERNEL_SET_NAME(_filters_lookup_vbmi)
+#define _filters_sepia_bgr_vbmi                   FILTERS_KERNEL_SET_NAME(_filters_sepia_bgr_vbmi)
+#define _filters_brightness_contrast_fixed_point  FILTERS_KERNEL_SET_NAME(_filters_brightness_contrast_fixed_point)
+#define _filters_median_run                       FILTERS_KERNEL_SET_NAME(_filters_median_run)
+#define _filters_slide_histogram                  FILTERS_KERNEL_SET_NAME(_filters_slide_histogram)
+#define Filters_Kernel_Set                        FILTERS_KERNEL_SET_NAME(Filters_Kernel_Set)
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_brightness_contrast(
+                       uint8_t *pixels,
+                       size_t position,
+                       float brightness,
+                       float contrast
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_sepia(
+                       uint8_t *pixels,
+                       size_t position
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_brightness_contrast_bgrx(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count,
+                       float brightness,
+                       float contrast
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_sepia_bgrx(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_bgrx(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_brightness_contrast_planar(
+                       uint8_t *plane,
+                       size_t position,
+                       size_t channel_count,
+                       float brightness,
+                       float contrast
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_sepia_planar(
+                       uint8_t *blue,
+                       uint8_t *green,
+                       uint8_t *red,
+                       size_t position,
+                       size_t pixel_count
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_planar(
+                       uint8_t *source_plane,
+                       uint8_t *destination_plane,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_sepia_bgr(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_bgr(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_network(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_sliding(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   );
+
+FILTERS_KERNEL_SET_TARGET
+static inline bool filters_apply_median_columns(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t y,
+                       size_t row_count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   );
+
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_median_run(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t y,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t count
+                   );
+#endif
+
+FILTERS_KERNEL_SET_TARGET
+static inline void filters_apply_lookup(
+                       uint8_t *channels,
+                       size_t count,
+                       bool keep_alpha,
+                       const uint8_t *table
+                   );
+
+/* Segment Kernels */
+
+static bool filters_kernels_are_supported(void);
+
+static bool filters_kernels_prefer_lookup(void);
+
+FILTERS_KERNEL_SET_TARGET
+static bool filters_kernels_fixed_point_is_exact(
+                float brightness,
+                float contrast
+            );
+
+static size_t filters_kernels_channels_per_step(
+                  size_t bytes_per_pixel,
+                  size_t plane_size
+              );
+
+FILTERS_KERNEL_SET_TARGET
+static void filters_kernels_brightness_contrast(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                bool padded,
+                float brightness,
+                float contrast,
+                bool fixed_point
+            );
+
+FILTERS_KERNEL_SET_TARGET
+static void filters_kernels_sepia(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size
+            );
+
+FILTERS_KERNEL_SET_TARGET
+static void filters_kernels_median(
+                uint8_t *source_pixels,
+                uint8_t *destination_pixels,
+                size_t position,
+                size_t end,
+                size_t width,
+                size_t height,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                size_t row_stride,
+                size_t radius
+            );
+
+FILTERS_KERNEL_SET_TARGET
+static void filters_kernels_median_tile(
+                uint8_t *source_tile,
+                uint8_t *destination_tile,
+                size_t columns,
+                size_t rows,
+                size_t bytes_per_pixel
+            );
+
+FILTERS_KERNEL_SET_TARGET
+static void filters_kernels_lookup(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                const uint8_t *table
+            );
+
+#include "filters_kernels.impl.h.c"
+
+#undef filters_apply_brightness_contrast
+#undef filters_apply_sepia
+#undef filters_apply_median
+#undef filters_apply_brightness_contrast_bgrx
+#undef filters_apply_sepia_bgrx
+#undef filters_apply_median_bgrx
+#undef filters_apply_brightness_contrast_planar
+#undef filters_apply_sepia_planar
+#undef filters_apply_median_planar
+#undef filters_apply_sepia_bgr
+#undef filters_apply_median_bgr
+#undef filters_apply_median_run
+#undef filters_apply_median_network
+#undef filters_apply_median_sliding
+#undef filters_apply_median_columns
+#undef filters_apply_lookup
+#undef filters_kernels_are_supported
+#undef filters_kernels_prefer_lookup
+#undef filters_kernels_fixed_point_is_exact
+#undef filters_kernels_channels_per_step
+#undef filters_kernels_brightness_contrast
+#undef filters_kernels_sepia
+#undef filters_kernels_median
+#undef filters_kernels_median_tile
+#undef filters_kernels_lookup
+#undef _filters_compare_color_channels
+#undef _filters_brightness_contrast_vector
+#undef _filters_sepia_vector
+#undef _filters_sepia_bgrx_vector
+#undef _filters_shuffle_pixels_vector
+#undef _filters_median_vector
+#undef _filters_lookup_vector
+#undef _filters_lookup_vbmi
+#undef _filters_sepia_bgr_vbmi
+#undef _filters_brightness_contrast_fixed_point
+#undef _filters_median_run
+#undef _filters_slide_histogram
+#undef Filters_Kernel_Set
+
+#undef FILTERS_VECTOR_IMPLEMENTATION
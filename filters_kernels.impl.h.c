@@ -0,0 +1,3284 @@
+#include "filters.h"
+#include "bmp.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+/*
+    // AT&T/UNIX GCC Inline Assembly Sample
+
+    static const char Argument[] =                   // C constants
+        "some data";
+    static const unsigned long Another_Argument =
+        sizeof(Argument);
+    long result;                                     // a C variable
+
+    // x86, x86-64
+    __asm__ __volatile__ (
+        "op-code<length suffix> %%src_register, %%dest_register\n\t"
+        "op-code<length suffix> $immediate, %%dest_register\n\t"
+        // ...
+        "op-code<length suffix> %<argument number>, %%dest_register\n\t"
+        "op-code"
+        : "=a" (result)                              // output argument/s
+        : "D" ((unsigned long) file_descriptor),     // input arguments
+            "S" (buffer),
+            "d" (buffer_size),
+            "r" (Argument), "r" (Another_Argument)
+        : "%used register", "%another used register" // clobbered registers
+    );
+
+    // The ARM assembly syntax uses the `#` symbol for constants and NOT
+    // the `$` symbol. Registers `r` or `x` (for the 32-bit or 64-bit
+    // architecture) do not need a `%%` prefix.
+    //
+    // `__asm__` and `__volatile__` could also be written as `asm` and `volatile`.
+    //
+    // The `volatile` modifier tells the compiler not to remove or reorder
+    // the inlined assembly block during the compiler optimization step.
+    //
+    // <length suffixes>
+    //     'b'    'w'     's'     'l'     'q'
+    //      8 bit  16 bit  16 bit  32 bit  64 bit  integers
+    //                     32 bit  64 bit          floating point numbers
+    //
+    // Length suffixes are not required for the ARM assembly syntax.
+    // Argument numbers go from top to bottom, from left to right
+    // starting from zero.
+    //
+    //     result           : %<argument number> = %0
+    //     file_descriptor  : ...                = %1
+    //     buffer           :                    = %2
+    //     buffer_size      :                    = %3
+    //     Argument         :                    = %4
+    //     Another_Argument :                    = %5
+    //
+    // The first quoted letter before the argument in brackets is a
+    // register constraint. It tells the compiler to provide the
+    // argument through that register.
+    //
+    // On X86/-64 the following register constraints are possible
+    // +---+--------------------------+
+    // | r :   any register           |
+    // +---+--------------------------+
+    // | a :   %rax, %eax, %ax, %al   |
+    // | b :   %rbx, %ebx, %bx, %bl   |
+    // | c :   %rcx, %ecx, %cx, %cl   |
+    // | d :   %rdx, %edx, %dx, %dl   |
+    // | S :   %rsi, %esi, %si        |
+    // | D :   %rdi, %edi, %di        |
+    // +---+--------------------------+
+    //
+    // On ARM, the `r` constraint will work for all general purpose
+    // registers. The input variable's register can be specified after the
+    // variable's declaration wrapped in quotes and parentheses.
+    //
+    //     register long result ("r7"); // 32-bit ARM
+    //     register long result ("x0"); // 64-bit ARM
+    //
+    // All registers used as input or output arguments should not be
+    // listed as clobbered.
+    //
+    // https://www.ibiblio.org/gferg/ldp/GCC-Inline-Assembly-HOWTO.html
+*/
+
+#ifndef FILTERS_VECTOR_CONSTANTS
+#define FILTERS_VECTOR_CONSTANTS
+
+static const float Filters_Channel_Maximum = 255.0f;
+
+// Bytes set in a keep mask are carried over unfiltered by the vector
+// kernels, the alpha mask keeps the X/alpha byte of 32 bpp pixels.
+static const uint8_t Filters_Keep_Alpha_Mask[32] __attribute__((aligned(32))) = {
+    0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff,
+    0x00, 0x00, 0x00, 0xff, 0x00, 0x00, 0x00, 0xff
+};
+
+static const uint8_t Filters_Keep_No_Mask[32] __attribute__((aligned(32))) = { 0 };
+
+// Lookups through 16 byte shuffles step over the table in rows of 16
+// entries. Indices are moved down by a row per step, the bias keeps the
+// low four bits of the ones in the current row and sets the top bit of all
+// others, which makes the shuffles return 0 for them.
+static const uint8_t Filters_Lookup_Row_Step[32] __attribute__((aligned(32))) = {
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+};
+
+static const uint8_t Filters_Lookup_Row_Bias[32] __attribute__((aligned(32))) = {
+    0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70,
+    0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70,
+    0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70,
+    0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70, 0x70
+};
+
+// Byte shuffles between 16 packed 24 bpp pixels in three vectors and their
+// B, G and R planes. `Filters_Deinterleave_Shuffles[c * 3 + v]` picks the
+// channel `c` bytes of vector `v`, `Filters_Interleave_Shuffles[v * 3 + c]`
+// puts the bytes of plane `c` into vector `v`.
+static const uint8_t Filters_Deinterleave_Shuffles[9][16] __attribute__((aligned(16))) = {
+    { 0x00, 0x03, 0x06, 0x09, 0x0c, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x02, 0x05, 0x08, 0x0b, 0x0e, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x04, 0x07, 0x0a, 0x0d },
+    { 0x01, 0x04, 0x07, 0x0a, 0x0d, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x03, 0x06, 0x09, 0x0c, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x02, 0x05, 0x08, 0x0b, 0x0e },
+    { 0x02, 0x05, 0x08, 0x0b, 0x0e, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01, 0x04, 0x07, 0x0a, 0x0d, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 },
+    { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x00, 0x03, 0x06, 0x09, 0x0c, 0x0f }
+};
+
+// The same split and merge of 16 packed 24 bpp pixels within one vector
+// of 64 bytes for byte permutes, the planes follow each other.
+static const uint8_t Filters_Deinterleave_Permutes[64] __attribute__((aligned(64))) = {
+    0x00, 0x03, 0x06, 0x09, 0x0c, 0x0f, 0x12, 0x15, 0x18, 0x1b, 0x1e, 0x21, 0x24, 0x27, 0x2a, 0x2d,
+    0x01, 0x04, 0x07, 0x0a, 0x0d, 0x10, 0x13, 0x16, 0x19, 0x1c, 0x1f, 0x22, 0x25, 0x28, 0x2b, 0x2e,
+    0x02, 0x05, 0x08, 0x0b, 0x0e, 0x11, 0x14, 0x17, 0x1a, 0x1d, 0x20, 0x23, 0x26, 0x29, 0x2c, 0x2f,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f
+};
+
+static const uint8_t Filters_Interleave_Permutes[64] __attribute__((aligned(64))) = {
+    0x00, 0x10, 0x20, 0x01, 0x11, 0x21, 0x02, 0x12, 0x22, 0x03, 0x13, 0x23, 0x04, 0x14, 0x24, 0x05,
+    0x15, 0x25, 0x06, 0x16, 0x26, 0x07, 0x17, 0x27, 0x08, 0x18, 0x28, 0x09, 0x19, 0x29, 0x0a, 0x1a,
+    0x2a, 0x0b, 0x1b, 0x2b, 0x0c, 0x1c, 0x2c, 0x0d, 0x1d, 0x2d, 0x0e, 0x1e, 0x2e, 0x0f, 0x1f, 0x2f,
+    0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f
+};
+
+static const uint8_t Filters_Interleave_Shuffles[9][16] __attribute__((aligned(16))) = {
+    { 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80, 0x05 },
+    { 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80 },
+    { 0x80, 0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80 },
+    { 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a, 0x80 },
+    { 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a },
+    { 0x80, 0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80 },
+    { 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80, 0x80 },
+    { 0x80, 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80 },
+    { 0x0a, 0x80, 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f }
+};
+
+// One sepia output channel of 4 (SSE4.1) or 8 (AVX2) pixels with the blue,
+// green and red channels as floats in the registers 1, 2 and 3 and 255.0 in
+// register 6. The products are summed in the order of the C code, the sum is
+// clamped and truncated into the integers of register 4, register 5 is used
+// as a scratch register.
+#define FILTERS_SSE41_SEPIA_CHANNEL(COEFFICIENTS, RED, GREEN, BLUE) \
+    "movss " #RED "(" COEFFICIENTS "), %%xmm4\n\t"                 \
+    "shufps $0x0, %%xmm4, %%xmm4\n\t"                               \
+    "mulps %%xmm3, %%xmm4\n\t"                                      \
+    "movss " #GREEN "(" COEFFICIENTS "), %%xmm5\n\t"               \
+    "shufps $0x0, %%xmm5, %%xmm5\n\t"                               \
+    "mulps %%xmm2, %%xmm5\n\t"                                      \
+    "addps %%xmm5, %%xmm4\n\t"                                      \
+    "movss " #BLUE "(" COEFFICIENTS "), %%xmm5\n\t"                \
+    "shufps $0x0, %%xmm5, %%xmm5\n\t"                               \
+    "mulps %%xmm1, %%xmm5\n\t"                                      \
+    "addps %%xmm5, %%xmm4\n\t"                                      \
+    "minps %%xmm6, %%xmm4\n\t"                                      \
+    "cvttps2dq %%xmm4, %%xmm4\n\t"
+
+#define FILTERS_AVX2_SEPIA_CHANNEL(COEFFICIENTS, RED, GREEN, BLUE)  \
+    "vbroadcastss " #RED "(" COEFFICIENTS "), %%ymm4\n\t"          \
+    "vmulps %%ymm3, %%ymm4, %%ymm4\n\t"                             \
+    "vbroadcastss " #GREEN "(" COEFFICIENTS "), %%ymm5\n\t"        \
+    "vmulps %%ymm2, %%ymm5, %%ymm5\n\t"                             \
+    "vaddps %%ymm5, %%ymm4, %%ymm4\n\t"                             \
+    "vbroadcastss " #BLUE "(" COEFFICIENTS "), %%ymm5\n\t"         \
+    "vmulps %%ymm1, %%ymm5, %%ymm5\n\t"                             \
+    "vaddps %%ymm5, %%ymm4, %%ymm4\n\t"                             \
+    "vminps %%ymm6, %%ymm4, %%ymm4\n\t"                             \
+    "vcvttps2dq %%ymm4, %%ymm4\n\t"
+
+// Byte exchanges of the median-of-9 network below for SSE4.1 and AVX2.
+#define FILTERS_SSE41_SORT_BYTES(a, b)                 \
+    "movdqa %%xmm" #a ", %%xmm9\n\t"                   \
+    "pminub %%xmm" #b ", %%xmm9\n\t"                   \
+    "pmaxub %%xmm" #a ", %%xmm" #b "\n\t"              \
+    "movdqa %%xmm9, %%xmm" #a "\n\t"
+
+#define FILTERS_AVX2_SORT_BYTES(a, b)                    \
+    "vpminub %%ymm" #a ", %%ymm" #b ", %%ymm9\n\t"      \
+    "vpmaxub %%ymm" #a ", %%ymm" #b ", %%ymm" #b "\n\t" \
+    "vmovdqa %%ymm9, %%ymm" #a "\n\t"
+
+#define FILTERS_MEDIAN_OF_9_NETWORK(SORT_BYTES)         \
+    SORT_BYTES(1, 2) SORT_BYTES(4, 5) SORT_BYTES(7, 8)  \
+    SORT_BYTES(0, 1) SORT_BYTES(3, 4) SORT_BYTES(6, 7)  \
+    SORT_BYTES(1, 2) SORT_BYTES(4, 5) SORT_BYTES(7, 8)  \
+    SORT_BYTES(0, 3) SORT_BYTES(5, 8) SORT_BYTES(4, 7)  \
+    SORT_BYTES(3, 6) SORT_BYTES(1, 4) SORT_BYTES(2, 5)  \
+    SORT_BYTES(4, 7) SORT_BYTES(4, 2) SORT_BYTES(6, 4)  \
+    SORT_BYTES(4, 2)
+
+// Windows past the default radius sorted by exchange networks are sorted
+// for this many channels at once.
+#define FILTERS_MEDIAN_NETWORK_LANES 64
+
+// Histograms of channel values have a bin for every value followed by a
+// coarse bin for every 16 of them. The coarse bins lead the way to the fine
+// bin of a rank.
+#define FILTERS_MEDIAN_FINE_BINS      256
+#define FILTERS_MEDIAN_HISTOGRAM_BINS (FILTERS_MEDIAN_FINE_BINS + FILTERS_MEDIAN_FINE_BINS / 16)
+
+// Counts `value` into a histogram with coarse bins.
+static inline void _filters_count_in_histogram(
+                       uint16_t *histogram,
+                       uint8_t value
+                   )
+{
+    ++histogram[value];
+    ++histogram[FILTERS_MEDIAN_FINE_BINS + (value >> 4)];
+}
+
+static inline void _filters_remove_from_histogram(
+                       uint16_t *histogram,
+                       uint8_t value
+                   )
+{
+    --histogram[value];
+    --histogram[FILTERS_MEDIAN_FINE_BINS + (value >> 4)];
+}
+
+// Finds the value of rank `rank` (counted from 0) in a histogram with
+// coarse bins.
+static inline uint8_t _filters_select_from_histogram(
+                          const uint16_t *histogram,
+                          size_t rank
+                      )
+{
+    const uint16_t *coarse =
+        histogram + FILTERS_MEDIAN_FINE_BINS;
+
+    size_t bin =
+        0;
+    size_t below =
+        0;
+    while (below + coarse[bin] <= rank) {
+        below += coarse[bin++];
+    }
+
+    bin *= 16;
+    while (below + histogram[bin] <= rank) {
+        below += histogram[bin++];
+    }
+
+    return (uint8_t) bin;
+}
+
+#endif
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+// Vector kernels of the AVX2 and SSE4.1 sets. They follow the C code
+// exactly: products and sums are not fused, results are clamped as floats
+// and truncated.
+
+// Filters 16 channels, bytes set in `keep_mask` stay as they are.
+static inline void _filters_brightness_contrast_vector(
+                       uint8_t *pixels,
+                       const uint8_t *keep_mask,
+                       float brightness,
+                       float contrast
+                   )
+{
+#if defined x86_32_CPU || defined x86_64_CPU
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+
+    __asm__ __volatile__ (
+        "vbroadcastss (%0), %%ymm2\n\t"
+        "vbroadcastss (%1), %%ymm1\n\t"
+        "vbroadcastss (%4), %%ymm6\n\t"
+        "vxorps %%ymm3, %%ymm3, %%ymm3\n\t"
+
+        "vpmovzxbd (%2), %%ymm4\n\t"
+        "vpmovzxbd 0x8(%2), %%ymm5\n\t"
+        "vcvtdq2ps %%ymm4, %%ymm4\n\t"
+        "vcvtdq2ps %%ymm5, %%ymm5\n\t"
+        "vmulps %%ymm1, %%ymm4, %%ymm4\n\t"
+        "vmulps %%ymm1, %%ymm5, %%ymm5\n\t"
+        "vaddps %%ymm2, %%ymm4, %%ymm4\n\t"
+        "vaddps %%ymm2, %%ymm5, %%ymm5\n\t"
+        "vmaxps %%ymm3, %%ymm4, %%ymm4\n\t"
+        "vmaxps %%ymm3, %%ymm5, %%ymm5\n\t"
+        "vminps %%ymm6, %%ymm4, %%ymm4\n\t"
+        "vminps %%ymm6, %%ymm5, %%ymm5\n\t"
+        "vcvttps2dq %%ymm4, %%ymm4\n\t"
+        "vcvttps2dq %%ymm5, %%ymm5\n\t"
+
+        "vpackusdw %%ymm5, %%ymm4, %%ymm4\n\t"
+        "vpermq $0xd8, %%ymm4, %%ymm4\n\t"
+        "vextracti128 $0x1, %%ymm4, %%xmm5\n\t"
+        "vpackuswb %%xmm5, %%xmm4, %%xmm4\n\t"
+
+        "vmovdqu (%3), %%xmm1\n\t"
+        "vpblendvb %%xmm1, (%2), %%xmm4, %%xmm4\n\t"
+        "vmovdqu %%xmm4, (%2)\n\t"
+    ::
+        "r"(&brightness), "r"(&contrast), "r"(pixels), "r"(keep_mask),
+        "r"(&Filters_Channel_Maximum)
+    :
+        "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "memory"
+    );
+
+#else
+
+    __asm__ __volatile__ (
+        "movss (%0), %%xmm2\n\t"
+        "shufps $0x0, %%xmm2, %%xmm2\n\t"
+        "movss (%1), %%xmm1\n\t"
+        "shufps $0x0, %%xmm1, %%xmm1\n\t"
+        "movss (%4), %%xmm6\n\t"
+        "shufps $0x0, %%xmm6, %%xmm6\n\t"
+        "xorps %%xmm3, %%xmm3\n\t"
+
+        "pmovzxbd (%2), %%xmm4\n\t"
+        "pmovzxbd 0x4(%2), %%xmm5\n\t"
+        "pmovzxbd 0x8(%2), %%xmm0\n\t"
+        "pmovzxbd 0xc(%2), %%xmm7\n\t"
+        "cvtdq2ps %%xmm4, %%xmm4\n\t"
+        "cvtdq2ps %%xmm5, %%xmm5\n\t"
+        "cvtdq2ps %%xmm0, %%xmm0\n\t"
+        "cvtdq2ps %%xmm7, %%xmm7\n\t"
+        "mulps %%xmm1, %%xmm4\n\t"
+        "mulps %%xmm1, %%xmm5\n\t"
+        "mulps %%xmm1, %%xmm0\n\t"
+        "mulps %%xmm1, %%xmm7\n\t"
+        "addps %%xmm2, %%xmm4\n\t"
+        "addps %%xmm2, %%xmm5\n\t"
+        "addps %%xmm2, %%xmm0\n\t"
+        "addps %%xmm2, %%xmm7\n\t"
+        "maxps %%xmm3, %%xmm4\n\t"
+        "maxps %%xmm3, %%xmm5\n\t"
+        "maxps %%xmm3, %%xmm0\n\t"
+        "maxps %%xmm3, %%xmm7\n\t"
+        "minps %%xmm6, %%xmm4\n\t"
+        "minps %%xmm6, %%xmm5\n\t"
+        "minps %%xmm6, %%xmm0\n\t"
+        "minps %%xmm6, %%xmm7\n\t"
+        "cvttps2dq %%xmm4, %%xmm4\n\t"
+        "cvttps2dq %%xmm5, %%xmm5\n\t"
+        "cvttps2dq %%xmm0, %%xmm0\n\t"
+        "cvttps2dq %%xmm7, %%xmm7\n\t"
+
+        "packusdw %%xmm5, %%xmm4\n\t"
+        "packusdw %%xmm7, %%xmm0\n\t"
+        "packuswb %%xmm0, %%xmm4\n\t"
+
+        "movdqu (%3), %%xmm1\n\t"
+        "movdqu (%2), %%xmm5\n\t"
+        "pand %%xmm1, %%xmm5\n\t"
+        "pandn %%xmm4, %%xmm1\n\t"
+        "por %%xmm5, %%xmm1\n\t"
+        "movdqu %%xmm1, (%2)\n\t"
+    ::
+        "r"(&brightness), "r"(&contrast), "r"(pixels), "r"(keep_mask),
+        "r"(&Filters_Channel_Maximum)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+        "memory"
+    );
+
+#endif
+
+#else
+#error "Unsupported processor architecture"
+#endif
+}
+
+// Filters 16 pixels kept in three planes of 16 bytes.
+static inline void _filters_sepia_vector(
+                       uint8_t *blue,
+                       uint8_t *green,
+                       uint8_t *red
+                   )
+{
+#if defined x86_32_CPU || defined x86_64_CPU
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+
+    for (size_t i = 0; i < 16; i += 8) {
+        __asm__ __volatile__ (
+            "vbroadcastss (%4), %%ymm6\n\t"
+            "vpmovzxbd (%0), %%ymm1\n\t"
+            "vpmovzxbd (%1), %%ymm2\n\t"
+            "vpmovzxbd (%2), %%ymm3\n\t"
+            "vcvtdq2ps %%ymm1, %%ymm1\n\t"
+            "vcvtdq2ps %%ymm2, %%ymm2\n\t"
+            "vcvtdq2ps %%ymm3, %%ymm3\n\t"
+
+            FILTERS_AVX2_SEPIA_CHANNEL("%3", 0x0, 0x4, 0x8)
+            "vmovdqa %%ymm4, %%ymm0\n\t"
+            FILTERS_AVX2_SEPIA_CHANNEL("%3", 0xc, 0x10, 0x14)
+            "vmovdqa %%ymm4, %%ymm7\n\t"
+            FILTERS_AVX2_SEPIA_CHANNEL("%3", 0x18, 0x1c, 0x20)
+
+            "vextracti128 $0x1, %%ymm0, %%xmm5\n\t"
+            "vpackusdw %%xmm5, %%xmm0, %%xmm0\n\t"
+            "vpackuswb %%xmm0, %%xmm0, %%xmm0\n\t"
+            "vmovq %%xmm0, (%0)\n\t"
+            "vextracti128 $0x1, %%ymm7, %%xmm5\n\t"
+            "vpackusdw %%xmm5, %%xmm7, %%xmm7\n\t"
+            "vpackuswb %%xmm7, %%xmm7, %%xmm7\n\t"
+            "vmovq %%xmm7, (%1)\n\t"
+            "vextracti128 $0x1, %%ymm4, %%xmm5\n\t"
+            "vpackusdw %%xmm5, %%xmm4, %%xmm4\n\t"
+            "vpackuswb %%xmm4, %%xmm4, %%xmm4\n\t"
+            "vmovq %%xmm4, (%2)\n\t"
+        ::
+            "r"(blue + i), "r"(green + i), "r"(red + i),
+            "r"(Filters_Sepia_Coefficients), "r"(&Filters_Channel_Maximum)
+        :
+            "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+            "memory"
+        );
+    }
+
+#else
+
+    for (size_t i = 0; i < 16; i += 4) {
+        __asm__ __volatile__ (
+            "movss (%4), %%xmm6\n\t"
+            "shufps $0x0, %%xmm6, %%xmm6\n\t"
+            "pmovzxbd (%0), %%xmm1\n\t"
+            "pmovzxbd (%1), %%xmm2\n\t"
+            "pmovzxbd (%2), %%xmm3\n\t"
+            "cvtdq2ps %%xmm1, %%xmm1\n\t"
+            "cvtdq2ps %%xmm2, %%xmm2\n\t"
+            "cvtdq2ps %%xmm3, %%xmm3\n\t"
+
+            FILTERS_SSE41_SEPIA_CHANNEL("%3", 0x0, 0x4, 0x8)
+            "movdqa %%xmm4, %%xmm0\n\t"
+            FILTERS_SSE41_SEPIA_CHANNEL("%3", 0xc, 0x10, 0x14)
+            "movdqa %%xmm4, %%xmm7\n\t"
+            FILTERS_SSE41_SEPIA_CHANNEL("%3", 0x18, 0x1c, 0x20)
+
+            "packusdw %%xmm0, %%xmm0\n\t"
+            "packuswb %%xmm0, %%xmm0\n\t"
+            "movd %%xmm0, (%0)\n\t"
+            "packusdw %%xmm7, %%xmm7\n\t"
+            "packuswb %%xmm7, %%xmm7\n\t"
+            "movd %%xmm7, (%1)\n\t"
+            "packusdw %%xmm4, %%xmm4\n\t"
+            "packuswb %%xmm4, %%xmm4\n\t"
+            "movd %%xmm4, (%2)\n\t"
+        ::
+            "r"(blue + i), "r"(green + i), "r"(red + i),
+            "r"(Filters_Sepia_Coefficients), "r"(&Filters_Channel_Maximum)
+        :
+            "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+            "memory"
+        );
+    }
+
+#endif
+
+#else
+#error "Unsupported processor architecture"
+#endif
+}
+
+// Filters 8 (AVX2) or 4 (SSE4.1) BGRX pixels, the X/alpha byte is kept.
+static inline void _filters_sepia_bgrx_vector(uint8_t *pixels)
+{
+#if defined x86_32_CPU || defined x86_64_CPU
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+
+    __asm__ __volatile__ (
+        "vmovdqu (%0), %%ymm7\n\t"
+        "vpcmpeqd %%ymm6, %%ymm6, %%ymm6\n\t"
+        "vpsrld $24, %%ymm6, %%ymm6\n\t"
+        "vpand %%ymm6, %%ymm7, %%ymm1\n\t"
+        "vpsrld $8, %%ymm7, %%ymm2\n\t"
+        "vpand %%ymm6, %%ymm2, %%ymm2\n\t"
+        "vpsrld $16, %%ymm7, %%ymm3\n\t"
+        "vpand %%ymm6, %%ymm3, %%ymm3\n\t"
+        "vcvtdq2ps %%ymm1, %%ymm1\n\t"
+        "vcvtdq2ps %%ymm2, %%ymm2\n\t"
+        "vcvtdq2ps %%ymm3, %%ymm3\n\t"
+        "vbroadcastss (%2), %%ymm6\n\t"
+
+        FILTERS_AVX2_SEPIA_CHANNEL("%1", 0x0, 0x4, 0x8)
+        "vmovdqa %%ymm4, %%ymm0\n\t"
+        FILTERS_AVX2_SEPIA_CHANNEL("%1", 0xc, 0x10, 0x14)
+        "vpslld $8, %%ymm4, %%ymm4\n\t"
+        "vpor %%ymm4, %%ymm0, %%ymm0\n\t"
+        FILTERS_AVX2_SEPIA_CHANNEL("%1", 0x18, 0x1c, 0x20)
+        "vpslld $16, %%ymm4, %%ymm4\n\t"
+        "vpor %%ymm4, %%ymm0, %%ymm0\n\t"
+
+        "vpsrld $24, %%ymm7, %%ymm7\n\t"
+        "vpslld $24, %%ymm7, %%ymm7\n\t"
+        "vpor %%ymm7, %%ymm0, %%ymm0\n\t"
+        "vmovdqu %%ymm0, (%0)\n\t"
+    ::
+        "r"(pixels), "r"(Filters_Sepia_Coefficients), "r"(&Filters_Channel_Maximum)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+        "memory"
+    );
+
+#else
+
+    __asm__ __volatile__ (
+        "movdqu (%0), %%xmm7\n\t"
+        "pcmpeqd %%xmm6, %%xmm6\n\t"
+        "psrld $24, %%xmm6\n\t"
+        "movdqa %%xmm7, %%xmm1\n\t"
+        "pand %%xmm6, %%xmm1\n\t"
+        "movdqa %%xmm7, %%xmm2\n\t"
+        "psrld $8, %%xmm2\n\t"
+        "pand %%xmm6, %%xmm2\n\t"
+        "movdqa %%xmm7, %%xmm3\n\t"
+        "psrld $16, %%xmm3\n\t"
+        "pand %%xmm6, %%xmm3\n\t"
+        "cvtdq2ps %%xmm1, %%xmm1\n\t"
+        "cvtdq2ps %%xmm2, %%xmm2\n\t"
+        "cvtdq2ps %%xmm3, %%xmm3\n\t"
+        "movss (%2), %%xmm6\n\t"
+        "shufps $0x0, %%xmm6, %%xmm6\n\t"
+
+        FILTERS_SSE41_SEPIA_CHANNEL("%1", 0x0, 0x4, 0x8)
+        "movdqa %%xmm4, %%xmm0\n\t"
+        FILTERS_SSE41_SEPIA_CHANNEL("%1", 0xc, 0x10, 0x14)
+        "pslld $8, %%xmm4\n\t"
+        "por %%xmm4, %%xmm0\n\t"
+        FILTERS_SSE41_SEPIA_CHANNEL("%1", 0x18, 0x1c, 0x20)
+        "pslld $16, %%xmm4\n\t"
+        "por %%xmm4, %%xmm0\n\t"
+
+        "psrld $24, %%xmm7\n\t"
+        "pslld $24, %%xmm7\n\t"
+        "por %%xmm7, %%xmm0\n\t"
+        "movdqu %%xmm0, (%0)\n\t"
+    ::
+        "r"(pixels), "r"(Filters_Sepia_Coefficients), "r"(&Filters_Channel_Maximum)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+        "memory"
+    );
+
+#endif
+
+#else
+#error "Unsupported processor architecture"
+#endif
+}
+
+// Gathers three vectors of 16 bytes out of the three vectors at `source`
+// with `shuffles`, splitting 16 packed 24 bpp pixels into their B, G and R
+// planes or packing them back.
+static inline void _filters_shuffle_pixels_vector(
+                       const uint8_t *source,
+                       uint8_t *destination,
+                       const uint8_t (*shuffles)[16]
+                   )
+{
+#if defined x86_32_CPU || defined x86_64_CPU
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+
+#define FILTERS_SHUFFLE_VECTOR(SHUFFLES, DESTINATION)         \
+    "vpshufb " #SHUFFLES "(%2), %%xmm0, %%xmm3\n\t"           \
+    "vpshufb " #SHUFFLES "+0x10(%2), %%xmm1, %%xmm4\n\t"      \
+    "vpor %%xmm4, %%xmm3, %%xmm3\n\t"                         \
+    "vpshufb " #SHUFFLES "+0x20(%2), %%xmm2, %%xmm4\n\t"      \
+    "vpor %%xmm4, %%xmm3, %%xmm3\n\t"                         \
+    "vmovdqu %%xmm3, " #DESTINATION "(%1)\n\t"
+
+    __asm__ __volatile__ (
+        "vmovdqu (%0), %%xmm0\n\t"
+        "vmovdqu 0x10(%0), %%xmm1\n\t"
+        "vmovdqu 0x20(%0), %%xmm2\n\t"
+        FILTERS_SHUFFLE_VECTOR(0x0, 0x0)
+        FILTERS_SHUFFLE_VECTOR(0x30, 0x10)
+        FILTERS_SHUFFLE_VECTOR(0x60, 0x20)
+    ::
+        "r"(source), "r"(destination), "r"(shuffles)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "memory"
+    );
+
+#undef FILTERS_SHUFFLE_VECTOR
+
+#else
+
+#define FILTERS_SHUFFLE_VECTOR(SHUFFLES, DESTINATION)         \
+    "movdqa %%xmm0, %%xmm3\n\t"                               \
+    "pshufb " #SHUFFLES "(%2), %%xmm3\n\t"                    \
+    "movdqa %%xmm1, %%xmm4\n\t"                               \
+    "pshufb " #SHUFFLES "+0x10(%2), %%xmm4\n\t"               \
+    "por %%xmm4, %%xmm3\n\t"                                  \
+    "movdqa %%xmm2, %%xmm4\n\t"                               \
+    "pshufb " #SHUFFLES "+0x20(%2), %%xmm4\n\t"               \
+    "por %%xmm4, %%xmm3\n\t"                                  \
+    "movdqu %%xmm3, " #DESTINATION "(%1)\n\t"
+
+    __asm__ __volatile__ (
+        "movdqu (%0), %%xmm0\n\t"
+        "movdqu 0x10(%0), %%xmm1\n\t"
+        "movdqu 0x20(%0), %%xmm2\n\t"
+        FILTERS_SHUFFLE_VECTOR(0x0, 0x0)
+        FILTERS_SHUFFLE_VECTOR(0x30, 0x10)
+        FILTERS_SHUFFLE_VECTOR(0x60, 0x20)
+    ::
+        "r"(source), "r"(destination), "r"(shuffles)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "memory"
+    );
+
+#undef FILTERS_SHUFFLE_VECTOR
+
+#endif
+
+#else
+#error "Unsupported processor architecture"
+#endif
+}
+
+#if defined x86_64_CPU
+
+// Filters 32 (AVX2) or 16 (SSE4.1) bytes at `destination` with the median
+// of the 3x3 windows around the bytes of `row`, the bytes of a neighbouring
+// pixel are `distance` bytes away. Bytes set in `keep_mask` are copied from
+// `row`.
+static inline void _filters_median_vector(
+                       const uint8_t *row_above,
+                       const uint8_t *row,
+                       const uint8_t *row_below,
+                       size_t distance,
+                       uint8_t *destination,
+                       const uint8_t *keep_mask
+                   )
+{
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+
+    // 32 bytes at a time.
+    __asm__ __volatile__ (
+        "vmovdqu (%0), %%ymm0\n\t"
+        "vmovdqu (%0,%3), %%ymm1\n\t"
+        "vmovdqu (%0,%3,2), %%ymm2\n\t"
+        "vmovdqu (%1), %%ymm3\n\t"
+        "vmovdqu (%1,%3), %%ymm4\n\t"
+        "vmovdqu (%1,%3,2), %%ymm5\n\t"
+        "vmovdqu (%2), %%ymm6\n\t"
+        "vmovdqu (%2,%3), %%ymm7\n\t"
+        "vmovdqu (%2,%3,2), %%ymm8\n\t"
+
+        FILTERS_MEDIAN_OF_9_NETWORK(FILTERS_AVX2_SORT_BYTES)
+
+        "vmovdqu (%5), %%ymm0\n\t"
+        "vpblendvb %%ymm0, (%1,%3), %%ymm4, %%ymm4\n\t"
+        "vmovdqu %%ymm4, (%4)\n\t"
+    ::
+        "r"(row_above - distance), "r"(row - distance), "r"(row_below - distance),
+        "r"(distance), "r"(destination), "r"(keep_mask)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+        "%xmm5", "%xmm6", "%xmm7", "%xmm8", "%xmm9", "memory"
+    );
+
+#else
+
+    // 16 bytes at a time.
+    __asm__ __volatile__ (
+        "movdqu (%0), %%xmm0\n\t"
+        "movdqu (%0,%3), %%xmm1\n\t"
+        "movdqu (%0,%3,2), %%xmm2\n\t"
+        "movdqu (%1), %%xmm3\n\t"
+        "movdqu (%1,%3), %%xmm4\n\t"
+        "movdqu (%1,%3,2), %%xmm5\n\t"
+        "movdqu (%2), %%xmm6\n\t"
+        "movdqu (%2,%3), %%xmm7\n\t"
+        "movdqu (%2,%3,2), %%xmm8\n\t"
+
+        FILTERS_MEDIAN_OF_9_NETWORK(FILTERS_SSE41_SORT_BYTES)
+
+        "movdqu (%5), %%xmm0\n\t"
+        "movdqu (%1,%3), %%xmm1\n\t"
+        "pand %%xmm0, %%xmm1\n\t"
+        "pandn %%xmm4, %%xmm0\n\t"
+        "por %%xmm1, %%xmm0\n\t"
+        "movdqu %%xmm0, (%4)\n\t"
+    ::
+        "r"(row_above - distance), "r"(row - distance), "r"(row_below - distance),
+        "r"(distance), "r"(destination), "r"(keep_mask)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4",
+        "%xmm5", "%xmm6", "%xmm7", "%xmm8", "%xmm9", "memory"
+    );
+
+#endif
+}
+
+#endif
+
+#endif
+
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+
+// Maps 32 (AVX2 and AVX-512) or 16 (SSE4.1) bytes through a table of 256
+// entries aligned to 16 bytes, one shuffle per row of 16 entries. Bytes set
+// in `keep_mask` stay as they are.
+static inline void _filters_lookup_vector(
+                       uint8_t *channels,
+                       const uint8_t *keep_mask,
+                       const uint8_t *table
+                   )
+{
+#if defined x86_32_CPU || defined x86_64_CPU
+
+#if defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+#define FILTERS_LOOKUP_ROW(ROW)                   \
+    "movdqa %%xmm1, %%xmm5\n\t"                   \
+    "paddusb %%xmm4, %%xmm5\n\t"                  \
+    "movdqa " #ROW "(%2), %%xmm6\n\t"             \
+    "pshufb %%xmm5, %%xmm6\n\t"                   \
+    "por %%xmm6, %%xmm2\n\t"                      \
+    "psubb %%xmm3, %%xmm1\n\t"
+
+    __asm__ __volatile__ (
+        "movdqu (%0), %%xmm0\n\t"
+        "movdqa %%xmm0, %%xmm1\n\t"
+        "pxor %%xmm2, %%xmm2\n\t"
+        "movdqa (%3), %%xmm3\n\t"
+        "movdqa (%4), %%xmm4\n\t"
+        FILTERS_LOOKUP_ROW(0x00) FILTERS_LOOKUP_ROW(0x10)
+        FILTERS_LOOKUP_ROW(0x20) FILTERS_LOOKUP_ROW(0x30)
+        FILTERS_LOOKUP_ROW(0x40) FILTERS_LOOKUP_ROW(0x50)
+        FILTERS_LOOKUP_ROW(0x60) FILTERS_LOOKUP_ROW(0x70)
+        FILTERS_LOOKUP_ROW(0x80) FILTERS_LOOKUP_ROW(0x90)
+        FILTERS_LOOKUP_ROW(0xa0) FILTERS_LOOKUP_ROW(0xb0)
+        FILTERS_LOOKUP_ROW(0xc0) FILTERS_LOOKUP_ROW(0xd0)
+        FILTERS_LOOKUP_ROW(0xe0) FILTERS_LOOKUP_ROW(0xf0)
+
+        "movdqu (%1), %%xmm1\n\t"
+        "pand %%xmm1, %%xmm0\n\t"
+        "pandn %%xmm2, %%xmm1\n\t"
+        "por %%xmm0, %%xmm1\n\t"
+        "movdqu %%xmm1, (%0)\n\t"
+    ::
+        "r"(channels), "r"(keep_mask), "r"(table),
+        "r"(Filters_Lookup_Row_Step), "r"(Filters_Lookup_Row_Bias)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "memory"
+    );
+
+#undef FILTERS_LOOKUP_ROW
+
+#else
+
+#define FILTERS_LOOKUP_ROW(ROW)                           \
+    "vpaddusb %%ymm4, %%ymm1, %%ymm5\n\t"                 \
+    "vbroadcasti128 " #ROW "(%2), %%ymm6\n\t"             \
+    "vpshufb %%ymm5, %%ymm6, %%ymm5\n\t"                  \
+    "vpor %%ymm5, %%ymm2, %%ymm2\n\t"                     \
+    "vpsubb %%ymm3, %%ymm1, %%ymm1\n\t"
+
+    __asm__ __volatile__ (
+        "vmovdqu (%0), %%ymm0\n\t"
+        "vmovdqa %%ymm0, %%ymm1\n\t"
+        "vpxor %%ymm2, %%ymm2, %%ymm2\n\t"
+        "vmovdqa (%3), %%ymm3\n\t"
+        "vmovdqa (%4), %%ymm4\n\t"
+        FILTERS_LOOKUP_ROW(0x00) FILTERS_LOOKUP_ROW(0x10)
+        FILTERS_LOOKUP_ROW(0x20) FILTERS_LOOKUP_ROW(0x30)
+        FILTERS_LOOKUP_ROW(0x40) FILTERS_LOOKUP_ROW(0x50)
+        FILTERS_LOOKUP_ROW(0x60) FILTERS_LOOKUP_ROW(0x70)
+        FILTERS_LOOKUP_ROW(0x80) FILTERS_LOOKUP_ROW(0x90)
+        FILTERS_LOOKUP_ROW(0xa0) FILTERS_LOOKUP_ROW(0xb0)
+        FILTERS_LOOKUP_ROW(0xc0) FILTERS_LOOKUP_ROW(0xd0)
+        FILTERS_LOOKUP_ROW(0xe0) FILTERS_LOOKUP_ROW(0xf0)
+
+        "vmovdqu (%1), %%ymm1\n\t"
+        "vpblendvb %%ymm1, %%ymm0, %%ymm2, %%ymm2\n\t"
+        "vmovdqu %%ymm2, (%0)\n\t"
+    ::
+        "r"(channels), "r"(keep_mask), "r"(table),
+        "r"(Filters_Lookup_Row_Step), "r"(Filters_Lookup_Row_Bias)
+    :
+        "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "memory"
+    );
+
+#undef FILTERS_LOOKUP_ROW
+
+#endif
+
+#else
+#error "Unsupported processor architecture"
+#endif
+}
+
+#endif
+
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+// Maps `count` bytes through a table of 256 entries, 64 at a time with two
+// 128-entry permutes picked by the top bit of every byte. The stores are
+// masked, so the bytes set in `keep` (repeated every 64 bytes) and the
+// bytes past `count` are not touched.
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void _filters_lookup_vbmi(
+                uint8_t *channels,
+                size_t count,
+                uint64_t keep,
+                const uint8_t *table
+            )
+{
+    for (size_t i = 0; i < count; i += 64) {
+        uint64_t store_mask =
+            (count - i >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << (count - i)) - 1) & ~keep;
+
+        __asm__ __volatile__ (
+            "kmovq %1, %%k1\n\t"
+            "vmovdqu8 (%0), %%zmm4%{%%k1%}%{z%}\n\t"
+            "vmovdqu64 (%2), %%zmm0\n\t"
+            "vmovdqu64 0x40(%2), %%zmm1\n\t"
+            "vmovdqu64 0x80(%2), %%zmm2\n\t"
+            "vmovdqu64 0xc0(%2), %%zmm3\n\t"
+            "vpmovb2m %%zmm4, %%k2\n\t"
+            "vmovdqa64 %%zmm4, %%zmm5\n\t"
+            "vpermi2b %%zmm1, %%zmm0, %%zmm4\n\t"
+            "vpermi2b %%zmm3, %%zmm2, %%zmm5\n\t"
+            "vmovdqu8 %%zmm5, %%zmm4%{%%k2%}\n\t"
+            "vmovdqu8 %%zmm4, (%0)%{%%k1%}\n\t"
+        ::
+            "r"(channels + i), "r"(store_mask), "r"(table)
+        :
+            "%zmm0", "%zmm1", "%zmm2", "%zmm3", "%zmm4", "%zmm5", "%k1", "%k2",
+            "memory"
+        );
+    }
+}
+
+// Filters up to 16 packed 24 bpp pixels. They are split into planes and
+// merged back by byte permutes within one register and filtered like the
+// planar kernel does. Loads and stores are masked to the pixels, no byte
+// past them is read or written.
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void _filters_sepia_bgr_vbmi(
+                uint8_t *pixels,
+                size_t pixel_count
+            )
+{
+    uint64_t byte_mask =
+        ((uint64_t) 1 << (pixel_count * 3)) - 1;
+
+    __asm__ __volatile__ (
+        "kmovq %1, %%k1\n\t"
+        "vmovdqu8 (%0), %%zmm0%{%%k1%}%{z%}\n\t"
+        "vmovdqu64 (%3), %%zmm7\n\t"
+        "vpermb %%zmm0, %%zmm7, %%zmm0\n\t"
+        "vpmovzxbd %%xmm0, %%zmm1\n\t"
+        "vextracti32x4 $0x1, %%zmm0, %%xmm2\n\t"
+        "vpmovzxbd %%xmm2, %%zmm2\n\t"
+        "vextracti32x4 $0x2, %%zmm0, %%xmm3\n\t"
+        "vpmovzxbd %%xmm3, %%zmm3\n\t"
+        "vcvtdq2ps %%zmm1, %%zmm1\n\t"
+        "vcvtdq2ps %%zmm2, %%zmm2\n\t"
+        "vcvtdq2ps %%zmm3, %%zmm3\n\t"
+
+        "vmulps (%2)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x4(%2)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x8(%2)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm0\n\t"
+
+        "vmulps 0xc(%2)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x10(%2)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x14(%2)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm6\n\t"
+
+        "vmulps 0x18(%2)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x1c(%2)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x20(%2)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm7\n\t"
+
+        "vpmovusdb %%zmm0, %%xmm0\n\t"
+        "vpmovusdb %%zmm6, %%xmm6\n\t"
+        "vpmovusdb %%zmm7, %%xmm7\n\t"
+        "vinserti32x4 $0x1, %%xmm6, %%zmm0, %%zmm0\n\t"
+        "vinserti32x4 $0x2, %%xmm7, %%zmm0, %%zmm0\n\t"
+        "vmovdqu64 (%4), %%zmm7\n\t"
+        "vpermb %%zmm0, %%zmm7, %%zmm0\n\t"
+        "vmovdqu8 %%zmm0, (%0)%{%%k1%}\n\t"
+    ::
+        "r"(pixels), "r"(byte_mask), "r"(Filters_Sepia_Coefficients),
+        "r"(Filters_Deinterleave_Permutes), "r"(Filters_Interleave_Permutes)
+    :
+        "%zmm0", "%zmm1", "%zmm2", "%zmm3",
+        "%zmm4", "%zmm5", "%zmm6", "%zmm7", "%k1", "memory"
+    );
+}
+
+// Adjusts the brightness and contrast of `count` channels in fixed point,
+// 64 at a time as 16-bit words. Channels shifted up by 7 bits are scaled by
+// the contrast in 8 + `f` fraction bits with a rounding high multiply, which
+// leaves them in `f` fraction bits. The brightness is added with signed
+// saturation, the fraction is shifted out, which truncates like the C code,
+// and the words are clamped to bytes. `f` is the largest number of bits the
+// contrast fits 16 bits with. The rounded factors can put a channel one off
+// the float kernels, callers check a table of all channel values against
+// them before taking this. The stores are masked, so the bytes set in `keep` (repeated
+// every 64 bytes) and the bytes past `count` are not touched. Returns false
+// when the contrast does not fit 16 bits at all.
+FILTERS_KERNEL_SET_TARGET
+static inline bool _filters_brightness_contrast_fixed_point(
+                       uint8_t *channels,
+                       size_t count,
+                       uint64_t keep,
+                       float brightness,
+                       float contrast
+                   )
+{
+    float contrast_magnitude =
+        contrast < 0.0f ? -contrast : contrast;
+
+    int fraction_bits =
+        7;
+    while (fraction_bits >= 0 && contrast_magnitude * (float) (1 << (8 + fraction_bits)) >= 32767.0f) {
+        --fraction_bits;
+    }
+
+    if (fraction_bits < 0) {
+        return false;
+    }
+
+    float scaled_contrast =
+        contrast * (float) (1 << (8 + fraction_bits));
+    float scaled_brightness =
+        UTILS_CLAMP(brightness * (float) (1 << fraction_bits), -32768.0f, 32767.0f);
+    int32_t fixed_contrast =
+        (int32_t) (scaled_contrast + (scaled_contrast < 0.0f ? -0.5f : 0.5f));
+    int32_t fixed_brightness =
+        (int32_t) (scaled_brightness + (scaled_brightness < 0.0f ? -0.5f : 0.5f));
+
+    for (size_t i = 0; i < count; i += 64) {
+        uint64_t store_mask =
+            (count - i >= 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << (count - i)) - 1) & ~keep;
+
+        __asm__ __volatile__ (
+            "kmovq %1, %%k1\n\t"
+            "vmovdqu8 (%0), %%zmm0%{%%k1%}%{z%}\n\t"
+            "vpbroadcastw %k2, %%zmm3\n\t"
+            "vpbroadcastw %k3, %%zmm4\n\t"
+            "vmovd %k4, %%xmm5\n\t"
+            "vpxord %%zmm6, %%zmm6, %%zmm6\n\t"
+
+            "vpmovzxbw %%ymm0, %%zmm1\n\t"
+            "vextracti64x4 $0x1, %%zmm0, %%ymm2\n\t"
+            "vpmovzxbw %%ymm2, %%zmm2\n\t"
+            "vpsllw $0x7, %%zmm1, %%zmm1\n\t"
+            "vpsllw $0x7, %%zmm2, %%zmm2\n\t"
+            "vpmulhrsw %%zmm3, %%zmm1, %%zmm1\n\t"
+            "vpmulhrsw %%zmm3, %%zmm2, %%zmm2\n\t"
+            "vpaddsw %%zmm4, %%zmm1, %%zmm1\n\t"
+            "vpaddsw %%zmm4, %%zmm2, %%zmm2\n\t"
+            "vpsraw %%xmm5, %%zmm1, %%zmm1\n\t"
+            "vpsraw %%xmm5, %%zmm2, %%zmm2\n\t"
+            "vpmaxsw %%zmm6, %%zmm1, %%zmm1\n\t"
+            "vpmaxsw %%zmm6, %%zmm2, %%zmm2\n\t"
+            "vpmovuswb %%zmm1, %%ymm1\n\t"
+            "vpmovuswb %%zmm2, %%ymm2\n\t"
+            "vinserti64x4 $0x1, %%ymm2, %%zmm1, %%zmm1\n\t"
+            "vmovdqu8 %%zmm1, (%0)%{%%k1%}\n\t"
+        ::
+            "r"(channels + i), "r"(store_mask),
+            "r"(fixed_contrast), "r"(fixed_brightness), "r"((int32_t) fraction_bits)
+        :
+            "%zmm0", "%zmm1", "%zmm2", "%zmm3", "%zmm4", "%zmm5", "%zmm6", "%k1",
+            "memory"
+        );
+    }
+
+    return true;
+}
+
+#endif
+
+static inline void filters_apply_brightness_contrast(
+                       uint8_t *pixels,
+                       size_t position,
+                       float brightness,
+                       float contrast
+                   )
+{
+#if defined FILTERS_C_IMPLEMENTATION
+
+    pixels[position] =
+        (uint8_t) UTILS_CLAMP(pixels[position]     * contrast + brightness, 0.0f, 255.0f);
+    pixels[position + 1] =
+        (uint8_t) UTILS_CLAMP(pixels[position + 1] * contrast + brightness, 0.0f, 255.0f);
+    pixels[position + 2] =
+        (uint8_t) UTILS_CLAMP(pixels[position + 2] * contrast + brightness, 0.0f, 255.0f);
+
+#elif defined FILTERS_X87_ASM_IMPLEMENTATION
+
+#if defined x86_32_CPU
+
+    // Similar, but not a one to one conversion of the C code above. Try to find in what way.
+    __asm__ __volatile__ (
+        "subl $0x1c, %%esp\n\t"
+
+        "xorl %%eax, %%eax\n\t"
+
+        "movb (%2,%3), %%al\n\t"
+        "movl %%eax, (%%esp)\n\t"
+
+        "movb 0x1(%2,%3), %%al\n\t"
+        "movl %%eax, 0x4(%%esp)\n\t"
+
+        "movb 0x2(%2,%3), %%al\n\t"
+        "movl %%eax, 0x8(%%esp)\n\t"
+
+        "fildl (%%esp)\n\t"
+        "fildl 0x4(%%esp)\n\t"
+        "fildl 0x8(%%esp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpl 0x8(%%esp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpl 0x4(%%esp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpl (%%esp)\n\t"
+
+        "movl $0xff, %%edx\n\t"
+        "movl $0x0, %%edi\n\t"
+
+        "movl (%%esp), %%eax\n\t"
+        "cmpl %%edx, %%eax\n\t"
+        "cmovgl %%edx, %%eax\n\t"
+        "cmpl %%edi, %%eax\n\t"
+        "cmovll %%edi, %%eax\n\t"
+        "movb %%al, (%2,%3)\n\t"
+
+        "movl 0x4(%%esp), %%eax\n\t"
+        "cmpl %%edx, %%eax\n\t"
+        "cmovgl %%edx, %%eax\n\t"
+        "cmpl %%edi, %%eax\n\t"
+        "cmovll %%edi, %%eax\n\t"
+        "movb %%al, 0x1(%2,%3)\n\t"
+
+        "movl 0x8(%%esp), %%eax\n\t"
+        "cmpl %%edx, %%eax\n\t"
+        "cmovgl %%edx, %%eax\n\t"
+        "cmpl %%edi, %%eax\n\t"
+        "cmovll %%edi, %%eax\n\t"
+        "movb %%al, 0x2(%2,%3)\n\t"
+
+        "addl $0x1c, %%esp\n\t"
+    ::
+        "S"(&brightness), "D"(&contrast),
+        "b"(pixels), "c"(position)
+    :
+        "%eax", "%edx", "memory"
+    );
+
+#elif defined x86_64_CPU
+
+    // Similar, but not a one to one conversion of the C code above. Try to find in what way.
+    __asm__ __volatile__ (
+        // Skips the red zone, the compiler may keep its locals there.
+        "subq $0xb8, %%rsp\n\t"
+
+        "xorq %%rax, %%rax\n\t"
+
+        "movb (%2,%3), %%al\n\t"
+        "movq %%rax, (%%rsp)\n\t"
+
+        "movb 0x1(%2,%3), %%al\n\t"
+        "movq %%rax, 0x8(%%rsp)\n\t"
+
+        "movb 0x2(%2,%3), %%al\n\t"
+        "movq %%rax, 0x10(%%rsp)\n\t"
+
+        "fildl (%%rsp)\n\t"
+        "fildl 0x8(%%rsp)\n\t"
+        "fildl 0x10(%%rsp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpq 0x10(%%rsp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpq 0x8(%%rsp)\n\t"
+
+        "flds (%1)\n\t"
+        "fmulp\n\t"
+        "flds (%0)\n\t"
+        "faddp\n\t"
+        "fistpq (%%rsp)\n\t"
+
+        "movq $0xff, %%rdx\n\t"
+        "movq $0x0, %%r8\n\t"
+
+        "movq (%%rsp), %%rax\n\t"
+        "cmpq %%rdx, %%rax\n\t"
+        "cmovgq %%rdx, %%rax\n\t"
+        "cmpq %%r8, %%rax\n\t"
+        "cmovlq %%r8, %%rax\n\t"
+        "movb %%al, (%2,%3)\n\t"
+
+        "movq 0x8(%%rsp), %%rax\n\t"
+        "cmpq %%rdx, %%rax\n\t"
+        "cmovgq %%rdx, %%rax\n\t"
+        "cmpq %%r8, %%rax\n\t"
+        "cmovlq %%r8, %%rax\n\t"
+        "movb %%al, 0x1(%2,%3)\n\t"
+
+        "movq 0x10(%%rsp), %%rax\n\t"
+        "cmpq %%rdx, %%rax\n\t"
+        "cmovgq %%rdx, %%rax\n\t"
+        "cmpq %%r8, %%rax\n\t"
+        "cmovlq %%r8, %%rax\n\t"
+        "movb %%al, 0x2(%2,%3)\n\t"
+
+        "addq $0xb8, %%rsp\n\t"
+    ::
+        "S"(&brightness), "D"(&contrast),
+        "b"(pixels), "c"(position)
+    :
+        "%rax", "%rdx", "%r8", "memory"
+    );
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+    // Process 16 color channels at the same time.
+    _filters_brightness_contrast_vector(pixels + position, Filters_Keep_No_Mask, brightness, contrast);
+
+#elif defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+#if defined x86_32_CPU
+
+    // Process 16 color channels at the same time.
+    __asm__ __volatile__ (
+        "vbroadcastss (%0), %%zmm2\n\t"
+        "vbroadcastss (%1), %%zmm1\n\t"
+        "vpmovzxbd (%2, %3), %%zmm0\n\t"
+        "vcvtdq2ps %%zmm0, %%zmm0\n\t"
+        "vmulps %%zmm1, %%zmm0, %%zmm0\n\t"
+        "vaddps %%zmm2, %%zmm0, %%zmm0\n\t"
+        "vcvttps2dq %%zmm0, %%zmm0\n\t"
+	
+	"movl $0xff, %%edx\n\t"
+    	"movl $0x0, %%eax\n\t"
+        "vpbroadcastd %%edx, %%zmm2\n\t"
+        "vpbroadcastd %%eax, %%zmm1\n\t"
+        
+    	"vpcmpgtd %%zmm2, %%zmm0, %%k1\n\t"
+    	"vmovdqa32 %%zmm2, %%zmm0%{%%k1%}\n\t"
+    	"vpcmpgtd %%zmm0, %%zmm1, %%k1\n\t"
+    	"vmovdqa32 %%zmm1, %%zmm0%{%%k1%}\n\t"
+        
+
+    	"vpmovusdb %%zmm0, (%2, %3)\n\t"
+    ::
+        "S"(&brightness), "D"(&contrast), "b"(pixels), "c"(position)
+    :
+        "%eax", "%edx", "%zmm0", "%zmm1", "%zmm2", "%k1", "memory"
+    );
+
+#elif defined x86_64_CPU
+
+    // Process 16 color channels at the same time.
+    __asm__ __volatile__ (
+       "vbroadcastss (%0), %%zmm2\n\t"
+        "vbroadcastss (%1), %%zmm1\n\t"
+        "vpmovzxbd (%2, %3), %%zmm0\n\t"
+        "vcvtdq2ps %%zmm0, %%zmm0\n\t"
+        "vmulps %%zmm1, %%zmm0, %%zmm0\n\t"
+        "vaddps %%zmm2, %%zmm0, %%zmm0\n\t"
+        "vcvttps2dq %%zmm0, %%zmm0\n\t"
+
+	"movl $0xff, %%edx\n\t"
+	"movl $0x0, %%eax\n\t"
+        "vpbroadcastd %%edx, %%zmm2\n\t"
+        "vpbroadcastd %%eax, %%zmm1\n\t"
+
+	"vpcmpgtd %%zmm2, %%zmm0, %%k1\n\t"
+    	"vmovdqa32 %%zmm2, %%zmm0%{%%k1%}\n\t"
+    	"vpcmpgtd %%zmm0, %%zmm1, %%k1\n\t"
+    	"vmovdqa32 %%zmm1, %%zmm0%{%%k1%}\n\t"
+        
+	"vpmovusdb %%zmm0, (%2, %3)\n\t"
+    ::
+        "S"(&brightness), "D"(&contrast), "b"(pixels), "c"(position)
+    :
+        "%eax", "%edx", "%zmm0", "%zmm1", "%zmm2", "%k1", "memory"
+    );
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#endif
+}
+
+static inline void filters_apply_sepia(
+                       uint8_t *pixels,
+                       size_t position
+                   )
+{
+    // Only the scalar kernel sets filter single pixels, with the C code.
+    uint32_t blue =
+        pixels[position];
+    uint32_t green =
+        pixels[position + 1];
+    uint32_t red = pixels[position + 2];
+
+    pixels[position] =
+        (uint8_t) UTILS_MIN(
+                      Filters_Sepia_Coefficients[0] * red  +
+                      Filters_Sepia_Coefficients[1] * green +
+                      Filters_Sepia_Coefficients[2] * blue,
+                      255.0f
+                  );
+    pixels[position + 1] =
+        (uint8_t) UTILS_MIN(
+                      Filters_Sepia_Coefficients[3] * red  +
+                      Filters_Sepia_Coefficients[4] * green +
+                      Filters_Sepia_Coefficients[5] * blue,
+                      255.0f
+                  );
+    pixels[position + 2] =
+        (uint8_t) UTILS_MIN(
+                      Filters_Sepia_Coefficients[6] * red  +
+                      Filters_Sepia_Coefficients[7] * green +
+                      Filters_Sepia_Coefficients[8] * blue,
+                      255.0f
+                  );
+}
+
+static int _filters_compare_color_channels(const void *a, const void *b)
+{
+    return *((const uint8_t *) a) - *((const uint8_t *) b);
+}
+
+static inline void filters_apply_median(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride
+                   )
+{
+    const size_t window_width =
+        2 * FILTERS_MEDIAN_DEFAULT_RADIUS + 1;
+    const size_t window_height =
+        window_width;
+    const size_t window_center_shift_x =
+        window_width / 2;
+    const size_t window_center_shift_y =
+        window_height / 2;
+    const size_t window_size =
+        window_width * window_height;
+    const size_t window_center =
+        window_size / 2;
+
+    // Planes are filtered one channel at a time with `bytes_per_pixel` set to 1.
+    const size_t channels =
+        UTILS_MIN(bytes_per_pixel, 3);
+
+    uint8_t window[window_size];
+    for (size_t channel = 0; channel < channels; ++channel) {
+        for (size_t wy = 0; wy < window_height; ++wy) {
+            for (size_t wx = 0; wx < window_width; ++wx) {
+                ssize_t adjusted_x =
+                    (ssize_t) x - (ssize_t) window_center_shift_x + (ssize_t) wx;
+                ssize_t adjusted_y =
+                    (ssize_t) y - (ssize_t) window_center_shift_y + (ssize_t) wy;
+
+                window[wy * window_width + wx] =
+                    bmp_sample_pixel(
+                        source_pixels,
+                        adjusted_x,
+                        adjusted_y,
+                        width,
+                        height,
+                        bytes_per_pixel,
+                        row_stride
+                    )[channel];
+            }
+        }
+
+        qsort(window, window_size, sizeof(*window), _filters_compare_color_channels);
+
+        uint8_t median =
+            window_size % 2 == 0 ?
+                (uint8_t) ((window[window_center - 1] + window[window_center]) * 0.5f) :
+                window[window_center];
+        destination_pixels[position + channel] =
+            median;
+    }
+
+    // The X/alpha byte of 32 bpp pixels is carried over unfiltered.
+    if (bytes_per_pixel == 4) {
+        destination_pixels[position + 3] =
+            source_pixels[position + 3];
+    }
+}
+
+// Filters `count` pixels of a row from `x` on with windows `radius` pixels
+// around them. The windows of FILTERS_MEDIAN_NETWORK_LANES channels are
+// gathered side by side and sorted together by an odd-even merge sort
+// network. Its exchanges take minimums and maximums of whole rows of
+// channels, the compiler turns them into vector instructions of the set.
+static inline void filters_apply_median_network(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   )
+{
+    const size_t window_width =
+        2 * radius + 1;
+    const size_t window_size =
+        window_width * window_width;
+    const size_t pixels_per_run =
+        FILTERS_MEDIAN_NETWORK_LANES / bytes_per_pixel;
+
+    // Rows past the top and bottom edges repeat the edge rows.
+    const uint8_t *rows[2 * FILTERS_MEDIAN_NETWORK_RADIUS + 1];
+    for (size_t wy = 0; wy < window_width; ++wy) {
+        ssize_t row_y =
+            UTILS_CLAMP((ssize_t) (y + wy) - (ssize_t) radius, 0, (ssize_t) height - 1);
+        rows[wy] =
+            source_pixels + (size_t) row_y * row_stride;
+    }
+
+    uint8_t window[(2 * FILTERS_MEDIAN_NETWORK_RADIUS + 1) * (2 * FILTERS_MEDIAN_NETWORK_RADIUS + 1)]
+                  [FILTERS_MEDIAN_NETWORK_LANES]
+        __attribute__((aligned(64)));
+    memset(window, 0, sizeof(window));
+
+    uint8_t *row =
+        destination_pixels + position - x * bytes_per_pixel;
+    for (size_t run_x = x; run_x < x + count; run_x += pixels_per_run) {
+        size_t run_pixels =
+            UTILS_MIN(pixels_per_run, x + count - run_x);
+        size_t run_channels =
+            run_pixels * bytes_per_pixel;
+
+        // Columns past the left and right edges repeat the edge columns.
+        bool inner =
+            run_x >= radius && run_x + run_pixels + radius <= width;
+        for (size_t wy = 0; wy < window_width; ++wy) {
+            for (size_t wx = 0; wx < window_width; ++wx) {
+                uint8_t *lanes =
+                    window[wy * window_width + wx];
+
+                if (inner) {
+                    memcpy(lanes, rows[wy] + (run_x + wx - radius) * bytes_per_pixel, run_channels);
+
+                    continue;
+                }
+
+                for (size_t lane = 0; lane < run_channels; ++lane) {
+                    ssize_t column =
+                        UTILS_CLAMP(
+                            (ssize_t) (run_x + lane / bytes_per_pixel + wx) - (ssize_t) radius,
+                            0, (ssize_t) width - 1
+                        );
+                    lanes[lane] =
+                        rows[wy][(size_t) column * bytes_per_pixel + lane % bytes_per_pixel];
+                }
+            }
+        }
+
+        for (size_t p = 1; p < window_size; p <<= 1) {
+            for (size_t k = p; k >= 1; k >>= 1) {
+                for (size_t j = k % p; j + k < window_size; j += 2 * k) {
+                    for (size_t i = 0; i < k && i + j + k < window_size; ++i) {
+                        if ((i + j) / (2 * p) != (i + j + k) / (2 * p)) {
+                            continue;
+                        }
+
+                        uint8_t *low =
+                            window[i + j];
+                        uint8_t *high =
+                            window[i + j + k];
+                        for (size_t lane = 0; lane < FILTERS_MEDIAN_NETWORK_LANES; ++lane) {
+                            uint8_t a =
+                                low[lane];
+                            uint8_t b =
+                                high[lane];
+                            low[lane] =
+                                UTILS_MIN(a, b);
+                            high[lane] =
+                                UTILS_MAX(a, b);
+                        }
+                    }
+                }
+            }
+        }
+
+        uint8_t *medians =
+            window[window_size / 2];
+        uint8_t *destination =
+            row + run_x * bytes_per_pixel;
+        const uint8_t *source =
+            rows[radius] + run_x * bytes_per_pixel;
+        for (size_t lane = 0; lane < run_channels; ++lane) {
+            destination[lane] =
+                4 == bytes_per_pixel && 3 == lane % 4 ? source[lane] : medians[lane];
+        }
+    }
+}
+
+// Filters `count` pixels of a row from `x` on with windows `radius` pixels
+// around them, sliding one histogram per channel along the row. Every step
+// takes the column leaving the window out of it, adds the one entering it
+// and moves the median from where it was by the counts in between.
+static inline void filters_apply_median_sliding(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   )
+{
+    const size_t window_width =
+        2 * radius + 1;
+    const size_t window_center =
+        window_width * window_width / 2;
+    const size_t channels =
+        UTILS_MIN(bytes_per_pixel, 3);
+
+    const uint8_t *rows[window_width];
+    for (size_t wy = 0; wy < window_width; ++wy) {
+        ssize_t row_y =
+            UTILS_CLAMP((ssize_t) (y + wy) - (ssize_t) radius, 0, (ssize_t) height - 1);
+        rows[wy] =
+            source_pixels + (size_t) row_y * row_stride;
+    }
+
+    // `below` counts the window values smaller than `median`.
+    uint16_t histograms[3][256];
+    size_t median[3], below[3];
+    memset(histograms, 0, sizeof(histograms));
+    for (size_t wx = 0; wx < window_width; ++wx) {
+        size_t column =
+            (size_t) UTILS_CLAMP((ssize_t) (x + wx) - (ssize_t) radius, 0, (ssize_t) width - 1) *
+            bytes_per_pixel;
+        for (size_t wy = 0; wy < window_width; ++wy) {
+            for (size_t channel = 0; channel < channels; ++channel) {
+                ++histograms[channel][rows[wy][column + channel]];
+            }
+        }
+    }
+    for (size_t channel = 0; channel < channels; ++channel) {
+        median[channel] =
+            0;
+        below[channel] =
+            0;
+        while (below[channel] + histograms[channel][median[channel]] <= window_center) {
+            below[channel] += histograms[channel][median[channel]++];
+        }
+    }
+
+    uint8_t *destination =
+        destination_pixels + position;
+    for (size_t pixel_x = x;;) {
+        for (size_t channel = 0; channel < channels; ++channel) {
+            destination[channel] =
+                (uint8_t) median[channel];
+        }
+        if (4 == bytes_per_pixel) {
+            destination[3] =
+                rows[radius][pixel_x * bytes_per_pixel + 3];
+        }
+        destination += bytes_per_pixel;
+
+        if (++pixel_x == x + count) {
+            break;
+        }
+
+        size_t leaving_column =
+            (size_t) UTILS_CLAMP((ssize_t) pixel_x - 1 - (ssize_t) radius, 0, (ssize_t) width - 1) *
+            bytes_per_pixel;
+        size_t entering_column =
+            UTILS_MIN(pixel_x + radius, width - 1) * bytes_per_pixel;
+        for (size_t channel = 0; channel < channels; ++channel) {
+            uint16_t *histogram =
+                histograms[channel];
+            size_t channel_median =
+                median[channel];
+            size_t channel_below =
+                below[channel];
+
+            for (size_t wy = 0; wy < window_width; ++wy) {
+                uint8_t leaving =
+                    rows[wy][leaving_column + channel];
+                uint8_t entering =
+                    rows[wy][entering_column + channel];
+                --histogram[leaving];
+                ++histogram[entering];
+                channel_below -= leaving < channel_median;
+                channel_below += entering < channel_median;
+            }
+
+            while (channel_below > window_center) {
+                channel_below -= histogram[--channel_median];
+            }
+            while (channel_below + histogram[channel_median] <= window_center) {
+                channel_below += histogram[channel_median++];
+            }
+
+            median[channel] =
+                channel_median;
+            below[channel] =
+                channel_below;
+        }
+    }
+}
+
+// Adds the `count` bins of `entering` to `histogram` and takes those of
+// `leaving` out of it. Counts are multiples of 16.
+FILTERS_KERNEL_SET_TARGET
+static inline void _filters_slide_histogram(
+                       uint16_t *histogram,
+                       const uint16_t *entering,
+                       const uint16_t *leaving,
+                       size_t count
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+    size_t i =
+        0;
+    for (; i + 32 <= count; i += 32) {
+        __asm__ __volatile__ (
+            "vmovdqu16 (%1), %%zmm0\n\t"
+            "vpsubw (%2), %%zmm0, %%zmm0\n\t"
+            "vpaddw (%0), %%zmm0, %%zmm0\n\t"
+            "vmovdqu16 %%zmm0, (%0)\n\t"
+        ::
+            "r"(histogram + i), "r"(entering + i), "r"(leaving + i)
+        :
+            "%zmm0", "memory"
+        );
+    }
+    if (i < count) {
+        // The last bins are masked in a full register, narrower EVEX forms
+        // would need AVX512VL.
+        uint32_t bin_mask =
+            (uint32_t) ((UINT64_C(1) << (count - i)) - 1);
+
+        __asm__ __volatile__ (
+            "kmovd %3, %%k1\n\t"
+            "vmovdqu16 (%1), %%zmm0%{%%k1%}%{z%}\n\t"
+            "vmovdqu16 (%2), %%zmm1%{%%k1%}%{z%}\n\t"
+            "vpsubw %%zmm1, %%zmm0, %%zmm0\n\t"
+            "vmovdqu16 (%0), %%zmm1%{%%k1%}%{z%}\n\t"
+            "vpaddw %%zmm1, %%zmm0, %%zmm0\n\t"
+            "vmovdqu16 %%zmm0, (%0)%{%%k1%}\n\t"
+        ::
+            "r"(histogram + i), "r"(entering + i), "r"(leaving + i), "r"(bin_mask)
+        :
+            "%zmm0", "%zmm1", "%k1", "memory"
+        );
+    }
+
+#else
+
+    for (size_t i = 0; i < count; ++i) {
+        histogram[i] += (uint16_t) (entering[i] - leaving[i]);
+    }
+
+#endif
+}
+
+// Filters `row_count` whole rows from row `y` on with windows `radius`
+// pixels around their pixels (Perreault and Hebert). Every column keeps a
+// histogram of the window rows, updated by one pixel leaving and one
+// entering as a row is done. Sliding along a row adds the histogram of the
+// column entering the window and takes that of the leaving one out, which
+// costs the same for every radius. Columns are updated right before they
+// enter the window, while their histograms are in the cache. Returns false
+// when there is no memory for the histograms and nothing was filtered.
+static inline bool filters_apply_median_columns(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t y,
+                       size_t row_count,
+                       size_t width,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t radius
+                   )
+{
+    const size_t window_center =
+        (2 * radius + 1) * (2 * radius + 1) / 2;
+    const size_t channels =
+        UTILS_MIN(bytes_per_pixel, 3);
+    const size_t column_bins =
+        channels * FILTERS_MEDIAN_HISTOGRAM_BINS;
+    const size_t column_size =
+        column_bins * sizeof(uint16_t);
+
+    uint16_t *columns =
+        aligned_alloc(64, ((width * column_size - 1) / 64 + 1) * 64);
+    if (NULL == columns) {
+        return false;
+    }
+    memset(columns, 0, width * column_size);
+
+    uint16_t kernel[3 * FILTERS_MEDIAN_HISTOGRAM_BINS]
+        __attribute__((aligned(64)));
+
+    // Rows and columns past the edges repeat the edge ones.
+    for (ssize_t row_y = (ssize_t) y - (ssize_t) radius; row_y <= (ssize_t) (y + radius); ++row_y) {
+        const uint8_t *row =
+            source_pixels + (size_t) UTILS_CLAMP(row_y, 0, (ssize_t) height - 1) * row_stride;
+        for (size_t x = 0; x < width; ++x) {
+            for (size_t channel = 0; channel < channels; ++channel) {
+                _filters_count_in_histogram(
+                    columns + x * column_bins + channel * FILTERS_MEDIAN_HISTOGRAM_BINS,
+                    row[x * bytes_per_pixel + channel]
+                );
+            }
+        }
+    }
+
+    for (size_t row_y = y; row_y < y + row_count; ++row_y) {
+        const uint8_t *leaving_row =
+            source_pixels + (size_t) UTILS_MAX((ssize_t) row_y - 1 - (ssize_t) radius, 0) * row_stride;
+        const uint8_t *entering_row =
+            source_pixels + UTILS_MIN(row_y + radius, height - 1) * row_stride;
+        const uint8_t *row =
+            source_pixels + row_y * row_stride;
+        uint8_t *destination =
+            destination_pixels + row_y * row_stride;
+
+        // The first row of the band has its column histograms built whole,
+        // at the edges the same row can leave and enter.
+        bool update_columns =
+            row_y > y && leaving_row != entering_row;
+        for (size_t x = 0; update_columns && x < UTILS_MIN(radius + 1, width); ++x) {
+            for (size_t channel = 0; channel < channels; ++channel) {
+                uint16_t *histogram =
+                    columns + x * column_bins + channel * FILTERS_MEDIAN_HISTOGRAM_BINS;
+                _filters_remove_from_histogram(histogram, leaving_row[x * bytes_per_pixel + channel]);
+                _filters_count_in_histogram(histogram, entering_row[x * bytes_per_pixel + channel]);
+            }
+        }
+
+        memset(kernel, 0, column_size);
+        for (ssize_t wx = -(ssize_t) radius; wx <= (ssize_t) radius; ++wx) {
+            const uint16_t *column =
+                columns + (size_t) UTILS_CLAMP(wx, 0, (ssize_t) width - 1) * column_bins;
+            for (size_t i = 0; i < column_bins; ++i) {
+                kernel[i] += column[i];
+            }
+        }
+
+        for (size_t x = 0;;) {
+            for (size_t channel = 0; channel < channels; ++channel) {
+                destination[x * bytes_per_pixel + channel] =
+                    _filters_select_from_histogram(
+                        kernel + channel * FILTERS_MEDIAN_HISTOGRAM_BINS,
+                        window_center
+                    );
+            }
+            if (4 == bytes_per_pixel) {
+                destination[x * bytes_per_pixel + 3] =
+                    row[x * bytes_per_pixel + 3];
+            }
+
+            if (++x == width) {
+                break;
+            }
+
+            size_t entering_x =
+                UTILS_MIN(x + radius, width - 1);
+            size_t leaving_x =
+                (size_t) UTILS_MAX((ssize_t) x - 1 - (ssize_t) radius, 0);
+            if (update_columns && x + radius < width) {
+                for (size_t channel = 0; channel < channels; ++channel) {
+                    uint16_t *histogram =
+                        columns + entering_x * column_bins + channel * FILTERS_MEDIAN_HISTOGRAM_BINS;
+                    _filters_remove_from_histogram(histogram, leaving_row[entering_x * bytes_per_pixel + channel]);
+                    _filters_count_in_histogram(histogram, entering_row[entering_x * bytes_per_pixel + channel]);
+                }
+            }
+            if (entering_x != leaving_x) {
+                _filters_slide_histogram(
+                    kernel,
+                    columns + entering_x * column_bins,
+                    columns + leaving_x * column_bins,
+                    column_bins
+                );
+            }
+        }
+    }
+
+    free(columns);
+
+    return true;
+}
+
+// Kernels for 32 bpp BGRX/BGRA pixels. Every pixel occupies a full 32-bit
+// lane, so a vector register never straddles two pixels and the X/alpha
+// byte can be masked out instead of being shuffled around.
+
+#ifndef FILTERS_SIMD_SORT_BYTES
+
+#define FILTERS_SIMD_SORT_BYTES(a, b)                  \
+    "vpminub %%zmm" #a ", %%zmm" #b ", %%zmm9\n\t"      \
+    "vpmaxub %%zmm" #a ", %%zmm" #b ", %%zmm" #b "\n\t" \
+    "vmovdqa64 %%zmm9, %%zmm" #a "\n\t"
+
+// Median-of-9 exchange network over %zmm0-%zmm8 (19 exchanges), the median
+// ends up in %zmm4. %zmm9 is used as a scratch register.
+#define FILTERS_SIMD_MEDIAN_OF_9_NETWORK                                      \
+    FILTERS_SIMD_SORT_BYTES(1, 2) FILTERS_SIMD_SORT_BYTES(4, 5)               \
+    FILTERS_SIMD_SORT_BYTES(7, 8) FILTERS_SIMD_SORT_BYTES(0, 1)               \
+    FILTERS_SIMD_SORT_BYTES(3, 4) FILTERS_SIMD_SORT_BYTES(6, 7)               \
+    FILTERS_SIMD_SORT_BYTES(1, 2) FILTERS_SIMD_SORT_BYTES(4, 5)               \
+    FILTERS_SIMD_SORT_BYTES(7, 8) FILTERS_SIMD_SORT_BYTES(0, 3)               \
+    FILTERS_SIMD_SORT_BYTES(5, 8) FILTERS_SIMD_SORT_BYTES(4, 7)               \
+    FILTERS_SIMD_SORT_BYTES(3, 6) FILTERS_SIMD_SORT_BYTES(1, 4)               \
+    FILTERS_SIMD_SORT_BYTES(2, 5) FILTERS_SIMD_SORT_BYTES(4, 7)               \
+    FILTERS_SIMD_SORT_BYTES(4, 2) FILTERS_SIMD_SORT_BYTES(6, 4)               \
+    FILTERS_SIMD_SORT_BYTES(4, 2)
+
+#endif
+
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+// Filters the channels set in `channel_mask` out of the 64 at `destination`
+// with the median of the 3x3 windows around the channels of `row`, the
+// channels of a neighbouring pixel are `distance` bytes away. Channels set
+// in `keep` are copied from `row`. Loads and stores are masked, bytes out of
+// the windows of the channels are neither read nor written.
+FILTERS_KERNEL_SET_TARGET
+static inline void _filters_median_run(
+                       const uint8_t *row_above,
+                       const uint8_t *row,
+                       const uint8_t *row_below,
+                       size_t distance,
+                       uint8_t *destination,
+                       uint64_t channel_mask,
+                       uint64_t keep
+                   )
+{
+    __asm__ __volatile__ (
+        "kmovq %5, %%k1\n\t"
+        "kmovq %6, %%k2\n\t"
+        "vmovdqu8 (%0), %%zmm0%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%0, %3), %%zmm1%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%0, %3, 2), %%zmm2%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%1), %%zmm3%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%1, %3), %%zmm4%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%1, %3, 2), %%zmm5%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%2), %%zmm6%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%2, %3), %%zmm7%{%%k1%}%{z%}\n\t"
+        "vmovdqu8 (%2, %3, 2), %%zmm8%{%%k1%}%{z%}\n\t"
+        "vmovdqa64 %%zmm4, %%zmm10\n\t"
+
+        FILTERS_SIMD_MEDIAN_OF_9_NETWORK
+
+        "vmovdqu8 %%zmm10, %%zmm4%{%%k2%}\n\t"
+        "vmovdqu8 %%zmm4, (%4)%{%%k1%}\n\t"
+    ::
+        "r"(row_above - distance), "r"(row - distance), "r"(row_below - distance),
+        "r"(distance), "r"(destination), "r"(channel_mask), "r"(keep)
+    :
+        "%zmm0", "%zmm1", "%zmm2", "%zmm3", "%zmm4", "%zmm5",
+        "%zmm6", "%zmm7", "%zmm8", "%zmm9", "%zmm10", "%k1", "%k2", "memory"
+    );
+}
+
+#endif
+
+static inline void filters_apply_brightness_contrast_bgrx(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count,
+                       float brightness,
+                       float contrast
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+#if defined x86_32_CPU || defined x86_64_CPU
+
+    // Process up to 4 pixels (16 channels) at the same time, the
+    // X/alpha channels are masked out of the store. Bytes past the last
+    // pixel are not touched, so short color tables can be filtered in place.
+    uint32_t load_mask =
+        (1u << (pixel_count * 4)) - 1u;
+    uint32_t store_mask =
+        0x7777u & load_mask;
+
+    __asm__ __volatile__ (
+        "vbroadcastss (%0), %%zmm2\n\t"
+        "vbroadcastss (%1), %%zmm1\n\t"
+        "kmovw %5, %%k2\n\t"
+        "vpmovzxbd (%2, %3), %%zmm0%{%%k2%}%{z%}\n\t"
+        "vcvtdq2ps %%zmm0, %%zmm0\n\t"
+        "vmulps %%zmm1, %%zmm0, %%zmm0\n\t"
+        "vaddps %%zmm2, %%zmm0, %%zmm0\n\t"
+        "vcvttps2dq %%zmm0, %%zmm0\n\t"
+
+        "vpxord %%zmm1, %%zmm1, %%zmm1\n\t"
+        "vpmaxsd %%zmm1, %%zmm0, %%zmm0\n\t"
+
+        "kmovw %4, %%k1\n\t"
+        "vpmovusdb %%zmm0, (%2, %3)%{%%k1%}\n\t"
+    ::
+        "r"(&brightness), "r"(&contrast), "r"(pixels), "r"(position),
+        "r"(store_mask), "r"(load_mask)
+    :
+        "%zmm0", "%zmm1", "%zmm2", "%k1", "%k2", "memory"
+    );
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+    // Fewer than 4 pixels are filtered in a copy, the bytes past them are
+    // not touched.
+    if (4 == pixel_count) {
+        _filters_brightness_contrast_vector(pixels + position, Filters_Keep_Alpha_Mask, brightness, contrast);
+    } else {
+        uint8_t copy[16] = { 0 };
+
+        memcpy(copy, pixels + position, pixel_count * 4);
+        _filters_brightness_contrast_vector(copy, Filters_Keep_Alpha_Mask, brightness, contrast);
+        memcpy(pixels + position, copy, pixel_count * 4);
+    }
+
+#else
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        filters_apply_brightness_contrast(pixels, position + i * 4, brightness, contrast);
+    }
+
+#endif
+}
+
+static inline void filters_apply_sepia_bgrx(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+#if defined x86_32_CPU || defined x86_64_CPU
+
+    // Process up to 16 pixels at the same time. The channels are split
+    // into separate registers by shifting and masking the 32-bit lanes,
+    // and the products are summed in the same order as in the C code.
+    uint32_t pixel_mask =
+        (uint32_t) ((1ul << pixel_count) - 1ul);
+
+    __asm__ __volatile__ (
+        "kmovw %2, %%k1\n\t"
+        "vmovdqu32 (%0), %%zmm0%{%%k1%}%{z%}\n\t"
+
+        "movl $0xff, %%eax\n\t"
+        "vpbroadcastd %%eax, %%zmm6\n\t"
+
+        "vpandd %%zmm6, %%zmm0, %%zmm1\n\t"
+        "vpsrld $8, %%zmm0, %%zmm2\n\t"
+        "vpandd %%zmm6, %%zmm2, %%zmm2\n\t"
+        "vpsrld $16, %%zmm0, %%zmm3\n\t"
+        "vpandd %%zmm6, %%zmm3, %%zmm3\n\t"
+        "vcvtdq2ps %%zmm1, %%zmm1\n\t"
+        "vcvtdq2ps %%zmm2, %%zmm2\n\t"
+        "vcvtdq2ps %%zmm3, %%zmm3\n\t"
+
+        "vmulps (%1)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x4(%1)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x8(%1)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2dq %%zmm4, %%zmm4\n\t"
+        "vpminsd %%zmm6, %%zmm4, %%zmm7\n\t"
+
+        "vmulps 0xc(%1)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x10(%1)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x14(%1)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2dq %%zmm4, %%zmm4\n\t"
+        "vpminsd %%zmm6, %%zmm4, %%zmm4\n\t"
+        "vpslld $8, %%zmm4, %%zmm4\n\t"
+        "vpord %%zmm4, %%zmm7, %%zmm7\n\t"
+
+        "vmulps 0x18(%1)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x1c(%1)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x20(%1)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2dq %%zmm4, %%zmm4\n\t"
+        "vpminsd %%zmm6, %%zmm4, %%zmm4\n\t"
+        "vpslld $16, %%zmm4, %%zmm4\n\t"
+        "vpord %%zmm4, %%zmm7, %%zmm7\n\t"
+
+        "vpsrld $24, %%zmm0, %%zmm0\n\t"
+        "vpslld $24, %%zmm0, %%zmm0\n\t"
+        "vpord %%zmm0, %%zmm7, %%zmm7\n\t"
+
+        "vmovdqu32 %%zmm7, (%0)%{%%k1%}\n\t"
+    ::
+        "r"(pixels + position), "r"(Filters_Sepia_Coefficients), "r"(pixel_mask)
+    :
+        "%eax", "%zmm0", "%zmm1", "%zmm2", "%zmm3",
+        "%zmm4", "%zmm5", "%zmm6", "%zmm7", "%k1", "memory"
+    );
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    const size_t vector_pixels =
+        8;
+#else
+    const size_t vector_pixels =
+        4;
+#endif
+
+    // A last partial vector is filtered in a copy.
+    for (size_t i = 0; i < pixel_count; i += vector_pixels) {
+        if (i + vector_pixels <= pixel_count) {
+            _filters_sepia_bgrx_vector(pixels + position + i * 4);
+        } else {
+            uint8_t copy[32] = { 0 };
+
+            memcpy(copy, pixels + position + i * 4, (pixel_count - i) * 4);
+            _filters_sepia_bgrx_vector(copy);
+            memcpy(pixels + position + i * 4, copy, (pixel_count - i) * 4);
+        }
+    }
+
+#else
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        filters_apply_sepia(pixels, position + i * 4);
+    }
+
+#endif
+}
+
+// Filters 16 pixels of a row starting at (x, y), rows are `row_stride`
+// bytes apart. The caller guarantees that every pixel has both horizontal
+// neighbours inside the row, vertical neighbours are clamped to the image
+// like in `bmp_sample_pixel`.
+static inline void filters_apply_median_bgrx(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+    const uint8_t *row =
+        source_pixels + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+    _filters_median_run(
+        row_above, row, row_below,
+        4,
+        destination_pixels + position,
+        ~(uint64_t) 0,
+        UINT64_C(0x8888888888888888)
+    );
+
+#elif (defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION) && \
+      defined x86_64_CPU
+
+    const uint8_t *row =
+        source_pixels + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    const size_t vector_size =
+        32;
+#else
+    const size_t vector_size =
+        16;
+#endif
+
+    for (size_t i = 0; i < 64; i += vector_size) {
+        _filters_median_vector(
+            row_above + i, row + i, row_below + i,
+            4,
+            destination_pixels + position + i,
+            Filters_Keep_Alpha_Mask
+        );
+    }
+
+#else
+
+    for (size_t i = 0; i < 16; ++i) {
+        filters_apply_median(
+            source_pixels,
+            destination_pixels,
+            position + i * 4,
+            x + i, y,
+            width, height,
+            4,
+            row_stride
+        );
+    }
+
+#endif
+}
+
+// Kernels for planar images. `position` indexes the pixels of a plane, so
+// a single load picks up the same channel of consecutive pixels.
+
+static inline void filters_apply_brightness_contrast_planar(
+                       uint8_t *plane,
+                       size_t position,
+                       size_t channel_count,
+                       float brightness,
+                       float contrast
+                   )
+{
+    size_t end =
+        position + channel_count;
+
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+
+    // The plane has room for one vector past its end.
+    for (; position < end; position += 16) {
+        filters_apply_brightness_contrast(plane, position, brightness, contrast);
+    }
+
+#else
+
+    for (; position + 3 <= end; position += 3) {
+        filters_apply_brightness_contrast(plane, position, brightness, contrast);
+    }
+    for (; position < end; ++position) {
+        plane[position] =
+            (uint8_t) UTILS_CLAMP(plane[position] * contrast + brightness, 0.0f, 255.0f);
+    }
+
+#endif
+}
+
+static inline void filters_apply_sepia_planar(
+                       uint8_t *blue,
+                       uint8_t *green,
+                       uint8_t *red,
+                       size_t position,
+                       size_t pixel_count
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+#if defined x86_32_CPU || defined x86_64_CPU
+
+    // Process up to 16 pixels at the same time, one register per channel.
+    uint32_t pixel_mask =
+        (uint32_t) ((1ul << pixel_count) - 1ul);
+
+    __asm__ __volatile__ (
+        "kmovw %4, %%k1\n\t"
+        "vpmovzxbd (%0), %%zmm1\n\t"
+        "vpmovzxbd (%1), %%zmm2\n\t"
+        "vpmovzxbd (%2), %%zmm3\n\t"
+        "vcvtdq2ps %%zmm1, %%zmm1\n\t"
+        "vcvtdq2ps %%zmm2, %%zmm2\n\t"
+        "vcvtdq2ps %%zmm3, %%zmm3\n\t"
+
+        "vmulps (%3)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x4(%3)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x8(%3)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm0\n\t"
+
+        "vmulps 0xc(%3)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x10(%3)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x14(%3)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm6\n\t"
+
+        "vmulps 0x18(%3)%{1to16%}, %%zmm3, %%zmm4\n\t"
+        "vmulps 0x1c(%3)%{1to16%}, %%zmm2, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vmulps 0x20(%3)%{1to16%}, %%zmm1, %%zmm5\n\t"
+        "vaddps %%zmm5, %%zmm4, %%zmm4\n\t"
+        "vcvttps2udq %%zmm4, %%zmm7\n\t"
+
+        "vpmovusdb %%zmm0, (%0)%{%%k1%}\n\t"
+        "vpmovusdb %%zmm6, (%1)%{%%k1%}\n\t"
+        "vpmovusdb %%zmm7, (%2)%{%%k1%}\n\t"
+    ::
+        "r"(blue + position), "r"(green + position), "r"(red + position),
+        "r"(Filters_Sepia_Coefficients), "r"(pixel_mask)
+    :
+        "%zmm0", "%zmm1", "%zmm2", "%zmm3",
+        "%zmm4", "%zmm5", "%zmm6", "%zmm7", "%k1", "memory"
+    );
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+    // Fewer than 16 pixels are filtered in a copy.
+    if (16 == pixel_count) {
+        _filters_sepia_vector(blue + position, green + position, red + position);
+    } else {
+        uint8_t copy[48] = { 0 };
+
+        memcpy(copy,      blue  + position, pixel_count);
+        memcpy(copy + 16, green + position, pixel_count);
+        memcpy(copy + 32, red   + position, pixel_count);
+        _filters_sepia_vector(copy, copy + 16, copy + 32);
+        memcpy(blue  + position, copy,      pixel_count);
+        memcpy(green + position, copy + 16, pixel_count);
+        memcpy(red   + position, copy + 32, pixel_count);
+    }
+
+#else
+
+    for (size_t i = position; i < position + pixel_count; ++i) {
+        uint8_t pixel[3] = { blue[i], green[i], red[i] };
+
+        filters_apply_sepia(pixel, 0);
+
+        blue[i]  = pixel[0];
+        green[i] = pixel[1];
+        red[i]   = pixel[2];
+    }
+
+#endif
+}
+
+// Filters 64 pixels of a plane row starting at (x, y). The caller
+// guarantees that every pixel has both horizontal neighbours inside the row.
+static inline void filters_apply_median_planar(
+                       uint8_t *source_plane,
+                       uint8_t *destination_plane,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+    const uint8_t *row =
+        source_plane + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+    _filters_median_run(
+        row_above, row, row_below,
+        1,
+        destination_plane + position,
+        ~(uint64_t) 0,
+        0
+    );
+
+#elif (defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION) && \
+      defined x86_64_CPU
+
+    const uint8_t *row =
+        source_plane + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    const size_t vector_size =
+        32;
+#else
+    const size_t vector_size =
+        16;
+#endif
+
+    for (size_t i = 0; i < 64; i += vector_size) {
+        _filters_median_vector(
+            row_above + i, row + i, row_below + i,
+            1,
+            destination_plane + position + i,
+            Filters_Keep_No_Mask
+        );
+    }
+
+#else
+
+    for (size_t i = 0; i < 64; ++i) {
+        filters_apply_median(
+            source_plane,
+            destination_plane,
+            position + i,
+            x + i, y,
+            width, height,
+            1,
+            row_stride
+        );
+    }
+
+#endif
+}
+
+// Filters up to 16 packed 24 bpp pixels. The vector sets split them into
+// their B, G and R planes to share the planar kernel, none of them touches
+// the bytes past the pixels.
+static inline void filters_apply_sepia_bgr(
+                       uint8_t *pixels,
+                       size_t position,
+                       size_t pixel_count
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+#if defined x86_64_CPU
+    if (__builtin_cpu_supports("avx512vbmi")) {
+        _filters_sepia_bgr_vbmi(pixels + position, pixel_count);
+
+        return;
+    }
+#endif
+
+    uint8_t planes[48];
+    uint8_t *source =
+        pixels + position;
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        planes[i]      = source[i * 3];
+        planes[i + 16] = source[i * 3 + 1];
+        planes[i + 32] = source[i * 3 + 2];
+    }
+
+    filters_apply_sepia_planar(planes, planes + 16, planes + 32, 0, pixel_count);
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        source[i * 3]     = planes[i];
+        source[i * 3 + 1] = planes[i + 16];
+        source[i * 3 + 2] = planes[i + 32];
+    }
+
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+
+    // Fewer than 16 pixels are filtered in a copy.
+    uint8_t copy[48] = { 0 };
+    uint8_t *source =
+        16 == pixel_count ? pixels + position : copy;
+    uint8_t planes[48];
+
+    if (source == copy) {
+        memcpy(copy, pixels + position, pixel_count * 3);
+    }
+
+    _filters_shuffle_pixels_vector(source, planes, Filters_Deinterleave_Shuffles);
+    _filters_sepia_vector(planes, planes + 16, planes + 32);
+    _filters_shuffle_pixels_vector(planes, source, Filters_Interleave_Shuffles);
+
+    if (source == copy) {
+        memcpy(pixels + position, copy, pixel_count * 3);
+    }
+
+#else
+
+    for (size_t i = 0; i < pixel_count; ++i) {
+        filters_apply_sepia(pixels, position + i * 3);
+    }
+
+#endif
+}
+
+// Filters 16 packed 24 bpp pixels away from the left and right edges of a
+// row. The vector sets treat the 48 channels as bytes three bytes apart
+// from their neighbours, AVX-512 masks them out of one vector of 64.
+static inline void filters_apply_median_bgr(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t x,
+                       size_t y,
+                       size_t width,
+                       size_t height,
+                       size_t row_stride
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+    const uint8_t *row =
+        source_pixels + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+    _filters_median_run(
+        row_above, row, row_below,
+        3,
+        destination_pixels + position,
+        (UINT64_C(1) << 48) - 1,
+        0
+    );
+
+#elif (defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION) && \
+    defined x86_64_CPU
+
+    const uint8_t *row =
+        source_pixels + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+    // The two AVX2 vectors overlap in the middle 16 bytes, both write the
+    // same medians there.
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    const size_t offsets[] = { 0, 16 };
+#else
+    const size_t offsets[] = { 0, 16, 32 };
+#endif
+
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(*offsets); ++i) {
+        _filters_median_vector(
+            row_above + offsets[i], row + offsets[i], row_below + offsets[i],
+            3,
+            destination_pixels + position + offsets[i],
+            Filters_Keep_No_Mask
+        );
+    }
+
+#else
+
+    for (size_t i = 0; i < 16; ++i) {
+        filters_apply_median(
+            source_pixels,
+            destination_pixels,
+            position + i * 3,
+            x + i, y,
+            width, height,
+            3,
+            row_stride
+        );
+    }
+
+#endif
+}
+
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+
+// Filters the `count` pixels of one or more channels that are left at the
+// right end of a row, away from its left and right edges. The pixels have to
+// fit into a vector of 64 channels.
+static inline void filters_apply_median_run(
+                       uint8_t *source_pixels,
+                       uint8_t *destination_pixels,
+                       size_t position,
+                       size_t y,
+                       size_t height,
+                       size_t bytes_per_pixel,
+                       size_t row_stride,
+                       size_t count
+                   )
+{
+    const uint8_t *row =
+        source_pixels + position;
+    const uint8_t *row_above =
+        y > 0 ? row - row_stride : row;
+    const uint8_t *row_below =
+        y + 1 < height ? row + row_stride : row;
+
+    size_t channels =
+        count * bytes_per_pixel;
+    uint64_t channel_mask =
+        channels < 64 ? (UINT64_C(1) << channels) - 1 : ~(uint64_t) 0;
+
+    _filters_median_run(
+        row_above, row, row_below,
+        bytes_per_pixel,
+        destination_pixels + position,
+        channel_mask,
+        4 == bytes_per_pixel ? channel_mask & UINT64_C(0x8888888888888888) : 0
+    );
+}
+
+#endif
+
+// Maps `count` bytes through a table of 256 entries. With `keep_alpha`,
+// the bytes are whole 32 bpp pixels and their fourth bytes stay as they are.
+static inline void filters_apply_lookup(
+                       uint8_t *channels,
+                       size_t count,
+                       bool keep_alpha,
+                       const uint8_t *table
+                   )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+    if (__builtin_cpu_supports("avx512vbmi")) {
+        _filters_lookup_vbmi(
+            channels, count,
+            keep_alpha ? UINT64_C(0x8888888888888888) : 0,
+            table
+        );
+
+        return;
+    }
+#endif
+
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+
+#if defined FILTERS_SSE41_ASM_IMPLEMENTATION
+    const size_t vector_size =
+        16;
+#else
+    const size_t vector_size =
+        32;
+#endif
+
+    const uint8_t *keep_mask =
+        keep_alpha ? Filters_Keep_Alpha_Mask : Filters_Keep_No_Mask;
+
+    // A last partial vector is mapped in a copy.
+    for (size_t i = 0; i < count; i += vector_size) {
+        if (i + vector_size <= count) {
+            _filters_lookup_vector(channels + i, keep_mask, table);
+        } else {
+            uint8_t copy[32] = { 0 };
+
+            memcpy(copy, channels + i, count - i);
+            _filters_lookup_vector(copy, keep_mask, table);
+            memcpy(channels + i, copy, count - i);
+        }
+    }
+
+#else
+
+    if (keep_alpha) {
+        for (size_t i = 0; i < count; i += 4) {
+            channels[i]     = table[channels[i]];
+            channels[i + 1] = table[channels[i + 1]];
+            channels[i + 2] = table[channels[i + 2]];
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            channels[i] = table[channels[i]];
+        }
+    }
+
+#endif
+}
+
+// Segment kernels of the set, see `filters_kernel_set`.
+
+static bool filters_kernels_are_supported(void)
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    return __builtin_cpu_supports("avx2");
+#elif defined FILTERS_SSE41_ASM_IMPLEMENTATION
+    return __builtin_cpu_supports("sse4.1");
+#else
+    return true;
+#endif
+}
+
+// A lookup costs the scalar kernels far less than the arithmetic. The
+// shuffles of SSE4.1 and AVX2 take 16 rounds per vector and do not beat
+// their arithmetic, the permutes of AVX512-VBMI take two.
+static bool filters_kernels_prefer_lookup(void)
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+    return __builtin_cpu_supports("avx512vbmi");
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION || defined FILTERS_SSE41_ASM_IMPLEMENTATION
+    return false;
+#else
+    return true;
+#endif
+}
+
+// Fixed point rounds the brightness and the contrast. It is exact when it
+// maps every channel value the way the float kernels do, which takes one
+// table of all values adjusted each way.
+static bool filters_kernels_fixed_point_is_exact(
+                float brightness __attribute__((unused)),
+                float contrast __attribute__((unused))
+            )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+    uint8_t fixed_point_table[FILTERS_LOOKUP_TABLE_SIZE];
+    uint8_t float_table[FILTERS_LOOKUP_TABLE_SIZE];
+    for (size_t i = 0; i < FILTERS_LOOKUP_TABLE_SIZE; ++i) {
+        fixed_point_table[i] =
+            (uint8_t) i;
+        float_table[i] =
+            (uint8_t) i;
+    }
+
+    filters_apply_brightness_contrast_planar(
+        float_table,
+        0, FILTERS_LOOKUP_TABLE_SIZE,
+        brightness, contrast
+    );
+
+    return _filters_brightness_contrast_fixed_point(
+               fixed_point_table,
+               FILTERS_LOOKUP_TABLE_SIZE,
+               0,
+               brightness, contrast
+           ) &&
+           0 == memcmp(fixed_point_table, float_table, FILTERS_LOOKUP_TABLE_SIZE);
+#else
+    return false;
+#endif
+}
+
+// Task boundaries have to fall on whole pixels and on whole vector steps:
+// 16 channels for 24 bpp vector kernels (48 = lcm(16, 3)), 16 pixels for the
+// 32 bpp kernels and 64 pixels for the median of planes and single-byte
+// pixels. The scalar kernels step over three channels, single-byte pixels
+// take 192 = lcm(64, 3) for them.
+static size_t filters_kernels_channels_per_step(
+                  size_t bytes_per_pixel,
+                  size_t plane_size
+              )
+{
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+    return 3 != bytes_per_pixel || 0 != plane_size ? 64 : 48;
+#else
+    return 0 != plane_size      ? 64  :
+           3 == bytes_per_pixel ? 3   :
+           1 == bytes_per_pixel ? 192 :
+                                  64;
+#endif
+}
+
+static void filters_kernels_brightness_contrast(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                bool padded,
+                float brightness,
+                float contrast,
+                bool fixed_point
+            )
+{
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+    // The whole segment is adjusted in fixed point when the caller found it
+    // exact, the float kernels below are left for the other values.
+    if (fixed_point) {
+        if (0 != plane_size) {
+            for (size_t channel = 0; channel < 3; ++channel) {
+                _filters_brightness_contrast_fixed_point(
+                    pixels + channel * plane_size + position,
+                    end - position,
+                    0,
+                    brightness, contrast
+                );
+            }
+        } else {
+            _filters_brightness_contrast_fixed_point(
+                pixels + position,
+                end - position,
+                4 == bytes_per_pixel ? UINT64_C(0x8888888888888888) : 0,
+                brightness, contrast
+            );
+        }
+
+        return;
+    }
+#endif
+
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+    size_t step =
+        16;
+#else
+    size_t step =
+        bytes_per_pixel == 4 ? 16 : 3;
+#endif
+
+    if (0 != plane_size) {
+        for (size_t channel = 0; channel < 3; ++channel) {
+            filters_apply_brightness_contrast_planar(
+                pixels + channel * plane_size,
+                position, end - position,
+                brightness, contrast
+            );
+        }
+    } else if (bytes_per_pixel == 4) {
+        for (; position < end; position += step) {
+            filters_apply_brightness_contrast_bgrx(
+                pixels, position,
+                UTILS_MIN(end - position, step) / 4,
+                brightness, contrast
+            );
+        }
+    } else {
+        for (; position < end; position += step) {
+            if (!padded || end - position >= step) {
+                filters_apply_brightness_contrast(
+                    pixels, position,
+                    brightness, contrast
+                );
+            } else {
+                // A vector must not spill into the next row, the end
+                // of a padded row is filtered in a copy.
+                uint8_t tail[64] = { 0 };
+                size_t tail_size =
+                    end - position;
+
+                memcpy(tail, pixels + position, tail_size);
+                filters_apply_brightness_contrast(
+                    tail, 0,
+                    brightness, contrast
+                );
+                memcpy(pixels + position, tail, tail_size);
+            }
+        }
+    }
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    __asm__ __volatile__ ("vzeroupper");
+#endif
+}
+
+static void filters_kernels_sepia(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size
+            )
+{
+    if (0 != plane_size) {
+        size_t step =
+            16;
+
+        for (; position < end; position += step) {
+            filters_apply_sepia_planar(
+                pixels,
+                pixels + plane_size,
+                pixels + 2 * plane_size,
+                position,
+                UTILS_MIN(end - position, step)
+            );
+        }
+    } else if (bytes_per_pixel == 4) {
+        size_t step =
+            64;
+
+        for (; position < end; position += step) {
+            filters_apply_sepia_bgrx(
+                pixels, position,
+                UTILS_MIN(end - position, step) / 4
+            );
+        }
+    } else {
+#if defined FILTERS_VECTOR_IMPLEMENTATION
+        size_t step =
+            48;
+
+        for (; position < end; position += step) {
+            filters_apply_sepia_bgr(
+                pixels, position,
+                UTILS_MIN(end - position, step) / 3
+            );
+        }
+#else
+        size_t step =
+            3;
+
+        for (; position < end; position += step) {
+            filters_apply_sepia(pixels, position);
+        }
+#endif
+    }
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    __asm__ __volatile__ ("vzeroupper");
+#endif
+}
+
+static void filters_kernels_median(
+                uint8_t *source_pixels,
+                uint8_t *destination_pixels,
+                size_t position,
+                size_t end,
+                size_t width,
+                size_t height,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                size_t row_stride,
+                size_t radius
+            )
+{
+    // Positions count pixels or channels of packed rows, `offset` is where
+    // they are in the rows `row_stride` bytes apart.
+    // Planes are filtered one after another, the alpha plane is copied.
+    // Single-byte pixels (grayscale indices) form one plane.
+    bool planes =
+        0 != plane_size || 1 == bytes_per_pixel;
+
+    // Windows of other radii are filtered a piece of a row at a time, the
+    // way picked by their size.
+    if (FILTERS_MEDIAN_DEFAULT_RADIUS != radius) {
+        size_t pixel_size =
+            planes ? 1 : bytes_per_pixel;
+        size_t plane_count =
+            planes ? bytes_per_pixel : 1;
+        for (size_t channel = 0; channel < plane_count; ++channel) {
+            uint8_t *source_plane =
+                source_pixels + channel * plane_size;
+            uint8_t *destination_plane =
+                destination_pixels + channel * plane_size;
+
+            if (3 == channel) {
+                memcpy(
+                    destination_plane + position,
+                    source_plane + position,
+                    end - position
+                );
+
+                continue;
+            }
+
+            for (size_t pixel = position / pixel_size; pixel < end / pixel_size;) {
+                size_t x =
+                    pixel % width;
+                size_t y =
+                    pixel / width;
+                size_t count =
+                    UTILS_MIN(width - x, end / pixel_size - pixel);
+                size_t offset =
+                    y * row_stride + x * pixel_size;
+
+                // Bands of whole rows share their column histograms.
+                size_t row_count =
+                    0 == x ? (end / pixel_size - pixel) / width : 0;
+                if (radius > FILTERS_MEDIAN_SLIDING_RADIUS && 0 != row_count &&
+                    filters_apply_median_columns(
+                        source_plane,
+                        destination_plane,
+                        y, row_count,
+                        width, height,
+                        pixel_size,
+                        row_stride,
+                        radius
+                    )) {
+                    pixel += row_count * width;
+
+                    continue;
+                }
+
+                if (radius <= FILTERS_MEDIAN_NETWORK_RADIUS) {
+                    filters_apply_median_network(
+                        source_plane,
+                        destination_plane,
+                        offset,
+                        x, y,
+                        count,
+                        width, height,
+                        pixel_size,
+                        row_stride,
+                        radius
+                    );
+                } else {
+                    filters_apply_median_sliding(
+                        source_plane,
+                        destination_plane,
+                        offset,
+                        x, y,
+                        count,
+                        width, height,
+                        pixel_size,
+                        row_stride,
+                        radius
+                    );
+                }
+
+                pixel += count;
+            }
+        }
+
+        return;
+    }
+
+    for (size_t channel = 0; planes && channel < bytes_per_pixel; ++channel) {
+        uint8_t *source_plane =
+            source_pixels + channel * plane_size;
+        uint8_t *destination_plane =
+            destination_pixels + channel * plane_size;
+
+        if (3 == channel) {
+            memcpy(
+                destination_plane + position,
+                source_plane + position,
+                end - position
+            );
+
+            continue;
+        }
+
+        for (size_t plane_position = position; plane_position < end;) {
+            size_t x =
+                plane_position % width;
+            size_t y =
+                plane_position / width;
+            size_t offset =
+                y * row_stride + x;
+
+            if (x >= 1 && x + 64 < width &&
+                plane_position + 64 <= end) {
+                filters_apply_median_planar(
+                    source_plane,
+                    destination_plane,
+                    offset,
+                    x, y,
+                    width, height,
+                    row_stride
+                );
+                plane_position += 64;
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+            } else if (x >= 1 && x + 1 < width) {
+                size_t count =
+                    UTILS_MIN(UTILS_MIN(width - 1 - x, end - plane_position), (size_t) 64);
+
+                filters_apply_median_run(
+                    source_plane,
+                    destination_plane,
+                    offset,
+                    y, height,
+                    1,
+                    row_stride,
+                    count
+                );
+                plane_position += count;
+#endif
+            } else {
+                filters_apply_median(
+                    source_plane,
+                    destination_plane,
+                    offset,
+                    x, y,
+                    width, height,
+                    1,
+                    row_stride
+                );
+                ++plane_position;
+            }
+        }
+    }
+
+    while (!planes && position < end) {
+        size_t x =
+            (position / bytes_per_pixel) % width;
+        size_t y =
+            (position / bytes_per_pixel) / width;
+        size_t offset =
+            y * row_stride + x * bytes_per_pixel;
+
+        // Runs of 16 pixels away from the left and right edges of a
+        // 24 or 32 bpp row are filtered at once.
+        if (bytes_per_pixel == 4     &&
+            x >= 1 && x + 16 < width &&
+            position + 64 <= end) {
+            filters_apply_median_bgrx(
+                source_pixels,
+                destination_pixels,
+                offset,
+                x, y,
+                width, height,
+                row_stride
+            );
+            position += 64;
+        } else if (bytes_per_pixel == 3     &&
+                   x >= 1 && x + 16 < width &&
+                   position + 48 <= end) {
+            filters_apply_median_bgr(
+                source_pixels,
+                destination_pixels,
+                offset,
+                x, y,
+                width, height,
+                row_stride
+            );
+            position += 48;
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+        } else if ((bytes_per_pixel == 3 || bytes_per_pixel == 4) &&
+                   x >= 1 && x + 1 < width                        &&
+                   position + bytes_per_pixel <= end) {
+            size_t count =
+                UTILS_MIN(UTILS_MIN(width - 1 - x, (end - position) / bytes_per_pixel), (size_t) 16);
+
+            filters_apply_median_run(
+                source_pixels,
+                destination_pixels,
+                offset,
+                y, height,
+                bytes_per_pixel,
+                row_stride,
+                count
+            );
+            position += count * bytes_per_pixel;
+#endif
+        } else {
+            filters_apply_median(
+                source_pixels,
+                destination_pixels,
+                offset,
+                x, y,
+                width, height,
+                bytes_per_pixel,
+                row_stride
+            );
+            position += bytes_per_pixel;
+        }
+    }
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    __asm__ __volatile__ ("vzeroupper");
+#endif
+}
+
+// Every tile is filtered as a small image of BMP_TILE_STRIDE by
+// BMP_TILE_STRIDE pixels. Its halo holds the neighbours, so the windows of
+// its inner pixels stay within the tile and the row kernels apply to whole
+// tile rows. `columns` and `rows` leave out the parts of edge tiles past
+// the image.
+static void filters_kernels_median_tile(
+                uint8_t *source_tile,
+                uint8_t *destination_tile,
+                size_t columns,
+                size_t rows,
+                size_t bytes_per_pixel
+            )
+{
+    size_t row_stride =
+        BMP_TILE_STRIDE * bytes_per_pixel;
+
+    for (size_t y = BMP_TILE_HALO; y < BMP_TILE_HALO + rows; ++y) {
+        for (size_t x = BMP_TILE_HALO; x < BMP_TILE_HALO + columns;) {
+            size_t position =
+                y * row_stride + x * bytes_per_pixel;
+
+            if (1 == bytes_per_pixel && x + 64 < BMP_TILE_STRIDE) {
+                filters_apply_median_planar(
+                    source_tile,
+                    destination_tile,
+                    position,
+                    x, y,
+                    BMP_TILE_STRIDE, BMP_TILE_STRIDE,
+                    row_stride
+                );
+                x += 64;
+            } else if (4 == bytes_per_pixel && x + 16 < BMP_TILE_STRIDE) {
+                filters_apply_median_bgrx(
+                    source_tile,
+                    destination_tile,
+                    position,
+                    x, y,
+                    BMP_TILE_STRIDE, BMP_TILE_STRIDE,
+                    row_stride
+                );
+                x += 16;
+            } else if (3 == bytes_per_pixel && x + 16 < BMP_TILE_STRIDE) {
+                filters_apply_median_bgr(
+                    source_tile,
+                    destination_tile,
+                    position,
+                    x, y,
+                    BMP_TILE_STRIDE, BMP_TILE_STRIDE,
+                    row_stride
+                );
+                x += 16;
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION && defined x86_64_CPU
+            } else if (bytes_per_pixel != 2 && x + 1 < BMP_TILE_STRIDE) {
+                size_t count =
+                    UTILS_MIN(
+                        BMP_TILE_HALO + columns - x,
+                        64 / bytes_per_pixel
+                    );
+
+                filters_apply_median_run(
+                    source_tile,
+                    destination_tile,
+                    position,
+                    y, BMP_TILE_STRIDE,
+                    bytes_per_pixel,
+                    row_stride,
+                    count
+                );
+                x += count;
+#endif
+            } else {
+                filters_apply_median(
+                    source_tile,
+                    destination_tile,
+                    position,
+                    x, y,
+                    BMP_TILE_STRIDE, BMP_TILE_STRIDE,
+                    bytes_per_pixel,
+                    row_stride
+                );
+                ++x;
+            }
+        }
+    }
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    __asm__ __volatile__ ("vzeroupper");
+#endif
+}
+
+// Pointwise filters given as a table map every color channel through it.
+// The kernel works on exact byte counts, padded rows need no special care.
+static void filters_kernels_lookup(
+                uint8_t *pixels,
+                size_t position,
+                size_t end,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                const uint8_t *table
+            )
+{
+    if (0 != plane_size) {
+        for (size_t channel = 0; channel < 3; ++channel) {
+            filters_apply_lookup(
+                pixels + channel * plane_size + position,
+                end - position,
+                false,
+                table
+            );
+        }
+    } else {
+        filters_apply_lookup(
+            pixels + position,
+            end - position,
+            4 == bytes_per_pixel,
+            table
+        );
+    }
+
+#if defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    __asm__ __volatile__ ("vzeroupper");
+#endif
+}
+
+static const filters_kernel_set Filters_Kernel_Set = {
+#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
+    .name                 = "avx512",
+#elif defined FILTERS_AVX2_ASM_IMPLEMENTATION
+    .name                 = "avx2",
+#elif defined FILTERS_SSE41_ASM_IMPLEMENTATION
+    .name                 = "sse4.1",
+#elif defined FILTERS_X87_ASM_IMPLEMENTATION
+    .name                 = "x87",
+#else
+    .name                 = "c",
+#endif
+    .is_supported         = filters_kernels_are_supported,
+    .prefers_lookup       = filters_kernels_prefer_lookup,
+    .fixed_point_is_exact = filters_kernels_fixed_point_is_exact,
+    .channels_per_step    = filters_kernels_channels_per_step,
+    .brightness_contrast  = filters_kernels_brightness_contrast,
+    .sepia                = filters_kernels_sepia,
+    .median               = filters_kernels_median,
+    .median_tile          = filters_kernels_median_tile,
+    .lookup               = filters_kernels_lookup
+};
+
+
+/*
+#elif defined FILTERS_SIMD_ASM_IMPLEMENTATION
+
+In filters_threading.impl.h.c change FILTERS_SIMD_ASM_IMPLEMENTATION step to 12
+
+float coffs[] = {0.272f, 0.272f, 0.272f, 0.272f, //red1
+                 0.349f, 0.349f, 0.349f, 0.349f, //red2
+                 0.393f, 0.393f, 0.393f, 0.393f, //red3
+                 0.534f, 0.534f, 0.534f, 0.534f, //green1
+                 0.686f, 0.686f, 0.686f, 0.686f, //green2
+                 0.769f, 0.769f, 0.769f, 0.769f, //green3
+                 0.131f, 0.131f, 0.131f, 0.131f, //blue1
+                 0.168f, 0.168f, 0.168f, 0.168f, //blue2
+                 0.189f, 0.189f, 0.189f, 0.189f  //blue3
+                };
+
+uint8_t pixels_b[4];
+uint8_t pixels_g[4];
+uint8_t pixels_r[4];
+
+for(int i = 0; i < 4; ++i)
+{
+        pixels_b[i] = pixels[position + i * 3];
+        pixels_g[i] = pixels[position + i * 3 + 1];
+        pixels_r[i] = pixels[position + i * 3 + 2];
+
+}
+
+
+#if defined x86_32_CPU
+
+    __asm__ __volatile__ (
+        "\n\t" :::
+    );
+
+#elif defined x86_64_CPU
+
+
+      __asm__ __volatile__ (
+
+        "vpmovzxbd (%0), %%xmm1\n\t" //blues
+        "vpmovzxbd (%1), %%xmm2\n\t" //greens
+        "vpmovzxbd (%2), %%xmm3\n\t" //reds
+
+        "vmovups (%3), %%xmm4\n\t" //r1
+        "vmovups 0x10(%3), %%xmm5\n\t" //r2
+        "vmovups 0x20(%3), %%xmm6\n\t" //r3
+        "vmovups 0x30(%3), %%xmm7\n\t" //g1
+        "vmovups 0x40(%3), %%xmm8\n\t" //g2
+        "vmovups 0x50(%3), %%xmm9\n\t" //g3
+        "vmovups 0x60(%3), %%xmm10\n\t" //b1
+        "vmovups 0x70(%3), %%xmm11\n\t" //b2
+        "vmovups 0x80(%3), %%xmm12\n\t" //b3
+
+
+        "vcvtdq2ps  %%xmm1, %%xmm1\n\t"
+        "vcvtdq2ps  %%xmm2, %%xmm2\n\t"
+        "vcvtdq2ps  %%xmm3, %%xmm3\n\t"
+
+
+
+
+        //reds
+        "vmulps      %%xmm3, %%xmm4, %%xmm4\n\t"
+        "vmulps      %%xmm3, %%xmm5, %%xmm5\n\t"
+        "vmulps      %%xmm3, %%xmm6, %%xmm6\n\t"
+
+        //greens
+        "vmulps      %%xmm2, %%xmm7, %%xmm7\n\t"
+        "vmulps      %%xmm2, %%xmm8, %%xmm8\n\t"
+        "vmulps      %%xmm2, %%xmm9, %%xmm9\n\t"
+
+        //blues
+        "vmulps      %%xmm1, %%xmm10, %%xmm10\n\t"
+        "vmulps      %%xmm1, %%xmm11, %%xmm11\n\t"
+        "vmulps      %%xmm1, %%xmm12, %%xmm12\n\t"
+
+        //result for blue values
+        "vaddps      %%xmm7, %%xmm4, %%xmm1\n\t"
+        "vaddps      %%xmm1, %%xmm10, %%xmm1\n\t"
+
+        //result for green values
+        "vaddps      %%xmm8, %%xmm5, %%xmm2\n\t"
+        "vaddps      %%xmm2, %%xmm11, %%xmm2\n\t"
+
+        //result for red values
+        "vaddps      %%xmm9, %%xmm6, %%xmm3\n\t"
+        "vaddps      %%xmm3, %%xmm12, %%xmm3\n\t"
+
+        "vcvtps2dq  %%xmm1, %%xmm1\n\t"
+        "vcvtps2dq  %%xmm2, %%xmm2\n\t"
+        "vcvtps2dq  %%xmm3, %%xmm3\n\t"
+
+
+        "vpmovusdb  %%xmm1, (%0)\n\t"//blue
+        "vpmovusdb  %%xmm2, (%1)\n\t"//green
+        "vpmovusdb  %%xmm3, (%2)\n\t"//red
+::
+        "S"(pixels_b), "D"(pixels_g), "c"(pixels_r)
+        ,"d"(coffs)
+:
+        "%zmm0", "%zmm1", "%zmm2", "%zmm3", "zmm5",
+        "%zmm6", "%zmm7", "%zmm8", "%zmm9", "zmm10",
+        "%zmm11", "%zmm12"
+    );
+
+for(int i = 0; i < 4; ++i)
+{
+        pixels[position + i * 3] = pixels_b[i];
+        pixels[position + i * 3 + 1] = pixels_g[i];
+        pixels[position + i * 3 + 2] = pixels_r[i];
+}
+
+
+#else
+#error "Unsupported processor architecture"
+#endif
+
+#endif
+
+*/
@@ -5,12 +5,41 @@
 #include <stddef.h>
 #include <stdbool.h>
 
+#include "bmp.h"
+#include "threadpool.h"
+
+static const char *Filters_Error_Not_Enough_Memory_to_Duplicate =
+                    "Not enough memory to duplicate the image",
+                  *Filters_Error_Radius_Exceeds_Tile_Halo =
+                    "The median window does not fit into the halo of a tile";
+
+/*
+    Pointwise filters working out of place copy this many channels into the
+    destination right before filtering them there, while they are still in
+    the cache. A multiple of every vector step (192 = lcm(64, 48, 3)).
+*/
+#define FILTERS_COPY_CHUNK_SIZE (64 * 192)
+
+/*
+    Pointwise filters reading their rows from the source themselves read
+    this many channels at a time and filter them before the next read.
+*/
+#define FILTERS_READ_CHUNK_SIZE (16 * FILTERS_COPY_CHUNK_SIZE)
+
 typedef struct _filters_brightness_contrast_data
 {
     size_t linear_position;
     size_t channels_to_process;
+    size_t bytes_per_pixel;
+    size_t plane_size;
+    size_t row_size, row_stride;
+    bmp_row_reader *row_reader;
+    uint8_t *source_pixels;
     uint8_t *pixels;
     float brightness, contrast;
+    bool fixed_point;
+    const uint8_t *lookup_table;
+    bmp_row_writer *row_writer;
     volatile ssize_t *channels_left;
     volatile bool *barrier_sense;
 } filters_brightness_contrast_data_t;
@@ -19,7 +48,13 @@ typedef struct _filters_sepia_data
 {
     size_t linear_position;
     size_t channels_to_process;
+    size_t bytes_per_pixel;
+    size_t plane_size;
+    size_t row_size, row_stride;
+    bmp_row_reader *row_reader;
+    uint8_t *source_pixels;
     uint8_t *pixels;
+    bmp_row_writer *row_writer;
     volatile ssize_t *channels_left;
     volatile bool *barrier_sense;
 } filters_sepia_data_t;
@@ -29,18 +64,54 @@ typedef struct _filters_median_data
     size_t linear_position;
     size_t channels_to_process;
     size_t image_width, image_height;
+    size_t bytes_per_pixel;
+    size_t plane_size;
+    size_t row_stride;
+    size_t radius;
     uint8_t *source_pixels;
     uint8_t *destination_pixels;
+    bmp_row_writer *row_writer;
     volatile ssize_t *channels_left;
     volatile bool *barrier_sense;
 } filters_median_data_t;
 
+typedef struct _filters_median_tiles_data
+{
+    size_t first_tile;
+    size_t tiles_to_process;
+    size_t tile_columns, tile_size;
+    size_t image_width, image_height;
+    size_t bytes_per_pixel;
+    uint8_t *source_pixels;
+    uint8_t *destination_pixels;
+    volatile ssize_t *tiles_left;
+    volatile bool *barrier_sense;
+} filters_median_tiles_data_t;
+
+typedef struct _filters_read_rows_data
+{
+    size_t linear_position;
+    size_t channels_to_process;
+    bmp_row_reader *row_reader;
+    volatile ssize_t *channels_left;
+    volatile bool *barrier_sense;
+} filters_read_rows_data_t;
+
 static inline filters_brightness_contrast_data_t *filters_brightness_contrast_data_create(
                                                        size_t linear_position,
                                                        size_t channels_to_process,
+                                                       size_t bytes_per_pixel,
+                                                       size_t plane_size,
+                                                       size_t row_size,
+                                                       size_t row_stride,
+                                                       bmp_row_reader *row_reader,
+                                                       uint8_t *source_pixels,
                                                        uint8_t *pixels,
                                                        float brightness,
                                                        float contrast,
+                                                       bool fixed_point,
+                                                       const uint8_t *lookup_table,
+                                                       bmp_row_writer *row_writer,
                                                        volatile ssize_t *channels_left,
                                                        volatile bool *barrier_sense
                                                   );
@@ -52,7 +123,14 @@ static inline void filters_brightness_contrast_data_destroy(
 static inline filters_sepia_data_t *filters_sepia_data_create(
                                         size_t linear_position,
                                         size_t channels_to_process,
+                                        size_t bytes_per_pixel,
+                                        size_t plane_size,
+                                        size_t row_size,
+                                        size_t row_stride,
+                                        bmp_row_reader *row_reader,
+                                        uint8_t *source_pixels,
                                         uint8_t *pixels,
+                                        bmp_row_writer *row_writer,
                                         volatile ssize_t *channels_left,
                                         volatile bool *barrier_sense
                                     );
@@ -66,8 +144,13 @@ static inline filters_median_data_t *filters_median_data_create(
                                          size_t channels_to_process,
                                          size_t image_width,
                                          size_t image_height,
+                                         size_t bytes_per_pixel,
+                                         size_t plane_size,
+                                         size_t row_stride,
+                                         size_t radius,
                                          uint8_t *source_pixels,
                                          uint8_t *destination_pixels,
+                                         bmp_row_writer *row_writer,
                                          volatile ssize_t *channels_left,
                                          volatile bool *barrier_sense
                                      );
@@ -76,6 +159,36 @@ static inline void filters_median_data_destroy(
                        filters_median_data_t *data
                    );
 
+static inline filters_median_tiles_data_t *filters_median_tiles_data_create(
+                                               size_t first_tile,
+                                               size_t tiles_to_process,
+                                               size_t tile_columns,
+                                               size_t tile_size,
+                                               size_t image_width,
+                                               size_t image_height,
+                                               size_t bytes_per_pixel,
+                                               uint8_t *source_pixels,
+                                               uint8_t *destination_pixels,
+                                               volatile ssize_t *tiles_left,
+                                               volatile bool *barrier_sense
+                                           );
+
+static inline void filters_median_tiles_data_destroy(
+                       filters_median_tiles_data_t *data
+                   );
+
+static inline filters_read_rows_data_t *filters_read_rows_data_create(
+                                            size_t linear_position,
+                                            size_t channels_to_process,
+                                            bmp_row_reader *row_reader,
+                                            volatile ssize_t *channels_left,
+                                            volatile bool *barrier_sense
+                                        );
+
+static inline void filters_read_rows_data_destroy(
+                       filters_read_rows_data_t *data
+                   );
+
 /* Threading Tasks */
 
 static void filters_brightness_contrast_processing_task(
@@ -93,6 +206,82 @@ static void filters_median_processing_task(
                 void (*result_callback)(void *result)
             );
 
+static void filters_median_tiles_processing_task(
+                void *task_data,
+                void (*result_callback)(void *result)
+            );
+
+static void filters_read_rows_task(
+                void *task_data,
+                void (*result_callback)(void *result)
+            );
+
+/* Processing Helpers */
+
+static void filters_process_channels(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                size_t first_channel,
+                size_t channels_count,
+                size_t image_width,
+                size_t image_height,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                size_t row_stride,
+                uint8_t *source_pixels,
+                uint8_t *pixels,
+                bmp_row_reader *row_reader,
+                bmp_row_writer *row_writer
+            );
+
+static void filters_read_rows(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                size_t channels_count,
+                size_t row_size,
+                bmp_row_reader *row_reader
+            );
+
+static void filters_process_median_tiles(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                bmp_image *image,
+                uint8_t *source_pixels
+            );
+
+static void filters_process_color_table(
+                int filter_id,
+                float brightness,
+                float contrast,
+                uint8_t *color_table,
+                size_t color_count
+            );
+
+static int filters_prepare_indexed_image(
+               bmp_image *image,
+               int filter_id,
+               float brightness,
+               float contrast
+           );
+
+static void filters_process_image(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                bmp_image *image,
+                uint8_t *destination_pixels,
+                bmp_row_reader *row_reader,
+                bmp_row_writer *row_writer,
+                const char **error_message
+            );
+
 #include "filters_threading.impl.h.c"
 
 #endif /* FILTERS_THREADING_H */
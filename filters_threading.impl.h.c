@@ -1,14 +1,25 @@
 #include "filters_threading.h"
 #include "filters.h"
+#include "image_buffer.h"
 
 #include <stdlib.h>
+#include <string.h>
 
 static inline filters_brightness_contrast_data_t *filters_brightness_contrast_data_create(
                                                       size_t linear_position,
                                                       size_t channels_to_process,
+                                                      size_t bytes_per_pixel,
+                                                      size_t plane_size,
+                                                      size_t row_size,
+                                                      size_t row_stride,
+                                                      bmp_row_reader *row_reader,
+                                                      uint8_t *source_pixels,
                                                       uint8_t *pixels,
                                                       float brightness,
                                                       float contrast,
+                                                      bool fixed_point,
+                                                      const uint8_t *lookup_table,
+                                                      bmp_row_writer *row_writer,
                                                       volatile ssize_t *channels_left,
                                                       volatile bool *barrier_sense
                                                   ) {
@@ -23,12 +34,30 @@ static inline filters_brightness_contrast_data_t *filters_brightness_contrast_da
         linear_position;
     data->channels_to_process =
         channels_to_process;
+    data->bytes_per_pixel =
+        bytes_per_pixel;
+    data->plane_size =
+        plane_size;
+    data->row_size =
+        row_size;
+    data->row_stride =
+        row_stride;
+    data->row_reader =
+        row_reader;
+    data->source_pixels =
+        source_pixels;
     data->pixels =
         pixels;
     data->brightness =
         brightness;
     data->contrast =
         contrast;
+    data->fixed_point =
+        fixed_point;
+    data->lookup_table =
+        lookup_table;
+    data->row_writer =
+        row_writer;
     data->channels_left =
         channels_left;
     data->barrier_sense =
@@ -49,7 +78,14 @@ static inline void filters_brightness_contrast_data_destroy(
 static inline filters_sepia_data_t *filters_sepia_data_create(
                                         size_t linear_position,
                                         size_t channels_to_process,
+                                        size_t bytes_per_pixel,
+                                        size_t plane_size,
+                                        size_t row_size,
+                                        size_t row_stride,
+                                        bmp_row_reader *row_reader,
+                                        uint8_t *source_pixels,
                                         uint8_t *pixels,
+                                        bmp_row_writer *row_writer,
                                         volatile ssize_t *channels_left,
                                         volatile bool *barrier_sense
                                    ) {
@@ -64,8 +100,22 @@ static inline filters_sepia_data_t *filters_sepia_data_create(
         linear_position;
     data->channels_to_process =
         channels_to_process;
+    data->bytes_per_pixel =
+        bytes_per_pixel;
+    data->plane_size =
+        plane_size;
+    data->row_size =
+        row_size;
+    data->row_stride =
+        row_stride;
+    data->row_reader =
+        row_reader;
+    data->source_pixels =
+        source_pixels;
     data->pixels =
         pixels;
+    data->row_writer =
+        row_writer;
     data->channels_left =
         channels_left;
     data->barrier_sense =
@@ -88,8 +138,13 @@ static inline filters_median_data_t *filters_median_data_create(
                                          size_t channels_to_process,
                                          size_t image_width,
                                          size_t image_height,
+                                         size_t bytes_per_pixel,
+                                         size_t plane_size,
+                                         size_t row_stride,
+                                         size_t radius,
                                          uint8_t *source_pixels,
                                          uint8_t *destination_pixels,
+                                         bmp_row_writer *row_writer,
                                          volatile ssize_t *channels_left,
                                          volatile bool *barrier_sense
                                      ) {
@@ -108,10 +163,20 @@ static inline filters_median_data_t *filters_median_data_create(
         image_width;
     data->image_height =
         image_height;
+    data->bytes_per_pixel =
+        bytes_per_pixel;
+    data->plane_size =
+        plane_size;
+    data->row_stride =
+        row_stride;
+    data->radius =
+        radius;
     data->source_pixels =
         source_pixels;
     data->destination_pixels =
         destination_pixels;
+    data->row_writer =
+        row_writer;
     data->channels_left =
         channels_left;
     data->barrier_sense =
@@ -129,6 +194,98 @@ static inline void filters_median_data_destroy(
     }
 }
 
+static inline filters_median_tiles_data_t *filters_median_tiles_data_create(
+                                               size_t first_tile,
+                                               size_t tiles_to_process,
+                                               size_t tile_columns,
+                                               size_t tile_size,
+                                               size_t image_width,
+                                               size_t image_height,
+                                               size_t bytes_per_pixel,
+                                               uint8_t *source_pixels,
+                                               uint8_t *destination_pixels,
+                                               volatile ssize_t *tiles_left,
+                                               volatile bool *barrier_sense
+                                           ) {
+    filters_median_tiles_data_t *data =
+        malloc(sizeof(*data));
+
+    if (NULL == data) {
+        return data;
+    }
+
+    data->first_tile =
+        first_tile;
+    data->tiles_to_process =
+        tiles_to_process;
+    data->tile_columns =
+        tile_columns;
+    data->tile_size =
+        tile_size;
+    data->image_width =
+        image_width;
+    data->image_height =
+        image_height;
+    data->bytes_per_pixel =
+        bytes_per_pixel;
+    data->source_pixels =
+        source_pixels;
+    data->destination_pixels =
+        destination_pixels;
+    data->tiles_left =
+        tiles_left;
+    data->barrier_sense =
+        barrier_sense;
+
+    return data;
+}
+
+static inline void filters_median_tiles_data_destroy(
+                       filters_median_tiles_data_t *data
+                   )
+{
+    if (NULL != data) {
+        free(data);
+    }
+}
+
+static inline filters_read_rows_data_t *filters_read_rows_data_create(
+                                            size_t linear_position,
+                                            size_t channels_to_process,
+                                            bmp_row_reader *row_reader,
+                                            volatile ssize_t *channels_left,
+                                            volatile bool *barrier_sense
+                                        ) {
+    filters_read_rows_data_t *data =
+        malloc(sizeof(*data));
+
+    if (NULL == data) {
+        return data;
+    }
+
+    data->linear_position =
+        linear_position;
+    data->channels_to_process =
+        channels_to_process;
+    data->row_reader =
+        row_reader;
+    data->channels_left =
+        channels_left;
+    data->barrier_sense =
+        barrier_sense;
+
+    return data;
+}
+
+static inline void filters_read_rows_data_destroy(
+                       filters_read_rows_data_t *data
+                   )
+{
+    if (NULL != data) {
+        free(data);
+    }
+}
+
 static void filters_brightness_contrast_processing_task(
                 void *task_data,
                 void (*result_callback)(void *result) __attribute__((unused))
@@ -149,21 +306,86 @@ static void filters_brightness_contrast_processing_task(
         data->brightness;
     float contrast =
         data->contrast;
-    size_t channels =
-        3;
-#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
-    size_t step =
-        16;
-#else
-    size_t step =
-        3;
-#endif
+    const uint8_t *lookup_table =
+        data->lookup_table;
+    size_t bytes_per_pixel =
+        data->bytes_per_pixel;
+    size_t plane_size =
+        data->plane_size;
+    size_t row_size =
+        data->row_size;
+    size_t row_stride =
+        data->row_stride;
+    uint8_t *source_pixels =
+        data->source_pixels;
+    bmp_row_reader *row_reader =
+        data->row_reader;
+    size_t read_end =
+        linear_position;
+    const filters_kernel_set *kernel_set =
+        filters_get_kernel_set();
 
-    for (; linear_position < end; linear_position += step) {
-        filters_apply_brightness_contrast(
-            pixels, linear_position,
-            brightness, contrast
-        );
+    // Positions count channels of packed rows. Padded rows are filtered one
+    // at a time with `pixels` moved past the padding of the rows above.
+    // Out of place, segments are cut into chunks copied right before use.
+    // With a `row_reader`, they are cut into chunks read from the source
+    // right before use as well.
+    while (linear_position < end) {
+        if (NULL != row_reader && linear_position >= read_end) {
+            read_end =
+                UTILS_MIN(end, linear_position + FILTERS_READ_CHUNK_SIZE);
+
+            bmp_read_rows(row_reader, linear_position, read_end - linear_position);
+        }
+
+        size_t row =
+            linear_position / row_size;
+        size_t segment_end =
+            row_stride == row_size ? end : UTILS_MIN(end, (row + 1) * row_size);
+        uint8_t *segment_pixels =
+            pixels + row * (row_stride - row_size);
+
+        if (NULL != row_reader) {
+            segment_end =
+                UTILS_MIN(segment_end, read_end);
+        }
+
+        if (NULL != source_pixels) {
+            segment_end =
+                UTILS_MIN(segment_end, linear_position + FILTERS_COPY_CHUNK_SIZE);
+
+            memcpy(
+                segment_pixels + linear_position,
+                source_pixels + row * (row_stride - row_size) + linear_position,
+                segment_end - linear_position
+            );
+        }
+
+        if (NULL != lookup_table) {
+            kernel_set->lookup(
+                segment_pixels,
+                linear_position, segment_end,
+                bytes_per_pixel,
+                plane_size,
+                lookup_table
+            );
+        } else {
+            kernel_set->brightness_contrast(
+                segment_pixels,
+                linear_position, segment_end,
+                bytes_per_pixel,
+                plane_size,
+                row_stride != row_size,
+                brightness, contrast,
+                data->fixed_point
+            );
+        }
+
+        linear_position = segment_end;
+    }
+
+    if (NULL != data->row_writer) {
+        bmp_write_finished_rows(data->row_writer, data->linear_position, channels_to_process);
     }
 
     ssize_t channels_left = __sync_sub_and_fetch(data->channels_left, (ssize_t) channels_to_process);
@@ -190,16 +412,67 @@ static void filters_sepia_processing_task(
         linear_position + channels_to_process;
     uint8_t *pixels =
         data->pixels;
-#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
-    size_t step =
-        3;
-#else
-    size_t step =
-        3;
-#endif
+    size_t bytes_per_pixel =
+        data->bytes_per_pixel;
+    size_t plane_size =
+        data->plane_size;
+    size_t row_size =
+        data->row_size;
+    size_t row_stride =
+        data->row_stride;
+    uint8_t *source_pixels =
+        data->source_pixels;
+    bmp_row_reader *row_reader =
+        data->row_reader;
+    size_t read_end =
+        linear_position;
+    const filters_kernel_set *kernel_set =
+        filters_get_kernel_set();
+
+    // Padded rows, read and copied chunks are handled like for brightness and contrast.
+    while (linear_position < end) {
+        if (NULL != row_reader && linear_position >= read_end) {
+            read_end =
+                UTILS_MIN(end, linear_position + FILTERS_READ_CHUNK_SIZE);
+
+            bmp_read_rows(row_reader, linear_position, read_end - linear_position);
+        }
+
+        size_t row =
+            linear_position / row_size;
+        size_t segment_end =
+            row_stride == row_size ? end : UTILS_MIN(end, (row + 1) * row_size);
+        uint8_t *segment_pixels =
+            pixels + row * (row_stride - row_size);
+
+        if (NULL != row_reader) {
+            segment_end =
+                UTILS_MIN(segment_end, read_end);
+        }
+
+        if (NULL != source_pixels) {
+            segment_end =
+                UTILS_MIN(segment_end, linear_position + FILTERS_COPY_CHUNK_SIZE);
 
-    for (; linear_position < end; linear_position += step) {
-        filters_apply_sepia(pixels, linear_position);
+            memcpy(
+                segment_pixels + linear_position,
+                source_pixels + row * (row_stride - row_size) + linear_position,
+                segment_end - linear_position
+            );
+        }
+
+        kernel_set->sepia(
+            segment_pixels,
+            linear_position, segment_end,
+            bytes_per_pixel,
+            plane_size
+        );
+
+        linear_position = segment_end;
+    }
+
+    if (NULL != data->row_writer) {
+        bmp_write_finished_rows(data->row_writer, data->linear_position, channels_to_process);
     }
 
     ssize_t channels_left = __sync_sub_and_fetch(data->channels_left, (ssize_t) channels_to_process);
@@ -232,22 +505,28 @@ static void filters_median_processing_task(
         data->source_pixels;
     uint8_t *destination_pixels =
         data->destination_pixels;
-    size_t step =
-        3;
-
-    for (; linear_position < end; linear_position += step) {
-        size_t x =
-            (linear_position / 3) % image_width;
-        size_t y =
-            (linear_position / 3) / image_width;
-
-        filters_apply_median(
-            source_pixels,
-            destination_pixels,
-            linear_position,
-            x, y,
-            image_width, image_height
-        );
+    size_t bytes_per_pixel =
+        data->bytes_per_pixel;
+    size_t plane_size =
+        data->plane_size;
+    size_t row_stride =
+        data->row_stride;
+    size_t radius =
+        data->radius;
+
+    filters_get_kernel_set()->median(
+        source_pixels,
+        destination_pixels,
+        linear_position, end,
+        image_width, image_height,
+        bytes_per_pixel,
+        plane_size,
+        row_stride,
+        radius
+    );
+
+    if (NULL != data->row_writer) {
+        bmp_write_finished_rows(data->row_writer, data->linear_position, channels_to_process);
     }
 
     ssize_t channels_left = __sync_sub_and_fetch(data->channels_left, (ssize_t) channels_to_process);
@@ -258,3 +537,564 @@ static void filters_median_processing_task(
     filters_median_data_destroy(data);
 }
 
+#if FILTERS_MEDIAN_DEFAULT_RADIUS > BMP_TILE_HALO
+#error "The median window does not fit into the halo of a tile"
+#endif
+
+static void filters_median_tiles_processing_task(
+                void *task_data,
+                void (*result_callback)(void *result) __attribute__((unused))
+            )
+{
+    filters_median_tiles_data_t *data =
+        task_data;
+
+    size_t tile_size =
+        data->tile_size;
+    size_t bytes_per_pixel =
+        data->bytes_per_pixel;
+    size_t end =
+        data->first_tile + data->tiles_to_process;
+    const filters_kernel_set *kernel_set =
+        filters_get_kernel_set();
+
+    // The parts of edge tiles past the image are skipped.
+    for (size_t tile = data->first_tile; tile < end; ++tile) {
+        size_t columns =
+            UTILS_MIN(data->image_width - tile % data->tile_columns * BMP_TILE_SIZE, (size_t) BMP_TILE_SIZE);
+        size_t rows =
+            UTILS_MIN(data->image_height - tile / data->tile_columns * BMP_TILE_SIZE, (size_t) BMP_TILE_SIZE);
+
+        kernel_set->median_tile(
+            data->source_pixels + tile * tile_size,
+            data->destination_pixels + tile * tile_size,
+            columns, rows,
+            bytes_per_pixel
+        );
+    }
+
+    ssize_t tiles_left = __sync_sub_and_fetch(data->tiles_left, (ssize_t) data->tiles_to_process);
+    if (0 >= tiles_left) {
+        __sync_lock_test_and_set(data->barrier_sense, true);
+    }
+
+    filters_median_tiles_data_destroy(data);
+}
+
+static void filters_read_rows_task(
+                void *task_data,
+                void (*result_callback)(void *result) __attribute__((unused))
+            )
+{
+    filters_read_rows_data_t *data =
+        task_data;
+
+    bmp_read_rows(data->row_reader, data->linear_position, data->channels_to_process);
+
+    ssize_t channels_left = __sync_sub_and_fetch(data->channels_left, (ssize_t) data->channels_to_process);
+    if (0 >= channels_left) {
+        __sync_lock_test_and_set(data->barrier_sense, true);
+    }
+
+    filters_read_rows_data_destroy(data);
+}
+
+
+/*
+    Splits `channels_count` channels starting at `first_channel` between the
+    workers of the pool and spins until all of them are done. Median reads
+    from `source_pixels` and writes into `pixels`, the other filters work on
+    `pixels` in place after copying them from `source_pixels` if it is a
+    different, non-planar buffer. Pixels are `bytes_per_pixel` (1, 3 or 4)
+    bytes wide.
+    Median takes windows `radius` pixels around every pixel.
+    For planar images `plane_size` is the distance between the channel planes
+    and positions count pixels of a plane instead of channels. Positions
+    count as if rows were packed, in memory they are `row_stride` bytes apart.
+    Pointwise filters read their positions through `row_reader` first unless
+    it is NULL, median expects `source_pixels` to be read already. Finished
+    positions are passed on to `row_writer` unless it is NULL.
+*/
+static void filters_process_channels(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                size_t first_channel,
+                size_t channels_count,
+                size_t image_width,
+                size_t image_height,
+                size_t bytes_per_pixel,
+                size_t plane_size,
+                size_t row_stride,
+                uint8_t *source_pixels,
+                uint8_t *pixels,
+                bmp_row_reader *row_reader,
+                bmp_row_writer *row_writer
+            )
+{
+    volatile ssize_t channels_left =
+        (ssize_t) channels_count;
+    volatile bool barrier_sense =
+        false;
+
+    if (0 == channels_count) {
+        return;
+    }
+
+    void (*task)(void *task_data, void (*result_callback)(void *result));
+    switch (filter_id) {
+        case FILTERS_BRIGHTNESS_CONTRAST_ID:
+            task =
+                filters_brightness_contrast_processing_task;
+            break;
+        case FILTERS_SEPIA_ID:
+            task =
+                filters_sepia_processing_task;
+            break;
+        case FILTERS_MEDIAN_ID:
+            task =
+                filters_median_processing_task;
+            break;
+        default:
+            return;
+    }
+
+    // Task boundaries have to fall on whole pixels and on whole vector
+    // steps of the kernels.
+    size_t channels_per_thread =
+        UTILS_MAX(channels_count / pool_size, 1);
+    size_t channels_per_step =
+        filters_get_kernel_set()->channels_per_step(bytes_per_pixel, plane_size);
+    channels_per_thread =
+        ((channels_per_thread - 1) / channels_per_step + 1) * channels_per_step;
+
+    size_t end =
+        first_channel + channels_count;
+    size_t row_size =
+        0 != plane_size ? image_width : image_width * bytes_per_pixel;
+
+    // Median windows past FILTERS_MEDIAN_SLIDING_RADIUS are built out of
+    // histograms of whole columns, every worker gets a band of whole rows to
+    // build them for once.
+    if (FILTERS_MEDIAN_ID == filter_id && radius > FILTERS_MEDIAN_SLIDING_RADIUS && 0 != row_size) {
+        size_t row_count =
+            UTILS_MAX(channels_count / row_size, 1);
+        channels_per_thread =
+            ((row_count - 1) / pool_size + 1) * row_size;
+    }
+
+    uint8_t *pointwise_source_pixels =
+        source_pixels != pixels ? source_pixels : NULL;
+
+    // Brightness and contrast are the same for every channel value wherever
+    // it is. Kernel sets faster with a table have the workers share one
+    // built up front.
+    uint8_t lookup_table[FILTERS_LOOKUP_TABLE_SIZE]
+        __attribute__((aligned(FILTERS_LOOKUP_TABLE_ALIGNMENT)));
+    bool use_lookup_table =
+        FILTERS_BRIGHTNESS_CONTRAST_ID == filter_id &&
+        filters_get_kernel_set()->prefers_lookup();
+    if (use_lookup_table) {
+        filters_build_brightness_contrast_table(lookup_table, brightness, contrast);
+    }
+    bool fixed_point =
+        FILTERS_BRIGHTNESS_CONTRAST_ID == filter_id && !use_lookup_table &&
+        filters_brightness_contrast_takes_fixed_point(brightness, contrast);
+
+    for (
+        size_t linear_position = first_channel;
+        linear_position < end;
+        linear_position += channels_per_thread
+    ) {
+        size_t channels_to_process =
+            linear_position + channels_per_thread > end ?
+                end - linear_position :
+                channels_per_thread;
+
+        void *task_data;
+        switch (filter_id) {
+            case FILTERS_BRIGHTNESS_CONTRAST_ID:
+                task_data =
+                    filters_brightness_contrast_data_create(
+                        linear_position,
+                        channels_to_process,
+                        bytes_per_pixel,
+                        plane_size,
+                        row_size, row_stride,
+                        row_reader,
+                        pointwise_source_pixels,
+                        pixels,
+                        brightness, contrast,
+                        fixed_point,
+                        use_lookup_table ? lookup_table : NULL,
+                        row_writer,
+                        &channels_left,
+                        &barrier_sense
+                    );
+                break;
+            case FILTERS_SEPIA_ID:
+                task_data =
+                    filters_sepia_data_create(
+                        linear_position,
+                        channels_to_process,
+                        bytes_per_pixel,
+                        plane_size,
+                        row_size, row_stride,
+                        row_reader,
+                        pointwise_source_pixels,
+                        pixels,
+                        row_writer,
+                        &channels_left,
+                        &barrier_sense
+                    );
+                break;
+            case FILTERS_MEDIAN_ID:
+                task_data =
+                    filters_median_data_create(
+                        linear_position,
+                        channels_to_process,
+                        image_width, image_height,
+                        bytes_per_pixel,
+                        plane_size,
+                        row_stride,
+                        radius,
+                        source_pixels,
+                        pixels,
+                        row_writer,
+                        &channels_left,
+                        &barrier_sense
+                    );
+                break;
+            default:
+                task_data =
+                    NULL;
+        }
+
+        if (NULL != task_data) {
+            threadpool_enqueue_task(
+                threadpool,
+                task,
+                task_data,
+                NULL
+            );
+        } else if (0 >= __sync_sub_and_fetch(&channels_left, (ssize_t) channels_to_process)) {
+            __sync_lock_test_and_set(&barrier_sense, true);
+        }
+    }
+
+    while (!barrier_sense) { }
+}
+
+/*
+    Reads the first `channels_count` channels of packed rows, `row_size`
+    channels each, through `row_reader` with one band of whole rows per
+    worker of the pool and spins until all of them are done.
+*/
+static void filters_read_rows(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                size_t channels_count,
+                size_t row_size,
+                bmp_row_reader *row_reader
+            )
+{
+    volatile ssize_t channels_left =
+        (ssize_t) channels_count;
+    volatile bool barrier_sense =
+        false;
+
+    if (0 == channels_count || 0 == row_size) {
+        return;
+    }
+
+    size_t row_count =
+        channels_count / row_size;
+    size_t channels_per_thread =
+        ((row_count - 1) / pool_size + 1) * row_size;
+
+    for (
+        size_t linear_position = 0;
+        linear_position < channels_count;
+        linear_position += channels_per_thread
+    ) {
+        size_t channels_to_process =
+            UTILS_MIN(channels_per_thread, channels_count - linear_position);
+
+        filters_read_rows_data_t *task_data =
+            filters_read_rows_data_create(
+                linear_position,
+                channels_to_process,
+                row_reader,
+                &channels_left,
+                &barrier_sense
+            );
+
+        if (NULL != task_data) {
+            threadpool_enqueue_task(
+                threadpool,
+                filters_read_rows_task,
+                task_data,
+                NULL
+            );
+        } else if (0 >= __sync_sub_and_fetch(&channels_left, (ssize_t) channels_to_process)) {
+            __sync_lock_test_and_set(&barrier_sense, true);
+        }
+    }
+
+    while (!barrier_sense) { }
+}
+
+/*
+    Splits the tiles of a tiled image between the workers of the pool and
+    spins until all of them are done. The median of every tile is taken from
+    `source_pixels` and written into `image->pixels`.
+*/
+static void filters_process_median_tiles(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                bmp_image *image,
+                uint8_t *source_pixels
+            )
+{
+    size_t tile_count =
+        image->tile_columns * image->tile_rows;
+
+    volatile ssize_t tiles_left =
+        (ssize_t) tile_count;
+    volatile bool barrier_sense =
+        false;
+
+    if (0 == tile_count) {
+        return;
+    }
+
+    size_t tiles_per_thread =
+        (tile_count - 1) / pool_size + 1;
+
+    for (size_t first_tile = 0; first_tile < tile_count; first_tile += tiles_per_thread) {
+        size_t tiles_to_process =
+            UTILS_MIN(tiles_per_thread, tile_count - first_tile);
+
+        filters_median_tiles_data_t *task_data =
+            filters_median_tiles_data_create(
+                first_tile,
+                tiles_to_process,
+                image->tile_columns, image->tile_size,
+                image->absolute_image_width, image->absolute_image_height,
+                image->bytes_per_pixel,
+                source_pixels,
+                image->pixels,
+                &tiles_left,
+                &barrier_sense
+            );
+
+        if (NULL != task_data) {
+            threadpool_enqueue_task(
+                threadpool,
+                filters_median_tiles_processing_task,
+                task_data,
+                NULL
+            );
+        } else if (0 >= __sync_sub_and_fetch(&tiles_left, (ssize_t) tiles_to_process)) {
+            __sync_lock_test_and_set(&barrier_sense, true);
+        }
+    }
+
+    while (!barrier_sense) { }
+}
+
+/*
+    Applies a pointwise filter to the BGRX entries of a color table. Indexed
+    images are filtered this way instead of pixel by pixel, so the cost does
+    not depend on the image size. Median is not pointwise and is ignored.
+*/
+static void filters_process_color_table(
+                int filter_id,
+                float brightness,
+                float contrast,
+                uint8_t *color_table,
+                size_t color_count
+            )
+{
+    size_t end =
+        color_count * 4;
+    uint8_t lookup_table[FILTERS_LOOKUP_TABLE_SIZE]
+        __attribute__((aligned(FILTERS_LOOKUP_TABLE_ALIGNMENT)));
+
+    switch (filter_id) {
+        case FILTERS_BRIGHTNESS_CONTRAST_ID:
+            filters_build_brightness_contrast_table(lookup_table, brightness, contrast);
+            filters_get_kernel_set()->lookup(
+                color_table,
+                0, end,
+                4, 0,
+                lookup_table
+            );
+            break;
+        case FILTERS_SEPIA_ID:
+            filters_get_kernel_set()->sepia(
+                color_table,
+                0, end,
+                4, 0
+            );
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+    Has to be called after the headers of an indexed image are read and before
+    its pixels are. Pointwise filters are applied to the color table right
+    away and leave the pixels alone. Grayscale indices are median filtered as
+    they are, other indices are expanded into colors first. Returns the filter
+    that still has to run over the pixels, -1 for none.
+*/
+static int filters_prepare_indexed_image(
+               bmp_image *image,
+               int filter_id,
+               float brightness,
+               float contrast
+           )
+{
+    if (NULL == image->color_table) {
+        // Gray pixels without a color table turn into colors with sepia.
+        if (FILTERS_SEPIA_ID == filter_id && 1 == image->bytes_per_pixel) {
+            image->bytes_per_pixel =
+                3;
+        }
+
+        return filter_id;
+    }
+
+    if (FILTERS_MEDIAN_ID != filter_id) {
+        filters_process_color_table(
+            filter_id,
+            brightness, contrast,
+            image->color_table,
+            image->color_count
+        );
+
+        return -1;
+    }
+
+    if (!bmp_is_grayscale(image)) {
+        image->bytes_per_pixel =
+            3;
+    }
+
+    return filter_id;
+}
+
+/*
+    Runs a filter over all pixels of an image read into memory. Median works
+    on a copy of the original pixels. With `destination_pixels`, the results
+    go there instead, laid out like `image->pixels`, which stay untouched.
+    Tiled images are always filtered in their own buffer, with median windows
+    no larger than the halo of their tiles.
+    With a `row_reader`, the pixels have not been read yet. Workers of
+    pointwise filters read the rows they filter themselves, median has all
+    rows read in parallel bands before it starts.
+    With a `row_writer`, every worker writes the rows it finished to the
+    destination itself.
+*/
+static void filters_process_image(
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                bmp_image *image,
+                uint8_t *destination_pixels,
+                bmp_row_reader *row_reader,
+                bmp_row_writer *row_writer,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+
+    if (image->tiled && FILTERS_MEDIAN_ID == filter_id && radius > BMP_TILE_HALO) {
+        *error_message = Filters_Error_Radius_Exceeds_Tile_Halo;
+
+        return;
+    }
+
+    if (NULL != row_reader && FILTERS_MEDIAN_ID == filter_id) {
+        filters_read_rows(
+            threadpool,
+            pool_size,
+            width * height * image->bytes_per_pixel,
+            width * image->bytes_per_pixel,
+            row_reader
+        );
+
+        row_reader =
+            NULL;
+    }
+
+    uint8_t *original_pixels =
+        NULL;
+    if (NULL != destination_pixels) {
+        original_pixels =
+            image->pixels;
+    } else if (FILTERS_MEDIAN_ID == filter_id) {
+        original_pixels = (uint8_t *) image_buffer_allocate(image->aligned_image_size, true);
+        if (NULL == original_pixels) {
+            *error_message = Filters_Error_Not_Enough_Memory_to_Duplicate;
+
+            return;
+        }
+
+        memcpy(original_pixels, image->pixels, image->aligned_image_size);
+    }
+
+    if (image->tiled && FILTERS_MEDIAN_ID == filter_id) {
+        filters_process_median_tiles(
+            threadpool,
+            pool_size,
+            image,
+            original_pixels
+        );
+
+        image_buffer_free(original_pixels);
+
+        return;
+    }
+
+    // Pointwise filters run over tiles with their halos as over one long row.
+    size_t channels_count =
+        image->tiled ?
+            image->tile_columns * image->tile_rows * image->tile_size :
+        image->planar ?
+            width * height :
+            width * height * image->bytes_per_pixel;
+
+    filters_process_channels(
+        threadpool,
+        pool_size,
+        filter_id,
+        brightness, contrast,
+        radius,
+        0, channels_count,
+        width, height,
+        image->bytes_per_pixel, image->plane_size,
+        image->row_stride,
+        original_pixels,
+        NULL != destination_pixels ? destination_pixels : image->pixels,
+        row_reader,
+        row_writer
+    );
+
+    if (NULL != original_pixels && NULL == destination_pixels) {
+        image_buffer_free(original_pixels);
+    }
+}
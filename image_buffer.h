@@ -0,0 +1,32 @@
+#ifndef IMAGE_BUFFER_H
+#define IMAGE_BUFFER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define IMAGE_BUFFER_ALIGNMENT 64
+#define IMAGE_BUFFER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/*
+    Image buffers of at least one huge page are mapped on 2 MB pages, explicit
+    huge pages first and transparent ones otherwise. Smaller buffers come from
+    the heap. Every buffer is aligned on IMAGE_BUFFER_ALIGNMENT bytes and
+    preceded by a header, so it has to be released with `image_buffer_free`.
+*/
+typedef struct _image_buffer_header
+{
+    void *mapping;                  /* the start of the mapping or heap block the buffer lives in */
+    size_t mapping_size;            /* 0 for heap blocks                                           */
+} __attribute__((aligned(IMAGE_BUFFER_ALIGNMENT))) image_buffer_header;
+
+static void *image_buffer_allocate(size_t size, bool prefault);
+
+static void image_buffer_free(void *buffer);
+
+static bool image_buffer_is_mapped(const void *buffer);
+
+static size_t image_buffer_query_page_size(const void *address);
+
+#include "image_buffer.impl.h.c"
+
+#endif /* IMAGE_BUFFER_H */
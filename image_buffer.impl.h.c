@@ -0,0 +1,206 @@
+#include "image_buffer.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+static inline size_t _image_buffer_round_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static void _image_buffer_prefault(uint8_t *mapping, size_t mapping_size)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (0 == madvise(mapping, mapping_size, MADV_POPULATE_WRITE)) {
+        return;
+    }
+#endif
+
+    size_t page_size =
+        (size_t) sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < mapping_size; offset += page_size) {
+        ((volatile uint8_t *) mapping)[offset] = 0;
+    }
+}
+
+/* Maps transparent huge pages on a 2 MB boundary, so the whole buffer can be backed by them. */
+static uint8_t *_image_buffer_map_transparent(size_t mapping_size)
+{
+    size_t reservation_size =
+        mapping_size + IMAGE_BUFFER_HUGE_PAGE_SIZE;
+
+    uint8_t *reservation =
+        (uint8_t *) mmap(
+                        NULL, reservation_size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1, 0
+                    );
+    if (MAP_FAILED == reservation) {
+        return NULL;
+    }
+
+    uint8_t *mapping =
+        (uint8_t *) _image_buffer_round_up((size_t) reservation, IMAGE_BUFFER_HUGE_PAGE_SIZE);
+    size_t head_size =
+        (size_t) (mapping - reservation);
+    size_t tail_size =
+        reservation_size - head_size - mapping_size;
+    if (0 < head_size) {
+        munmap(reservation, head_size);
+    }
+    if (0 < tail_size) {
+        munmap(mapping + mapping_size, tail_size);
+    }
+
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, mapping_size, MADV_HUGEPAGE);
+#endif
+
+    return mapping;
+}
+
+/*
+    Allocates `size` bytes for pixels. With `prefault`, every page is faulted in
+    right away, so the filters do not pay for the page faults later.
+*/
+static void *image_buffer_allocate(size_t size, bool prefault)
+{
+    size_t header_size =
+        sizeof(image_buffer_header);
+
+    uint8_t *mapping =
+        NULL;
+    size_t mapping_size =
+        0;
+
+    if (size + header_size >= IMAGE_BUFFER_HUGE_PAGE_SIZE) {
+        mapping_size =
+            _image_buffer_round_up(size + header_size, IMAGE_BUFFER_HUGE_PAGE_SIZE);
+
+        mapping =
+            (uint8_t *) mmap(
+                            NULL, mapping_size,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB |
+                                (prefault ? MAP_POPULATE : 0),
+                            -1, 0
+                        );
+        if (MAP_FAILED == mapping) {
+            mapping =
+                _image_buffer_map_transparent(mapping_size);
+            if (NULL != mapping && prefault) {
+                _image_buffer_prefault(mapping, mapping_size);
+            }
+        }
+    }
+
+    if (NULL == mapping) {
+        mapping_size =
+            0;
+
+        mapping =
+            (uint8_t *) aligned_alloc(
+                            IMAGE_BUFFER_ALIGNMENT,
+                            _image_buffer_round_up(size, IMAGE_BUFFER_ALIGNMENT) + header_size
+                        );
+        if (NULL == mapping) {
+            return NULL;
+        }
+    }
+
+    image_buffer_header *header =
+        (image_buffer_header *) mapping;
+    header->mapping =
+        mapping;
+    header->mapping_size =
+        mapping_size;
+
+    return mapping + header_size;
+}
+
+static void image_buffer_free(void *buffer)
+{
+    if (NULL == buffer) {
+        return;
+    }
+
+    image_buffer_header *header =
+        (image_buffer_header *) buffer - 1;
+
+    if (0 < header->mapping_size) {
+        munmap(header->mapping, header->mapping_size);
+    } else {
+        free(header->mapping);
+    }
+}
+
+/* Tells whether a buffer lives in a mapping of its own instead of on the heap. */
+static bool image_buffer_is_mapped(const void *buffer)
+{
+    const image_buffer_header *header =
+        (const image_buffer_header *) buffer - 1;
+
+    return 0 < header->mapping_size;
+}
+
+/*
+    Looks up the mapping containing `address` in /proc/self/smaps. Transparent
+    huge pages show up as AnonHugePages of a mapping with base pages, explicit
+    ones in KernelPageSize. Falls back to the base page size.
+*/
+static size_t image_buffer_query_page_size(const void *address)
+{
+    size_t page_size =
+        (size_t) sysconf(_SC_PAGESIZE);
+
+    FILE *smaps =
+        fopen("/proc/self/smaps", "r");
+    if (NULL == smaps) {
+        return page_size;
+    }
+
+    unsigned long target =
+        (unsigned long) (uintptr_t) address;
+    bool in_mapping =
+        false;
+
+    char line[256];
+    while (NULL != fgets(line, sizeof(line), smaps)) {
+        unsigned long start, end;
+        size_t kilobytes;
+
+        if (2 == sscanf(line, "%lx-%lx ", &start, &end)) {
+            if (in_mapping) {
+                break;
+            }
+            in_mapping =
+                start <= target && target < end;
+        } else if (!in_mapping) {
+            continue;
+        } else if (1 == sscanf(line, "KernelPageSize: %zu kB", &kilobytes)) {
+            page_size =
+                UTILS_MAX(page_size, kilobytes * 1024);
+        } else if (1 == sscanf(line, "AnonHugePages: %zu kB", &kilobytes) && 0 < kilobytes) {
+            page_size =
+                UTILS_MAX(page_size, (size_t) IMAGE_BUFFER_HUGE_PAGE_SIZE);
+        }
+    }
+
+    fclose(smaps);
+
+    return page_size;
+}
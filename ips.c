@@ -4,18 +4,64 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "bmp.h"
+#include "pnm.h"
 #include "utils.h"
 #include "threadpool.h"
 #include "filters_threading.h"
+#include "streaming.h"
+#include "batch.h"
+#include "image_buffer.h"
 #include "profiler.h"
 
 static const char IPS_Usage[] =
-                    "Usage: ips "                                                       \
-                        "<filter name (brightness-contrast | sepia | median)> "         \
-                        "[<brightness> <contrast> for brightness and contrast filter] " \
-                        "<source bitmap image file> <destination bitmap image file>",
+                    "Usage: ips "                                                               \
+                        "[--mmap | --stream[=<memory budget in MiB>] | --uring] "               \
+                        "[--direct | --mmap-output] "                                           \
+                        "[--widen | --planar | --tiled] "                                       \
+                        "[--roi=<x>,<y>,<width>,<height>] "                                     \
+                        "[--kernel=<kernel set (c | x87 | sse4.1 | avx2 | avx512)>] "           \
+                        "(--batch=<job list file, jobs sharing a file run in list order> | "    \
+                        "<filter name (brightness-contrast | sepia | median)> "                 \
+                        "[<brightness> <contrast> for brightness and contrast filter] "         \
+                        "[--radius=<window radius (1 - 127)> for median filter] "               \
+                        "<source image file (BMP, PGM, PPM or PAM), directory or - for stdin> " \
+                        "<destination image file, directory or - for stdout>)",
+                  IPS_Memory_Map_Option[] =
+                    "--mmap",
+                  IPS_Stream_Option[] =
+                    "--stream",
+                  IPS_Widen_Option[] =
+                    "--widen",
+                  IPS_Planar_Option[] =
+                    "--planar",
+                  IPS_Tiled_Option[] =
+                    "--tiled",
+                  IPS_Uring_Option[] =
+                    "--uring",
+                  IPS_Direct_Option[] =
+                    "--direct",
+                  IPS_Map_Output_Option[] =
+                    "--mmap-output",
+                  IPS_Region_Option[] =
+                    "--roi=",
+                  IPS_Kernel_Option[] =
+                    "--kernel=",
+                  IPS_Batch_Option[] =
+                    "--batch=",
+                  IPS_Radius_Option[] =
+                    "--radius=",
+                  IPS_Automatic_Kernel_Set_Name[] =
+                    "auto",
+                  IPS_Standard_Stream_Name[] =
+                    "-",
+                  IPS_Job_Separators[] =
+                    " \t\r\n",
                   IPS_Brightness_Contrast_Filter_Name[] =
                     "brightness-contrast",
                   IPS_Sepia_Filter_Name[] =
@@ -32,8 +78,293 @@ static const char IPS_Usage[] =
                     "Error processing the image",
                   IPS_Error_Failed_to_Create_Threadpool[] =
                     "Error trying to create a threadpool",
-                  IPS_Error_Failed_to_Duplicate_the_Image[] =
-                    "Error duplicating the image";
+                  IPS_Error_Failed_to_Read_Job_List[] =
+                    "Failed to read the job list",
+                  IPS_Error_Illegal_Job[] =
+                    "Illegal job",
+                  IPS_Error_Failed_to_Process_Batch[] =
+                    "Error processing the batch",
+                  IPS_Error_Failed_to_Stream_Color_Indices[] =
+                    "The median of a color indexed image needs the whole image, it can not be streamed",
+                  IPS_Error_Failed_to_Stream_PNM_Image[] =
+                    "Only bitmap images can be streamed",
+                  IPS_Error_Failed_to_Crop_PNM_Image[] =
+                    "Only regions of bitmap images can be processed",
+                  IPS_Error_Failed_to_Select_Kernel_Set[] =
+                    "Failed to select the kernels",
+                  IPS_Error_Invalid_Region[] =
+                    "Invalid --roi, it takes four unsigned decimal numbers";
+
+/*
+    Parses the `<x>,<y>,<width>,<height>` of `--roi=`. Signs, empty fields
+    and anything after the last field are rejected.
+*/
+static bool ips_parse_region(
+                const char *value,
+                bmp_region *region
+            )
+{
+    size_t *fields[] = {
+        &region->x, &region->y, &region->width, &region->height
+    };
+
+    for (size_t i = 0; i < UTILS_COUNT_OF(fields); ++i) {
+        if (0 < i) {
+            if (',' != *value) {
+                return false;
+            }
+            ++value;
+        }
+
+        if (!isdigit((unsigned char) *value)) {
+            return false;
+        }
+
+        char *value_end;
+        errno = 0;
+        unsigned long long field =
+            strtoull(value, &value_end, 10);
+        if (0 != errno || SIZE_MAX < field) {
+            return false;
+        }
+
+        *fields[i] =
+            (size_t) field;
+        value =
+            value_end;
+    }
+
+    return '\0' == *value;
+}
+
+/*
+    Parses a job given as `<filter name> [<brightness> <contrast>]
+    [--radius=<radius>] <source> <destination>`, the same way on the command
+    line and in job lists.
+*/
+static bool ips_parse_job(
+                int argc,
+                char *argv[],
+                int *filter_id,
+                float *brightness,
+                float *contrast,
+                size_t *radius,
+                char **source_file_name,
+                char **destination_file_name
+            )
+{
+    if (3 > argc) {
+        return false;
+    }
+
+    if (0 == strncmp(
+            argv[0],
+            IPS_Brightness_Contrast_Filter_Name,
+            UTILS_COUNT_OF(IPS_Brightness_Contrast_Filter_Name)
+        )) {
+        if (5 > argc) {
+            return false;
+        }
+
+        *filter_id =
+            FILTERS_BRIGHTNESS_CONTRAST_ID;
+        *brightness =
+            strtof(argv[1], NULL);
+        *contrast =
+            strtof(argv[2], NULL);
+        *source_file_name =
+            argv[3];
+        *destination_file_name =
+            argv[4];
+    } else if (0 == strncmp(
+                        argv[0],
+                        IPS_Sepia_Filter_Name,
+                        UTILS_COUNT_OF(IPS_Sepia_Filter_Name)
+                    )) {
+        *filter_id =
+            FILTERS_SEPIA_ID;
+        *source_file_name =
+            argv[1];
+        *destination_file_name =
+            argv[2];
+    } else if (0 == strncmp(
+                        argv[0],
+                        IPS_Median_Filter_Name,
+                        UTILS_COUNT_OF(IPS_Median_Filter_Name)
+                    )) {
+        *filter_id =
+            FILTERS_MEDIAN_ID;
+
+        if (0 == strncmp(argv[1], IPS_Radius_Option, UTILS_COUNT_OF(IPS_Radius_Option) - 1)) {
+            const char *value =
+                &argv[1][UTILS_COUNT_OF(IPS_Radius_Option) - 1];
+            char *value_end;
+            unsigned long parsed_radius =
+                strtoul(value, &value_end, 10);
+            if (4 > argc || '\0' == *value || '\0' != *value_end ||
+                1 > parsed_radius || FILTERS_MEDIAN_MAX_RADIUS < parsed_radius) {
+                return false;
+            }
+
+            *radius =
+                (size_t) parsed_radius;
+
+            ++argv;
+        }
+
+        *source_file_name =
+            argv[1];
+        *destination_file_name =
+            argv[2];
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+/*
+    Reads a job list with one job per line. Empty lines and lines starting
+    with `#` are skipped. Names can not contain whitespace.
+*/
+static bool ips_read_job_list(
+                const char *job_list_file_name,
+                batch_job_t **jobs,
+                size_t *job_count
+            )
+{
+    bool result =
+        false;
+
+    size_t job_capacity =
+        0;
+
+    char *line =
+        NULL;
+    size_t line_capacity =
+        0;
+    size_t line_number =
+        0;
+
+    *jobs = NULL;
+    *job_count = 0;
+
+    FILE *job_list_descriptor =
+        fopen(job_list_file_name, "r");
+    if (NULL == job_list_descriptor) {
+        fprintf(
+            stderr,
+            "%s '%s'\n",
+            IPS_Error_Failed_to_Read_Job_List,
+            job_list_file_name
+        );
+
+        goto cleanup;
+    }
+
+    while (-1 != getline(&line, &line_capacity, job_list_descriptor)) {
+        ++line_number;
+
+        char *arguments[5];
+        int argument_count =
+            0;
+        for (char *token = strtok(line, IPS_Job_Separators);
+             NULL != token;
+             token = strtok(NULL, IPS_Job_Separators)) {
+            if (UTILS_COUNT_OF(arguments) == argument_count) {
+                ++argument_count;
+
+                break;
+            }
+            arguments[argument_count++] = token;
+        }
+
+        if (0 == argument_count || '#' == arguments[0][0]) {
+            continue;
+        }
+
+        int filter_id;
+        float brightness =
+            0.0f;
+        float contrast =
+            0.0f;
+        size_t radius =
+            FILTERS_MEDIAN_DEFAULT_RADIUS;
+        char *source_file_name;
+        char *destination_file_name;
+        if (UTILS_COUNT_OF(arguments) < argument_count ||
+            !ips_parse_job(
+                argument_count, arguments,
+                &filter_id,
+                &brightness, &contrast,
+                &radius,
+                &source_file_name,
+                &destination_file_name
+            )) {
+            fprintf(
+                stderr,
+                "%s '%s:%zu'\n",
+                IPS_Error_Illegal_Job,
+                job_list_file_name,
+                line_number
+            );
+
+            goto cleanup;
+        }
+
+        if (!batch_add_job(
+                jobs, job_count, &job_capacity,
+                filter_id,
+                brightness, contrast,
+                radius,
+                source_file_name,
+                destination_file_name
+            )) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Read_Job_List,
+                job_list_file_name,
+                Batch_Error_Not_Enough_Memory
+            );
+
+            goto cleanup;
+        }
+    }
+
+    result =
+        true;
+
+cleanup:
+    if (!result) {
+        batch_destroy_jobs(*jobs, *job_count);
+        *jobs = NULL;
+        *job_count = 0;
+    }
+
+    free(line);
+
+    if (NULL != job_list_descriptor) {
+        fclose(job_list_descriptor);
+    }
+
+    return result;
+}
+
+/* Tells whether `file_name` names the file already open as `file_descriptor`. */
+static bool ips_is_same_file(
+                FILE *file_descriptor,
+                const char *file_name
+            )
+{
+    struct stat file_status, named_file_status;
+
+    return 0 == fstat(fileno(file_descriptor), &file_status) &&
+           0 == stat(file_name, &named_file_status) &&
+           file_status.st_dev == named_file_status.st_dev &&
+           file_status.st_ino == named_file_status.st_ino;
+}
 
 int main(int argc, char *argv[])
 {
@@ -42,8 +373,6 @@ int main(int argc, char *argv[])
 
     int filter_id =
         -1;
-    void (*task)(void *task_data, void (*result_callback)(void *result)) =
-        NULL;
 
     char *source_file_name =
         NULL;
@@ -54,8 +383,141 @@ int main(int argc, char *argv[])
         0.0f;
     float contrast =
         0.0f;
+    size_t radius =
+        FILTERS_MEDIAN_DEFAULT_RADIUS;
 
-    if (3 > argc) {
+    bool map_source =
+        false;
+    bool stream_image =
+        false;
+    size_t memory_budget =
+        STREAMING_DEFAULT_MEMORY_BUDGET;
+    bool widen_pixels =
+        false;
+    bool planar_pixels =
+        false;
+    bool tiled_pixels =
+        false;
+    bool use_uring =
+        false;
+    bool direct_output =
+        false;
+    bool map_destination =
+        false;
+    bool use_region =
+        false;
+    bmp_region region =
+        { 0, 0, 0, 0 };
+    char *kernel_set_name =
+        NULL;
+    char *job_list_file_name =
+        NULL;
+
+    bool batch_mode =
+        false;
+    batch_job_t *jobs =
+        NULL;
+    size_t job_count =
+        0;
+
+    int option_count =
+        0;
+    while (1 + option_count < argc && 0 == strncmp(argv[1 + option_count], "--", 2)) {
+        char *option =
+            argv[1 + option_count];
+
+        if (0 == strcmp(option, IPS_Memory_Map_Option)) {
+            map_source =
+                true;
+        } else if (0 == strncmp(option, IPS_Stream_Option, UTILS_COUNT_OF(IPS_Stream_Option) - 1) &&
+                   ('\0' == option[UTILS_COUNT_OF(IPS_Stream_Option) - 1] ||
+                    '='  == option[UTILS_COUNT_OF(IPS_Stream_Option) - 1])) {
+            stream_image =
+                true;
+            if ('=' == option[UTILS_COUNT_OF(IPS_Stream_Option) - 1]) {
+                // The budget is a positive number of MiB, nothing else.
+                const char *value =
+                    &option[UTILS_COUNT_OF(IPS_Stream_Option)];
+                char *value_end;
+                errno = 0;
+                unsigned long long mebibytes =
+                    strtoull(value, &value_end, 10);
+                if (!isdigit((unsigned char) *value) || '\0' != *value_end || 0 != errno ||
+                    0 == mebibytes || SIZE_MAX / (1024 * 1024) < mebibytes) {
+                    fprintf(
+                        stderr,
+                        "%s\n"
+                        "\t%s\n",
+                        IPS_Error_Illegal_Parameters, IPS_Usage
+                    );
+
+                    return result;
+                }
+
+                memory_budget =
+                    (size_t) mebibytes * 1024 * 1024;
+            }
+        } else if (0 == strcmp(option, IPS_Widen_Option)) {
+            widen_pixels =
+                true;
+        } else if (0 == strcmp(option, IPS_Planar_Option)) {
+            planar_pixels =
+                true;
+        } else if (0 == strcmp(option, IPS_Tiled_Option)) {
+            tiled_pixels =
+                true;
+        } else if (0 == strcmp(option, IPS_Uring_Option)) {
+            use_uring =
+                true;
+        } else if (0 == strcmp(option, IPS_Direct_Option)) {
+            direct_output =
+                true;
+        } else if (0 == strcmp(option, IPS_Map_Output_Option)) {
+            map_destination =
+                true;
+        } else if (0 == strncmp(option, IPS_Region_Option, UTILS_COUNT_OF(IPS_Region_Option) - 1)) {
+            use_region =
+                ips_parse_region(&option[UTILS_COUNT_OF(IPS_Region_Option) - 1], &region);
+            if (!use_region) {
+                fprintf(
+                    stderr,
+                    "%s '%s'\n"
+                    "\t%s\n",
+                    IPS_Error_Invalid_Region, option, IPS_Usage
+                );
+
+                return result;
+            }
+        } else if (0 == strncmp(option, IPS_Kernel_Option, UTILS_COUNT_OF(IPS_Kernel_Option) - 1)) {
+            kernel_set_name =
+                &option[UTILS_COUNT_OF(IPS_Kernel_Option) - 1];
+        } else if (0 == strncmp(option, IPS_Batch_Option, UTILS_COUNT_OF(IPS_Batch_Option) - 1)) {
+            job_list_file_name =
+                &option[UTILS_COUNT_OF(IPS_Batch_Option) - 1];
+        } else {
+            fprintf(
+                stderr,
+                "%s\n"
+                "\t%s\n",
+                IPS_Error_Illegal_Parameters, IPS_Usage
+            );
+
+            return result;
+        }
+
+        ++option_count;
+    }
+    // Streamed bands are filtered in the file's pixel format, batches are read whole.
+    // Only single images read whole write their rows directly or into a mapping.
+    // Regions are read with seeks and cropped in the file's layout after filtering.
+    if ((stream_image && (widen_pixels || planar_pixels || tiled_pixels || NULL != job_list_file_name || use_uring)) ||
+        ((direct_output || map_destination) && (stream_image || use_uring || NULL != job_list_file_name)) ||
+        (direct_output && map_destination) ||
+        (map_source && use_uring) ||
+        (use_region && (stream_image || use_uring || NULL != job_list_file_name || map_source ||
+                        direct_output || map_destination || planar_pixels || tiled_pixels)) ||
+        (widen_pixels && planar_pixels) ||
+        (tiled_pixels && (widen_pixels || planar_pixels))) {
         fprintf(
             stderr,
             "%s\n"
@@ -65,13 +527,27 @@ int main(int argc, char *argv[])
 
         return result;
     }
+    argc -= option_count;
+    argv += option_count;
 
-    if (0 == strncmp(
-            argv[1],
-            IPS_Brightness_Contrast_Filter_Name,
-            UTILS_COUNT_OF(IPS_Brightness_Contrast_Filter_Name)
-        )) {
-        if (6 > argc) {
+    // Without `--kernel=`, the best kernels the processor supports are taken.
+    const char *kernel_set_error_message;
+    filters_select_kernel_set(kernel_set_name, &kernel_set_error_message);
+    if (NULL != kernel_set_error_message) {
+        fprintf(
+            stderr,
+            "%s '%s':\n"
+            "\t%s\n",
+            IPS_Error_Failed_to_Select_Kernel_Set,
+            NULL != kernel_set_name ? kernel_set_name : IPS_Automatic_Kernel_Set_Name,
+            kernel_set_error_message
+        );
+
+        return result;
+    }
+
+    if (NULL != job_list_file_name) {
+        if (1 != argc) {
             fprintf(
                 stderr,
                 "%s\n"
@@ -82,51 +558,181 @@ int main(int argc, char *argv[])
             return result;
         }
 
-        filter_id =
-            FILTERS_BRIGHTNESS_CONTRAST_ID;
-        task =
-            filters_brightness_contrast_processing_task;
-        brightness =
-            strtof(argv[2], NULL);
-        contrast =
-            strtof(argv[3], NULL);
-        source_file_name =
-            argv[4];
-        destination_file_name =
-            argv[5];
-    } else if (0 == strncmp(
-                        argv[1],
-                        IPS_Sepia_Filter_Name,
-                        UTILS_COUNT_OF(IPS_Sepia_Filter_Name)
-                    )) {
-        filter_id =
-            FILTERS_SEPIA_ID;
-        task =
-            filters_sepia_processing_task;
-        source_file_name =
-            argv[2];
-        destination_file_name =
-            argv[3];
-    } else if (0 == strncmp(
-                        argv[1],
-                        IPS_Median_Filter_Name,
-                        UTILS_COUNT_OF(IPS_Median_Filter_Name)
-                    )) {
-        filter_id =
-            FILTERS_MEDIAN_ID;
-        task =
-            filters_median_processing_task;
-        source_file_name =
-            argv[2];
-        destination_file_name =
-            argv[3];
+        if (!ips_read_job_list(job_list_file_name, &jobs, &job_count)) {
+            return result;
+        }
+        batch_mode =
+            true;
     } else {
-        fprintf(
-            stderr,
-            "%s\n"
-            "\t%s\n",
-            IPS_Error_Illegal_Parameters, IPS_Usage
-        );
+        if (!ips_parse_job(
+                argc - 1, &argv[1],
+                &filter_id,
+                &brightness, &contrast,
+                &radius,
+                &source_file_name,
+                &destination_file_name
+            )) {
+            fprintf(
+                stderr,
+                "%s\n"
+                "\t%s\n",
+                IPS_Error_Illegal_Parameters, IPS_Usage
+            );
+
+            return result;
+        }
+
+        // The standard streams have no paths the io_uring stages could open.
+        bool standard_streams =
+            0 == strcmp(source_file_name, IPS_Standard_Stream_Name) ||
+            0 == strcmp(destination_file_name, IPS_Standard_Stream_Name);
+        if (standard_streams && use_uring) {
+            fprintf(
+                stderr,
+                "%s\n"
+                "\t%s\n",
+                IPS_Error_Illegal_Parameters, IPS_Usage
+            );
+
+            return result;
+        }
+
+        struct stat source_status;
+        if (!standard_streams &&
+            0 == stat(source_file_name, &source_status) && S_ISDIR(source_status.st_mode)) {
+            if (stream_image || direct_output || map_destination || use_region) {
+                fprintf(
+                    stderr,
+                    "%s\n"
+                    "\t%s\n",
+                    IPS_Error_Illegal_Parameters, IPS_Usage
+                );
+
+                return result;
+            }
+
+            const char *error_message;
+            batch_list_directory(
+                source_file_name,
+                destination_file_name,
+                filter_id,
+                brightness, contrast,
+                radius,
+                &jobs, &job_count,
+                &error_message
+            );
+            if (NULL != error_message) {
+                fprintf(
+                    stderr,
+                    "%s '%s':\n"
+                    "\t%s\n",
+                    IPS_Error_Failed_to_Process_Batch,
+                    source_file_name,
+                    error_message
+                );
+
+                return result;
+            }
+            batch_mode =
+                true;
+        } else if (use_uring) {
+            /* io_uring I/O lives in the batch stages, a single image is a batch of one. */
+            size_t job_capacity =
+                0;
+            if (!batch_add_job(
+                    &jobs, &job_count, &job_capacity,
+                    filter_id,
+                    brightness, contrast,
+                    radius,
+                    source_file_name,
+                    destination_file_name
+                )) {
+                fprintf(
+                    stderr,
+                    "%s:\n"
+                    "\t%s\n",
+                    IPS_Error_Failed_to_Process_Batch,
+                    Batch_Error_Not_Enough_Memory
+                );
+
+                return result;
+            }
+            batch_mode =
+                true;
+        }
+    }
+
+    /*
+        Batches reuse one threadpool for all images. A reader thread prefetches
+        the next images and a writer thread stores the filtered ones, with
+        many reads and writes in flight at once when io_uring is used.
+    */
+    if (batch_mode) {
+        size_t pool_size = utils_get_number_of_cpu_cores() * 2;
+        threadpool_t *threadpool = threadpool_create(pool_size);
+        if (NULL == threadpool) {
+            fprintf(
+                stderr,
+                "%s.\n",
+                IPS_Error_Failed_to_Create_Threadpool
+            );
+
+            batch_destroy_jobs(jobs, job_count);
+
+            return result;
+        }
+
+        batch_options_t options = {
+            .map_source    = map_source,
+            .widen_pixels  = widen_pixels,
+            .planar_pixels = planar_pixels,
+            .tiled_pixels  = tiled_pixels,
+            .use_uring     = use_uring
+        };
+
+        const char *error_message;
+        size_t failed_job_count;
+
+PROFILER_START(1)
+        failed_job_count =
+            batch_process_jobs(
+                jobs, job_count,
+                &options,
+                threadpool,
+                pool_size,
+                &error_message
+            );
+PROFILER_STOP();
+
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s:\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Batch,
+                error_message
+            );
+        } else {
+            for (size_t i = 0; i < job_count; ++i) {
+                if (NULL != jobs[i].error_message) {
+                    fprintf(
+                        stderr,
+                        "%s '%s':\n"
+                        "\t%s\n",
+                        IPS_Error_Failed_to_Process_Image,
+                        jobs[i].error_file_name,
+                        jobs[i].error_message
+                    );
+                }
+            }
+
+            if (0 == failed_job_count) {
+                result =
+                    EXIT_SUCCESS;
+            }
+        }
+
+        batch_destroy_jobs(jobs, job_count);
 
         return result;
     }
@@ -134,12 +740,26 @@ int main(int argc, char *argv[])
     bmp_image image;
     bmp_init_image_structure(&image);
 
+    bmp_region inner_region;
+    bmp_row_reader row_reader;
+    bool row_reader_open =
+        false;
+    bmp_row_writer row_writer;
+    bool row_writer_open =
+        false;
+    bmp_mapped_output mapped_output;
+    bool output_mapped =
+        false;
+
     FILE *source_descriptor =
         NULL;
     FILE *destination_descriptor =
         NULL;
 
-    source_descriptor = fopen(source_file_name, "r");
+    source_descriptor =
+        0 == strcmp(source_file_name, IPS_Standard_Stream_Name) ?
+            stdin :
+            fopen(source_file_name, "r");
     if (NULL == source_descriptor) {
         fprintf(
             stderr,
@@ -153,7 +773,14 @@ int main(int argc, char *argv[])
 
     const char *error_message;
 
-    bmp_open_image_headers(source_descriptor, &image, &error_message);
+    // PGM, PPM and PAM images are written back in their own format.
+    bool pnm_image =
+        pnm_is_pnm_image(source_descriptor);
+    if (pnm_image) {
+        pnm_open_image_headers(source_descriptor, &image, &error_message);
+    } else {
+        bmp_open_image_headers(source_descriptor, &image, &error_message);
+    }
     if (NULL != error_message) {
         fprintf(
             stderr,
@@ -167,46 +794,208 @@ int main(int argc, char *argv[])
         goto cleanup;
     }
 
-    bmp_read_image_data(source_descriptor, &image, &error_message);
-    if (NULL != error_message) {
+    // Opening the destination truncates it. A source that is the same file
+    // is read whole before that instead of being mapped or streamed, and
+    // written by the row writer instead of through a shared mapping of the
+    // file it came from.
+    bool source_is_destination =
+        ips_is_same_file(source_descriptor, destination_file_name);
+    if (source_is_destination) {
+        map_source =
+            false;
+        stream_image =
+            false;
+        map_destination =
+            false;
+    }
+
+    if (widen_pixels) {
+        image.bytes_per_pixel =
+            4;
+    }
+    image.planar =
+        planar_pixels;
+    image.tiled =
+        tiled_pixels;
+
+    if (stream_image && pnm_image) {
         fprintf(
             stderr,
             "%s '%s':\n"
             "\t%s\n",
             IPS_Error_Failed_to_Process_Image,
             source_file_name,
-            error_message
+            IPS_Error_Failed_to_Stream_PNM_Image
         );
 
         goto cleanup;
     }
 
-    destination_descriptor = fopen(destination_file_name, "w");
-    if (NULL == destination_descriptor) {
+    if (use_region && pnm_image) {
         fprintf(
             stderr,
-            "%s '%s'\n",
-            IPS_Error_Failed_to_Create_Image,
-            destination_file_name
+            "%s '%s':\n"
+            "\t%s\n",
+            IPS_Error_Failed_to_Process_Image,
+            source_file_name,
+            IPS_Error_Failed_to_Crop_PNM_Image
+        );
+
+        goto cleanup;
+    }
+
+    if (stream_image &&
+        FILTERS_MEDIAN_ID == filter_id &&
+        NULL != image.color_table &&
+        !bmp_is_grayscale(&image)) {
+        fprintf(
+            stderr,
+            "%s '%s':\n"
+            "\t%s\n",
+            IPS_Error_Failed_to_Process_Image,
+            source_file_name,
+            IPS_Error_Failed_to_Stream_Color_Indices
         );
 
         goto cleanup;
     }
 
-    bmp_write_image_headers(destination_descriptor, &image, &error_message);
+    int pixel_filter_id =
+        filters_prepare_indexed_image(
+            &image,
+            filter_id,
+            brightness, contrast
+        );
+
+    // Bitmaps used in place are read by the workers in bands right before
+    // they filter them, unless the destination would truncate them first.
+    bool read_rows_at =
+        !stream_image && !pnm_image && !map_source && !use_region && 0 <= pixel_filter_id &&
+        !source_is_destination &&
+        bmp_can_read_rows_at(source_descriptor, &image);
+
+    if (stream_image) {
+        bmp_begin_image_rows(source_descriptor, &image, &error_message);
+    } else if (use_region) {
+        // The median window reaches this far past the region.
+        bmp_read_image_region(
+            source_descriptor,
+            &image,
+            &region,
+            FILTERS_MEDIAN_ID == pixel_filter_id ? radius : 0,
+            &inner_region,
+            &error_message
+        );
+    } else if (read_rows_at) {
+        bmp_open_row_reader(source_descriptor, &image, &row_reader, &error_message);
+        row_reader_open =
+            NULL == error_message;
+    } else if (pnm_image && map_source) {
+        pnm_map_image_data(source_descriptor, &image, &error_message);
+    } else if (pnm_image) {
+        pnm_read_image_data(source_descriptor, &image, &error_message);
+    } else if (map_source) {
+        bmp_map_image_data(source_descriptor, &image, &error_message);
+    } else {
+        bmp_read_image_data(source_descriptor, &image, &error_message);
+    }
     if (NULL != error_message) {
         fprintf(
             stderr,
             "%s '%s':\n"
             "\t%s\n",
             IPS_Error_Failed_to_Process_Image,
-            destination_file_name,
+            source_file_name,
             error_message
         );
 
         goto cleanup;
     }
 
+    // Shared writable mappings need the destination open for reading, too.
+    destination_descriptor =
+        0 == strcmp(destination_file_name, IPS_Standard_Stream_Name) ?
+            stdout :
+            fopen(destination_file_name, map_destination ? "w+" : "w");
+    if (NULL == destination_descriptor) {
+        fprintf(
+            stderr,
+            "%s '%s'\n",
+            IPS_Error_Failed_to_Create_Image,
+            destination_file_name
+        );
+
+        goto cleanup;
+    }
+
+    // A destination open only for writing, like stdout redirected to a file,
+    // cannot be mapped shared. Its rows are written at their offsets instead.
+    if (map_destination) {
+        int access_mode =
+            fcntl(fileno(destination_descriptor), F_GETFL);
+        if (-1 == access_mode || O_RDWR != (access_mode & O_ACCMODE)) {
+            map_destination =
+                false;
+        }
+    }
+
+    if (stream_image) {
+        bmp_write_image_headers(destination_descriptor, &image, &error_message);
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                destination_file_name,
+                error_message
+            );
+
+            goto cleanup;
+        }
+    } else {
+        bmp_release_image_payload(&image);
+    }
+
+    // Bitmaps filtered in place are written by the workers as their rows
+    // finish, or filtered straight into the mapped destination.
+    bool write_rows_at =
+        !stream_image && !pnm_image && !use_region && 0 <= pixel_filter_id &&
+        bmp_can_write_rows_at(destination_descriptor, &image);
+    if (write_rows_at && map_destination) {
+        bmp_map_image_output(destination_descriptor, &image, &mapped_output, &error_message);
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                destination_file_name,
+                error_message
+            );
+
+            goto cleanup;
+        }
+        output_mapped =
+            true;
+    } else if (write_rows_at) {
+        bmp_open_row_writer(destination_descriptor, &image, direct_output, &row_writer, &error_message);
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                destination_file_name,
+                error_message
+            );
+
+            goto cleanup;
+        }
+        row_writer_open =
+            true;
+    }
+
     size_t pool_size = utils_get_number_of_cpu_cores() * 2;
     threadpool_t *threadpool = threadpool_create(pool_size);
     if (NULL == threadpool) {
@@ -220,139 +1009,125 @@ int main(int argc, char *argv[])
     }
 
     /* Main Image Processing Loop */
-    {
-        static volatile ssize_t channels_left =
-            0;
-        static volatile bool barrier_sense =
-            false;
-        uint8_t *pixels =
-            image.pixels;
+    if (stream_image) {
+        const char *streaming_error_message;
 
-        uint8_t *original_pixels = NULL;
-        if (filter_id == FILTERS_MEDIAN_ID) {
-            original_pixels = (uint8_t *) aligned_alloc(64, image.aligned_image_size);
-            if (NULL == original_pixels) {
-                fprintf(
-                    stderr,
-                    "%s.\n",
-                    IPS_Error_Failed_to_Duplicate_the_Image
-                );
+PROFILER_START(1)
+        streaming_process_image(
+            source_descriptor,
+            destination_descriptor,
+            &image,
+            threadpool,
+            pool_size,
+            pixel_filter_id,
+            brightness, contrast,
+            radius,
+            memory_budget,
+            &streaming_error_message
+        );
+PROFILER_STOP();
 
-                goto cleanup;
-            }
+        if (NULL != streaming_error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                source_file_name,
+                streaming_error_message
+            );
 
-            memcpy(original_pixels, pixels, image.aligned_image_size);
+            goto cleanup;
         }
-
-        size_t width =
-            image.absolute_image_width;
-        size_t height =
-            image.absolute_image_height;
-        size_t channels_count =
-            width * height * 3;
-        size_t channels_per_thread =
-            channels_count / pool_size;
-#if defined FILTERS_SIMD_ASM_IMPLEMENTATION
-        channels_per_thread =
-            ((channels_per_thread - 1) / 16 + 1) * 16;
-#else
-        channels_per_thread =
-            ((channels_per_thread - 1) / 3 + 1) * 3;
+    } else {
+#ifdef PROFILE
+        fprintf(
+            stderr,
+            "Profiler: pixels on %zu KiB pages\n",
+            image_buffer_query_page_size(image.pixels) / 1024
+        );
 #endif
 
 PROFILER_START(1)
-        channels_left =
-            (ssize_t) channels_count;
-        barrier_sense =
-            false;
-
-        for (
-            size_t linear_position = 0;
-            linear_position < channels_count;
-            linear_position += channels_per_thread
-        ) {
-            size_t channels_to_process =
-                linear_position + channels_per_thread > channels_count ?
-                    channels_count - linear_position :
-                    channels_per_thread;
-
-            void *task_data;
-            switch (filter_id) {
-                case FILTERS_BRIGHTNESS_CONTRAST_ID:
-                    task_data =
-                        filters_brightness_contrast_data_create(
-                            linear_position,
-                            channels_to_process,
-                            pixels,
-                            brightness, contrast,
-                            &channels_left,
-                            &barrier_sense
-                        );
-                    break;
-                case FILTERS_SEPIA_ID:
-                    task_data =
-                        filters_sepia_data_create(
-                            linear_position,
-                            channels_to_process,
-                            pixels,
-                            &channels_left,
-                            &barrier_sense
-                        );
-                    break;
-                case FILTERS_MEDIAN_ID:
-                    task_data =
-                        filters_median_data_create(
-                            linear_position,
-                            channels_to_process,
-                            width, height,
-                            original_pixels,
-                            pixels,
-                            &channels_left,
-                            &barrier_sense
-                        );
-                    break;
-                default:
-                    task_data =
-                        NULL;
-            }
+        filters_process_image(
+            threadpool,
+            pool_size,
+            pixel_filter_id,
+            brightness, contrast,
+            radius,
+            &image,
+            output_mapped ? mapped_output.pixels : NULL,
+            row_reader_open ? &row_reader : NULL,
+            row_writer_open ? &row_writer : NULL,
+            &error_message
+        );
+PROFILER_STOP();
 
-            if (NULL != task_data) {
-                threadpool_enqueue_task(
-                    threadpool,
-                    task,
-                    task_data,
-                    NULL
-                );
-            }
+        if (NULL == error_message && row_reader_open) {
+            row_reader_open =
+                false;
+            bmp_close_row_reader(&row_reader, &error_message);
         }
+        if (NULL == error_message && use_region) {
+            bmp_crop_image(&image, &inner_region, &error_message);
+        }
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                source_file_name,
+                error_message
+            );
 
-        while (!barrier_sense) { }
-PROFILER_STOP();
-
-        if (NULL != original_pixels) {
-            free(original_pixels);
-            original_pixels = NULL;
+            goto cleanup;
         }
-    }
 
-    bmp_write_image_data(destination_descriptor, &image, &error_message);
-    if (NULL != error_message) {
-        fprintf(
-            stderr,
-            "%s '%s':\n"
-            "\t%s\n",
-            IPS_Error_Failed_to_Process_Image,
-            destination_file_name,
-            error_message
-        );
+        // Nothing touches the pixels after this, pipes can take their pages.
+        if (output_mapped) {
+            output_mapped =
+                false;
+            bmp_unmap_image_output(&mapped_output);
+        } else if (row_writer_open) {
+            row_writer_open =
+                false;
+            bmp_close_row_writer(&row_writer, &error_message);
+        } else if (pnm_image) {
+            pnm_write_image(destination_descriptor, &image, &error_message);
+        } else {
+            bmp_splice_image(destination_descriptor, &image, &error_message);
+        }
+        if (NULL != error_message) {
+            fprintf(
+                stderr,
+                "%s '%s':\n"
+                "\t%s\n",
+                IPS_Error_Failed_to_Process_Image,
+                destination_file_name,
+                error_message
+            );
 
-        goto cleanup;
+            goto cleanup;
+        }
     }
 
     result =
         EXIT_SUCCESS;
 
 cleanup:
+    if (row_reader_open) {
+        bmp_close_row_reader(&row_reader, &error_message);
+    }
+
+    if (output_mapped) {
+        bmp_unmap_image_output(&mapped_output);
+    }
+
+    if (row_writer_open) {
+        bmp_close_row_writer(&row_writer, &error_message);
+    }
+
     bmp_free_image_structure(&image);
 
     if (NULL != source_descriptor) {
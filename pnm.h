@@ -0,0 +1,89 @@
+#ifndef PNM_H
+#define PNM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bmp.h"
+
+static const char *PNM_Error_Invalid_File_Descriptor =
+                    "Invalid file descriptor",
+
+                  *PNM_Error_Failed_to_Read_Header =
+                    "Failed to read the PNM header",
+                  *PNM_Error_Invalid_File_Signature =
+                    "Invalid PNM file signature (not P5, P6 or P7)",
+                  *PNM_Error_Unsupported_Depth =
+                    "Unsupported PNM depth or tuple type (not 1, 3 or 4 channels)",
+                  *PNM_Error_Unsupported_Maximum_Value =
+                    "Unsupported PNM maximum value (not 255)",
+                  *PNM_Error_Invalid_Size_Information =
+                    "The PNM image contains invalid size information",
+
+                  *PNM_Error_Invalid_Image_Structure =
+                    "Invalid PNM image structure",
+                  *PNM_Error_Not_Enough_Memory_to_Read =
+                    "Not enough memory to read the image",
+                  *PNM_Error_Failed_to_Read_Image_Data =
+                    "Failed to read the image data",
+                  *PNM_Error_Failed_to_Map_Image_Data =
+                    "Failed to map the image data into memory",
+
+                  *PNM_Error_Failed_to_Write_Header =
+                    "Failed to write the PNM header",
+                  *PNM_Error_Failed_to_Write_Image_Data =
+                    "Failed to write the image data",
+                  *PNM_Error_Not_Enough_Memory_to_Write =
+                    "Not enough memory to write the image";
+
+static const int PNM_Magic_Byte = 0x50;
+
+/* The longest header written, P7 with two 20-digit dimensions. */
+#define PNM_MAXIMUM_HEADER_SIZE 128
+
+/*
+    Binary PGM (P5), PPM (P6) and PAM (P7) images are loaded into the same
+    `bmp_image` structure as bitmaps, so the filters and their threading
+    work on them unchanged. All sizes are 64-bit, the pixels directly follow
+    the header without any row padding. `file_header.signature` keeps the
+    magic number and `file_header.pixel_array_offset` the header size,
+    `file_header.file_size` is unused, `payload_size` holds the real size.
+
+    Color channels are stored as RGB(A) in the file and swapped to the
+    BGR(X) order of bitmaps in memory. Gray images are expanded to three
+    channels if `bytes_per_pixel` is set to 3 before the data is read and are
+    written back as color images. Widened, planar and tiled layouts are not
+    supported, these requests are ignored.
+*/
+
+static bool pnm_is_pnm_image(FILE *file_descriptor);
+
+static void pnm_open_image_headers(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void pnm_read_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void pnm_map_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+static void pnm_write_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            );
+
+#include "pnm.impl.h.c"
+
+#endif /* PNM_H */
@@ -0,0 +1,676 @@
+#include "pnm.h"
+#include "bmp.h"
+#include "utils.h"
+#include "image_buffer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The number of pixels swapped back to RGB(A) at a time while writing. */
+#define PNM_STAGING_PIXELS 65536
+
+static bool pnm_is_pnm_image(FILE *file_descriptor)
+{
+    if (NULL == file_descriptor) {
+        return false;
+    }
+
+    // One byte of push back is all a pipe is guaranteed to give.
+    int first_byte =
+        getc(file_descriptor);
+    if (EOF == first_byte) {
+        return false;
+    }
+    ungetc(first_byte, file_descriptor);
+
+    return PNM_Magic_Byte == first_byte;
+}
+
+/*
+    Reads the next whitespace separated header token, skipping comments.
+    The whitespace byte ending the token is consumed as well, for the last
+    token this is the single byte in front of the pixels.
+*/
+static bool _pnm_read_token(
+                FILE *file_descriptor,
+                char *token,
+                size_t token_size,
+                size_t *header_size
+            )
+{
+    int byte =
+        getc(file_descriptor);
+    ++*header_size;
+
+    while (EOF != byte && (isspace(byte) || '#' == byte)) {
+        if ('#' == byte) {
+            while (EOF != byte && '\n' != byte) {
+                byte = getc(file_descriptor);
+                ++*header_size;
+            }
+        }
+
+        byte = getc(file_descriptor);
+        ++*header_size;
+    }
+
+    size_t length =
+        0;
+    while (EOF != byte && !isspace(byte)) {
+        if (length + 1 >= token_size) {
+            return false;
+        }
+
+        token[length++] = (char) byte;
+
+        byte = getc(file_descriptor);
+        ++*header_size;
+    }
+    token[length] = '\0';
+
+    return 0 < length;
+}
+
+static bool _pnm_read_number(
+                FILE *file_descriptor,
+                size_t *number,
+                size_t *header_size
+            )
+{
+    char token[32];
+    if (!_pnm_read_token(file_descriptor, token, sizeof(token), header_size)) {
+        return false;
+    }
+
+    char *token_end;
+    unsigned long long value =
+        strtoull(token, &token_end, 10);
+    if ('\0' != *token_end || !isdigit((unsigned char) token[0]) || value > SIZE_MAX) {
+        return false;
+    }
+
+    *number = (size_t) value;
+
+    return true;
+}
+
+static void pnm_open_image_headers(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    size_t header_size =
+        0;
+    char token[32];
+    if (!_pnm_read_token(file_descriptor, token, sizeof(token), &header_size)) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Read_Header;
+        }
+
+        goto end;
+    }
+
+    if (0 != strcmp(token, "P5") && 0 != strcmp(token, "P6") && 0 != strcmp(token, "P7")) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Signature;
+        }
+
+        goto end;
+    }
+
+    char format =
+        token[1];
+    size_t width =
+        0;
+    size_t height =
+        0;
+    size_t depth =
+        '6' == format ? 3 : 1;
+    size_t maximum_value =
+        0;
+
+    if ('7' != format) {
+        if (!_pnm_read_number(file_descriptor, &width, &header_size)  ||
+            !_pnm_read_number(file_descriptor, &height, &header_size) ||
+            !_pnm_read_number(file_descriptor, &maximum_value, &header_size)) {
+            if (NULL != error_message) {
+                *error_message = PNM_Error_Failed_to_Read_Header;
+            }
+
+            goto end;
+        }
+    } else {
+        depth = 0;
+
+        // PAM headers are key and value lines up to ENDHDR, the tuple type
+        // only has to agree with the depth.
+        size_t tuple_depth =
+            0;
+        for (;;) {
+            if (!_pnm_read_token(file_descriptor, token, sizeof(token), &header_size)) {
+                if (NULL != error_message) {
+                    *error_message = PNM_Error_Failed_to_Read_Header;
+                }
+
+                goto end;
+            }
+
+            bool read =
+                true;
+            if (0 == strcmp(token, "ENDHDR")) {
+                break;
+            } else if (0 == strcmp(token, "WIDTH")) {
+                read = _pnm_read_number(file_descriptor, &width, &header_size);
+            } else if (0 == strcmp(token, "HEIGHT")) {
+                read = _pnm_read_number(file_descriptor, &height, &header_size);
+            } else if (0 == strcmp(token, "DEPTH")) {
+                read = _pnm_read_number(file_descriptor, &depth, &header_size);
+            } else if (0 == strcmp(token, "MAXVAL")) {
+                read = _pnm_read_number(file_descriptor, &maximum_value, &header_size);
+            } else if (0 == strcmp(token, "TUPLTYPE")) {
+                read = _pnm_read_token(file_descriptor, token, sizeof(token), &header_size);
+                tuple_depth =
+                    0 == strcmp(token, "GRAYSCALE") ? 1 :
+                    0 == strcmp(token, "RGB")       ? 3 :
+                    0 == strcmp(token, "RGB_ALPHA") ? 4 :
+                                                      SIZE_MAX;
+            } else {
+                read = false;
+            }
+
+            if (!read) {
+                if (NULL != error_message) {
+                    *error_message = PNM_Error_Failed_to_Read_Header;
+                }
+
+                goto end;
+            }
+        }
+
+        if (0 != tuple_depth && depth != tuple_depth) {
+            if (NULL != error_message) {
+                *error_message = PNM_Error_Unsupported_Depth;
+            }
+
+            goto end;
+        }
+    }
+
+    if (1 != depth && 3 != depth && 4 != depth) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Unsupported_Depth;
+        }
+
+        goto end;
+    }
+
+    if (255 != maximum_value) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Unsupported_Maximum_Value;
+        }
+
+        goto end;
+    }
+
+    if (0 == width || 0 == height ||
+        width > INT32_MAX || height > INT32_MAX ||
+        width > SIZE_MAX / 2 / height / depth) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_Size_Information;
+        }
+
+        goto end;
+    }
+
+    image->file_header.signature[0] =
+        (uint8_t) PNM_Magic_Byte;
+    image->file_header.signature[1] =
+        (uint8_t) format;
+    image->file_header.pixel_array_offset =
+        (uint32_t) header_size;
+
+    // Rows are stored top-down like in bitmaps with a negative height.
+    image->dib_header.image_width =
+        (int32_t) width;
+    image->dib_header.image_height =
+        -(int32_t) height;
+    image->dib_header.planes =
+        1;
+    image->dib_header.bits_per_pixel =
+        (uint16_t) (depth * 8);
+
+    image->bytes_per_pixel =
+        depth;
+    image->absolute_image_width =
+        width;
+    image->absolute_image_height =
+        height;
+    image->pixel_row_padding =
+        0;
+    image->image_size =
+        width * height * depth;
+    image->payload_size =
+        image->image_size;
+
+end:
+    return;
+}
+
+/* Swaps the first and the third channel of every pixel, `destination` may be `source`. */
+static inline void _pnm_swap_red_blue(
+                       uint8_t *destination,
+                       const uint8_t *source,
+                       size_t pixel_count,
+                       size_t bytes_per_pixel
+                   )
+{
+    for (size_t i = 0; i < pixel_count; ++i) {
+        uint8_t first =
+            source[0];
+        uint8_t third =
+            source[2];
+
+        destination[0] = third;
+        destination[1] = source[1];
+        destination[2] = first;
+        if (4 == bytes_per_pixel) {
+            destination[3] = source[3];
+        }
+
+        source += bytes_per_pixel;
+        destination += bytes_per_pixel;
+    }
+}
+
+/*
+    Turns the payload into `image->pixels`. The pixels are used in place
+    unless gray pixels have to be expanded to colors.
+*/
+static void _pnm_prepare_pixels(
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t depth =
+        (size_t) image->dib_header.bits_per_pixel / 8;
+    size_t pixel_count =
+        width * height;
+
+    image->raw_pixels =
+        image->payload;
+    image->planar =
+        false;
+    image->plane_size =
+        0;
+    image->tiled =
+        false;
+
+    if (1 == depth && 3 == image->bytes_per_pixel) {
+        size_t aligned_image_size =
+            _bmp_aligned_payload_size(pixel_count * 3);
+
+        image->pixels = (uint8_t *) image_buffer_allocate(aligned_image_size, true);
+        if (NULL == image->pixels) {
+            if (NULL != error_message) {
+                *error_message = PNM_Error_Not_Enough_Memory_to_Read;
+            }
+
+            goto end;
+        }
+
+        for (size_t i = 0; i < pixel_count; ++i) {
+            memset(image->pixels + i * 3, image->raw_pixels[i], 3);
+        }
+        memset(image->pixels + pixel_count * 3, 0, aligned_image_size - pixel_count * 3);
+
+        image->row_stride = width * 3;
+        image->aligned_image_size = aligned_image_size;
+
+        goto end;
+    }
+
+    image->bytes_per_pixel = depth;
+    image->pixels = image->raw_pixels;
+    image->row_stride = width * depth;
+    image->aligned_image_size = _bmp_aligned_payload_size(image->image_size);
+
+    if (3 <= depth) {
+        _pnm_swap_red_blue(image->pixels, image->pixels, pixel_count, depth);
+    }
+
+end:
+    return;
+}
+
+static void pnm_read_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    size_t payload_size =
+        image->image_size;
+
+    /* The pixels may be filtered in place, the vector kernels need the room past the payload. */
+    size_t aligned_payload_size =
+        _bmp_aligned_payload_size(payload_size);
+
+    image->payload_size = payload_size;
+    image->payload = (uint8_t *) image_buffer_allocate(aligned_payload_size, false);
+    if (NULL == image->payload) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Not_Enough_Memory_to_Read;
+        }
+
+        goto end;
+    }
+
+    memset(image->payload + payload_size, 0, aligned_payload_size - payload_size);
+
+    if (!fread(image->payload, payload_size, 1, file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Read_Image_Data;
+        }
+
+        goto cleanup;
+    }
+
+    _pnm_prepare_pixels(image, error_message);
+    if (NULL != *error_message) {
+        goto cleanup;
+    }
+
+end:
+    return;
+
+cleanup:
+    image_buffer_free(image->payload);
+    image->payload = NULL;
+    image->raw_pixels = NULL;
+}
+
+static void pnm_map_image_data(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    if (NULL == image) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    int file_number =
+        fileno(file_descriptor);
+
+    struct stat file_status;
+    if (-1 == file_number || -1 == fstat(file_number, &file_status)) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    /* Pipes and other streams can not be mapped, they are read instead. */
+    if (!S_ISREG(file_status.st_mode)) {
+        pnm_read_image_data(file_descriptor, image, error_message);
+
+        goto end;
+    }
+
+    size_t header_size =
+        (size_t) image->file_header.pixel_array_offset;
+    size_t file_size =
+        header_size + image->image_size;
+    if (file_size > (size_t) file_status.st_size) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Read_Image_Data;
+        }
+
+        goto end;
+    }
+
+    /*
+        Like bitmaps, the file is put on top of an anonymous reservation with
+        slack for the over-reads of the vector kernels.
+    */
+    size_t page_size =
+        (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapping_size =
+        ((file_size + 128 - 1) / page_size + 1) * page_size;
+
+    uint8_t *mapping =
+        mmap(
+            NULL, mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1, 0
+        );
+    if (MAP_FAILED == mapping) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Map_Image_Data;
+        }
+
+        goto end;
+    }
+
+    image->mapping = mapping;
+    image->mapping_size = mapping_size;
+
+    if (MAP_FAILED == mmap(
+                          mapping, file_size,
+                          PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED | MAP_POPULATE,
+                          file_number, 0
+                      )) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Map_Image_Data;
+        }
+
+        goto cleanup;
+    }
+
+    madvise(mapping, file_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    image->payload_size =
+        image->image_size;
+    image->payload =
+        mapping + header_size;
+
+    _pnm_prepare_pixels(image, error_message);
+    if (NULL != *error_message) {
+        goto cleanup;
+    }
+
+end:
+    return;
+
+cleanup:
+    _bmp_unmap_image(image);
+    image->raw_pixels = NULL;
+}
+
+/*
+    Writes P5 for gray and P6 for color pixels, or P7 if the source was a
+    PAM image or has an alpha channel.
+*/
+static void pnm_write_image(
+                FILE *file_descriptor,
+                bmp_image *image,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    uint8_t *staging =
+        NULL;
+
+    if (NULL == image || NULL == image->pixels) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_Image_Structure;
+        }
+
+        goto end;
+    }
+
+    if (NULL == file_descriptor) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Invalid_File_Descriptor;
+        }
+
+        goto end;
+    }
+
+    size_t width =
+        image->absolute_image_width;
+    size_t height =
+        image->absolute_image_height;
+    size_t bytes_per_pixel =
+        image->bytes_per_pixel;
+    size_t pixel_count =
+        width * height;
+
+    char header[PNM_MAXIMUM_HEADER_SIZE];
+    int header_size;
+    if ('7' == image->file_header.signature[1] || 4 == bytes_per_pixel) {
+        header_size =
+            snprintf(
+                header, sizeof(header),
+                "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH %zu\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                width, height, bytes_per_pixel,
+                1 == bytes_per_pixel ? "GRAYSCALE" :
+                3 == bytes_per_pixel ? "RGB"       :
+                                       "RGB_ALPHA"
+            );
+    } else {
+        header_size =
+            snprintf(
+                header, sizeof(header),
+                "P%c\n%zu %zu\n255\n",
+                1 == bytes_per_pixel ? '5' : '6',
+                width, height
+            );
+    }
+
+    if (!fwrite(header, (size_t) header_size, 1, file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Write_Header;
+        }
+
+        goto end;
+    }
+
+    if (1 == bytes_per_pixel) {
+        if (!fwrite(image->pixels, pixel_count, 1, file_descriptor)) {
+            if (NULL != error_message) {
+                *error_message = PNM_Error_Failed_to_Write_Image_Data;
+            }
+
+            goto end;
+        }
+    } else {
+        staging = (uint8_t *) malloc(PNM_STAGING_PIXELS * bytes_per_pixel);
+        if (NULL == staging) {
+            if (NULL != error_message) {
+                *error_message = PNM_Error_Not_Enough_Memory_to_Write;
+            }
+
+            goto end;
+        }
+
+        for (size_t first_pixel = 0; first_pixel < pixel_count; first_pixel += PNM_STAGING_PIXELS) {
+            size_t staged_pixels =
+                UTILS_MIN(pixel_count - first_pixel, (size_t) PNM_STAGING_PIXELS);
+
+            _pnm_swap_red_blue(
+                staging,
+                image->pixels + first_pixel * bytes_per_pixel,
+                staged_pixels,
+                bytes_per_pixel
+            );
+
+            if (!fwrite(staging, staged_pixels * bytes_per_pixel, 1, file_descriptor)) {
+                if (NULL != error_message) {
+                    *error_message = PNM_Error_Failed_to_Write_Image_Data;
+                }
+
+                goto end;
+            }
+        }
+    }
+
+    if (0 != fflush(file_descriptor)) {
+        if (NULL != error_message) {
+            *error_message = PNM_Error_Failed_to_Write_Image_Data;
+        }
+
+        goto end;
+    }
+
+end:
+    if (NULL != staging) {
+        free(staging);
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "bmp.h"
+#include "threadpool.h"
+#include "bounded_queue.h"
+
+static const char *Streaming_Error_Not_Enough_Memory =
+                    "Not enough memory to allocate the image bands",
+                  *Streaming_Error_Failed_to_Start_Thread =
+                    "Failed to start the reader or writer thread";
+
+#define STREAMING_BAND_COUNT             3
+#define STREAMING_DEFAULT_MEMORY_BUDGET (64 * 1024 * 1024)
+
+typedef struct _streaming_band
+{
+    uint8_t *source_pixels;         /* band rows with the halo rows above and below, packed       */
+    uint8_t *destination_pixels;    /* separate output rows for median, `source_pixels` otherwise */
+    size_t buffer_first_row;        /* image row stored at the start of the buffers               */
+    size_t first_row;               /* first image row the band produces                          */
+    size_t row_count;               /* number of rows the band produces                           */
+    size_t halo_top, halo_bottom;   /* halo rows actually present around the band                 */
+    bool last;
+    const char *error_message;
+} streaming_band_t;
+
+typedef struct _streaming_context
+{
+    FILE *source_descriptor;
+    FILE *destination_descriptor;
+    bmp_image *image;
+    size_t band_height;
+    size_t halo;
+    bounded_queue_t *free_bands;
+    bounded_queue_t *read_bands;
+    bounded_queue_t *processed_bands;
+    const char *writer_error_message;
+} streaming_context_t;
+
+static size_t streaming_get_band_height(
+                  bmp_image *image,
+                  int filter_id,
+                  size_t radius,
+                  size_t memory_budget
+              );
+
+static void streaming_process_image(
+                FILE *source_descriptor,
+                FILE *destination_descriptor,
+                bmp_image *image,
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                size_t memory_budget,
+                const char **error_message
+            );
+
+#include "streaming.impl.h.c"
+
+#endif /* STREAMING_H */
@@ -0,0 +1,346 @@
+#include "streaming.h"
+#include "filters.h"
+#include "filters_threading.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static size_t _streaming_get_halo(int filter_id, size_t radius)
+{
+    return FILTERS_MEDIAN_ID == filter_id ? radius : 0;
+}
+
+static size_t streaming_get_band_height(
+                  bmp_image *image,
+                  int filter_id,
+                  size_t radius,
+                  size_t memory_budget
+              )
+{
+    size_t halo =
+        _streaming_get_halo(filter_id, radius);
+    size_t row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
+
+    /* Source rows are read with their padding and compacted in place. */
+    size_t bytes_per_row =
+        row_size + image->pixel_row_padding;
+    if (FILTERS_MEDIAN_ID == filter_id) {
+        bytes_per_row += row_size;
+    }
+
+    size_t rows_per_band =
+        memory_budget / (STREAMING_BAND_COUNT * bytes_per_row);
+    size_t band_height =
+        rows_per_band > 2 * halo ? rows_per_band - 2 * halo : 1;
+
+    return UTILS_CLAMP(band_height, 1, UTILS_MAX(image->absolute_image_height, 1));
+}
+
+static void *_streaming_read_bands(void *arguments)
+{
+    streaming_context_t *context =
+        (streaming_context_t *) arguments;
+
+    bmp_image *image =
+        context->image;
+    size_t height =
+        image->absolute_image_height;
+    size_t row_size =
+        image->absolute_image_width * image->bytes_per_pixel;
+    size_t band_height =
+        context->band_height;
+    size_t halo =
+        context->halo;
+
+    streaming_band_t *previous_band =
+        NULL;
+    size_t next_row =
+        0;
+
+    for (size_t first_row = 0; first_row < height; first_row += band_height) {
+        streaming_band_t *band =
+            (streaming_band_t *) bounded_queue_deque(context->free_bands);
+
+        band->first_row =
+            first_row;
+        band->row_count =
+            UTILS_MIN(band_height, height - first_row);
+        band->halo_top =
+            UTILS_MIN(halo, first_row);
+        band->halo_bottom =
+            UTILS_MIN(halo, height - first_row - band->row_count);
+        band->buffer_first_row =
+            first_row - band->halo_top;
+        band->last =
+            first_row + band->row_count >= height;
+        band->error_message =
+            NULL;
+
+        /*
+            The halo rows above the band were already read into the previous
+            band. Its source rows stay untouched until the writer returns it,
+            and bands come back in order, so the previous band can't be the
+            free one we have just taken.
+        */
+        if (NULL != previous_band && next_row > band->buffer_first_row) {
+            memcpy(
+                band->source_pixels,
+                previous_band->source_pixels +
+                    (band->buffer_first_row - previous_band->buffer_first_row) * row_size,
+                (next_row - band->buffer_first_row) * row_size
+            );
+        }
+
+        size_t buffer_end_row =
+            first_row + band->row_count + band->halo_bottom;
+
+        bmp_read_image_rows(
+            context->source_descriptor,
+            image,
+            band->source_pixels + (next_row - band->buffer_first_row) * row_size,
+            buffer_end_row - next_row,
+            &band->error_message
+        );
+        next_row =
+            buffer_end_row;
+
+        if (NULL != band->error_message) {
+            band->last =
+                true;
+        }
+
+        bounded_queue_enqueue(context->read_bands, band);
+        if (band->last) {
+            break;
+        }
+
+        previous_band =
+            band;
+    }
+
+    return NULL;
+}
+
+static void *_streaming_write_bands(void *arguments)
+{
+    streaming_context_t *context =
+        (streaming_context_t *) arguments;
+
+    size_t row_size =
+        context->image->absolute_image_width * context->image->bytes_per_pixel;
+
+    bool last =
+        false;
+    while (!last) {
+        streaming_band_t *band =
+            (streaming_band_t *) bounded_queue_deque(context->processed_bands);
+
+        last =
+            band->last;
+
+        if (NULL != band->error_message) {
+            context->writer_error_message =
+                band->error_message;
+        } else if (NULL == context->writer_error_message) {
+            const char *error_message;
+            bmp_write_image_rows(
+                context->destination_descriptor,
+                context->image,
+                band->destination_pixels + band->halo_top * row_size,
+                band->row_count,
+                &error_message
+            );
+            context->writer_error_message =
+                error_message;
+        }
+
+        bounded_queue_enqueue(context->free_bands, band);
+    }
+
+    return NULL;
+}
+
+/*
+    Reads the image in horizontal bands, filters every band on the pool and
+    writes it out while the next band is being read. Memory is bounded by
+    the band buffers that fit into `memory_budget`, at least one row per
+    band. The source must be positioned right after the headers, and the
+    destination right after its headers.
+*/
+static void streaming_process_image(
+                FILE *source_descriptor,
+                FILE *destination_descriptor,
+                bmp_image *image,
+                threadpool_t *threadpool,
+                size_t pool_size,
+                int filter_id,
+                float brightness,
+                float contrast,
+                size_t radius,
+                size_t memory_budget,
+                const char **error_message
+            )
+{
+    *error_message = NULL;
+
+    streaming_context_t context;
+    memset(&context, 0, sizeof(context));
+
+    streaming_band_t bands[STREAMING_BAND_COUNT];
+    memset(bands, 0, sizeof(bands));
+
+    pthread_t reader_thread, writer_thread;
+    bool reader_started = false, writer_started = false;
+
+    size_t width =
+        image->absolute_image_width;
+    size_t row_size =
+        width * image->bytes_per_pixel;
+
+    context.source_descriptor =
+        source_descriptor;
+    context.destination_descriptor =
+        destination_descriptor;
+    context.image =
+        image;
+    context.halo =
+        _streaming_get_halo(filter_id, radius);
+    context.band_height =
+        streaming_get_band_height(image, filter_id, radius, memory_budget);
+
+    size_t buffer_rows =
+        context.band_height + 2 * context.halo;
+    size_t source_buffer_size =
+        ((buffer_rows * (row_size + image->pixel_row_padding) - 1) / 64 + 1) * 64 + 64;
+    size_t destination_buffer_size =
+        ((buffer_rows * row_size - 1) / 64 + 1) * 64 + 64;
+
+    context.free_bands =
+        bounded_queue_create(STREAMING_BAND_COUNT);
+    context.read_bands =
+        bounded_queue_create(STREAMING_BAND_COUNT);
+    context.processed_bands =
+        bounded_queue_create(STREAMING_BAND_COUNT);
+    if (NULL == context.free_bands ||
+        NULL == context.read_bands ||
+        NULL == context.processed_bands) {
+        *error_message = Streaming_Error_Not_Enough_Memory;
+
+        goto cleanup;
+    }
+
+    for (size_t i = 0; i < STREAMING_BAND_COUNT; ++i) {
+        bands[i].source_pixels =
+            (uint8_t *) aligned_alloc(64, source_buffer_size);
+        if (NULL == bands[i].source_pixels) {
+            *error_message = Streaming_Error_Not_Enough_Memory;
+
+            goto cleanup;
+        }
+        memset(bands[i].source_pixels, 0, source_buffer_size);
+
+        if (FILTERS_MEDIAN_ID == filter_id) {
+            bands[i].destination_pixels =
+                (uint8_t *) aligned_alloc(64, destination_buffer_size);
+            if (NULL == bands[i].destination_pixels) {
+                *error_message = Streaming_Error_Not_Enough_Memory;
+
+                goto cleanup;
+            }
+        } else {
+            bands[i].destination_pixels =
+                bands[i].source_pixels;
+        }
+
+        bounded_queue_enqueue(context.free_bands, &bands[i]);
+    }
+
+    if (0 != pthread_create(&reader_thread, NULL, _streaming_read_bands, &context)) {
+        *error_message = Streaming_Error_Failed_to_Start_Thread;
+
+        goto cleanup;
+    }
+    reader_started = true;
+
+    if (0 != pthread_create(&writer_thread, NULL, _streaming_write_bands, &context)) {
+        *error_message = Streaming_Error_Failed_to_Start_Thread;
+
+        goto cleanup;
+    }
+    writer_started = true;
+
+    bool last =
+        false;
+    while (!last) {
+        streaming_band_t *band =
+            (streaming_band_t *) bounded_queue_deque(context.read_bands);
+
+        last =
+            band->last;
+
+        if (NULL == band->error_message) {
+            filters_process_channels(
+                threadpool,
+                pool_size,
+                filter_id,
+                brightness, contrast,
+                radius,
+                band->halo_top * row_size,
+                band->row_count * row_size,
+                width,
+                band->halo_top + band->row_count + band->halo_bottom,
+                image->bytes_per_pixel, 0,
+                row_size,
+                band->source_pixels,
+                band->destination_pixels,
+                NULL,
+                NULL
+            );
+        }
+
+        bounded_queue_enqueue(context.processed_bands, band);
+    }
+
+cleanup:
+    if (reader_started) {
+        if (!writer_started) {
+            /* Let the reader run to the end without anyone writing. */
+            bool last =
+                false;
+            while (!last) {
+                streaming_band_t *band =
+                    (streaming_band_t *) bounded_queue_deque(context.read_bands);
+                last =
+                    band->last;
+                bounded_queue_enqueue(context.free_bands, band);
+            }
+        }
+
+        pthread_join(reader_thread, NULL);
+    }
+
+    if (writer_started) {
+        pthread_join(writer_thread, NULL);
+
+        if (NULL == *error_message) {
+            *error_message = context.writer_error_message;
+        }
+    }
+
+    for (size_t i = 0; i < STREAMING_BAND_COUNT; ++i) {
+        if (NULL != bands[i].destination_pixels &&
+            bands[i].destination_pixels != bands[i].source_pixels) {
+            free(bands[i].destination_pixels);
+        }
+        if (NULL != bands[i].source_pixels) {
+            free(bands[i].source_pixels);
+        }
+    }
+
+    bounded_queue_destroy(context.free_bands);
+    bounded_queue_destroy(context.read_bands);
+    bounded_queue_destroy(context.processed_bands);
+}
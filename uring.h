@@ -0,0 +1,89 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+    A minimal io_uring wrapper on top of the raw system calls. Only one thread
+    may use a ring, submissions are queued with the `uring_queue_*` functions
+    and sent to the kernel by `uring_wait_completion`.
+*/
+typedef struct _uring
+{
+    int ring_file_number;
+    unsigned entries;
+    unsigned queued_submissions;        /* queued since the last io_uring_enter */
+
+    unsigned *submission_head;
+    unsigned *submission_tail;
+    unsigned *submission_ring_mask;
+    unsigned *submission_array;
+    struct io_uring_sqe *submissions;
+
+    unsigned *completion_head;
+    unsigned *completion_tail;
+    unsigned *completion_ring_mask;
+    struct io_uring_cqe *completions;
+
+    void *submission_ring_mapping;
+    size_t submission_ring_mapping_size;
+    void *completion_ring_mapping;
+    size_t completion_ring_mapping_size;
+    size_t submissions_mapping_size;
+} uring_t;
+
+typedef struct _uring_completion
+{
+    uint64_t user_data;
+    int32_t result;                     /* the return value of the operation or -errno */
+} uring_completion_t;
+
+static bool uring_init(uring_t *ring, unsigned entries);
+
+static void uring_destroy(uring_t *ring);
+
+static bool uring_queue_openat(
+                uring_t *ring,
+                const char *path,
+                int flags,
+                mode_t mode,
+                uint64_t user_data
+            );
+
+static bool uring_queue_read(
+                uring_t *ring,
+                int file_number,
+                void *buffer,
+                size_t size,
+                uint64_t offset,
+                uint64_t user_data
+            );
+
+static bool uring_queue_readv(
+                uring_t *ring,
+                int file_number,
+                const struct iovec *vectors,
+                unsigned vector_count,
+                uint64_t offset,
+                uint64_t user_data
+            );
+
+static bool uring_queue_writev(
+                uring_t *ring,
+                int file_number,
+                const struct iovec *vectors,
+                unsigned vector_count,
+                uint64_t offset,
+                uint64_t user_data
+            );
+
+static bool uring_wait_completion(uring_t *ring, uring_completion_t *completion);
+
+#include "uring.impl.h.c"
+
+#endif /* URING_H */
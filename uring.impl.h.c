@@ -0,0 +1,383 @@
+#include "uring.h"
+#include "utils.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static inline int _uring_setup(unsigned entries, struct io_uring_params *parameters)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, parameters);
+}
+
+static inline int _uring_enter(
+                      int ring_file_number,
+                      unsigned submission_count,
+                      unsigned minimum_completion_count,
+                      unsigned flags
+                  )
+{
+    return (int) syscall(
+                     __NR_io_uring_enter,
+                     ring_file_number,
+                     submission_count,
+                     minimum_completion_count,
+                     flags,
+                     NULL, 0
+                 );
+}
+
+static bool uring_init(uring_t *ring, unsigned entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_file_number = -1;
+
+    struct io_uring_params parameters;
+    memset(&parameters, 0, sizeof(parameters));
+
+    ring->ring_file_number =
+        _uring_setup(entries, &parameters);
+    if (0 > ring->ring_file_number) {
+        return false;
+    }
+
+    ring->entries =
+        parameters.sq_entries;
+
+    ring->submission_ring_mapping_size =
+        parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+    ring->completion_ring_mapping_size =
+        parameters.cq_off.cqes + parameters.cq_entries * sizeof(struct io_uring_cqe);
+    ring->submissions_mapping_size =
+        parameters.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Newer kernels put both rings into one mapping. */
+    bool single_mapping =
+        0 != (parameters.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mapping) {
+        ring->submission_ring_mapping_size =
+            UTILS_MAX(ring->submission_ring_mapping_size, ring->completion_ring_mapping_size);
+    }
+
+    ring->submission_ring_mapping =
+        mmap(
+            NULL, ring->submission_ring_mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            ring->ring_file_number, IORING_OFF_SQ_RING
+        );
+    if (MAP_FAILED == ring->submission_ring_mapping) {
+        ring->submission_ring_mapping = NULL;
+
+        goto cleanup;
+    }
+
+    if (single_mapping) {
+        ring->completion_ring_mapping =
+            ring->submission_ring_mapping;
+    } else {
+        ring->completion_ring_mapping =
+            mmap(
+                NULL, ring->completion_ring_mapping_size,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE,
+                ring->ring_file_number, IORING_OFF_CQ_RING
+            );
+        if (MAP_FAILED == ring->completion_ring_mapping) {
+            ring->completion_ring_mapping = NULL;
+
+            goto cleanup;
+        }
+    }
+
+    ring->submissions =
+        mmap(
+            NULL, ring->submissions_mapping_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            ring->ring_file_number, IORING_OFF_SQES
+        );
+    if (MAP_FAILED == ring->submissions) {
+        ring->submissions = NULL;
+
+        goto cleanup;
+    }
+
+    uint8_t *submission_ring =
+        (uint8_t *) ring->submission_ring_mapping;
+    ring->submission_head =
+        (unsigned *) (submission_ring + parameters.sq_off.head);
+    ring->submission_tail =
+        (unsigned *) (submission_ring + parameters.sq_off.tail);
+    ring->submission_ring_mask =
+        (unsigned *) (submission_ring + parameters.sq_off.ring_mask);
+    ring->submission_array =
+        (unsigned *) (submission_ring + parameters.sq_off.array);
+
+    uint8_t *completion_ring =
+        (uint8_t *) ring->completion_ring_mapping;
+    ring->completion_head =
+        (unsigned *) (completion_ring + parameters.cq_off.head);
+    ring->completion_tail =
+        (unsigned *) (completion_ring + parameters.cq_off.tail);
+    ring->completion_ring_mask =
+        (unsigned *) (completion_ring + parameters.cq_off.ring_mask);
+    ring->completions =
+        (struct io_uring_cqe *) (completion_ring + parameters.cq_off.cqes);
+
+    return true;
+
+cleanup:
+    uring_destroy(ring);
+
+    return false;
+}
+
+static void uring_destroy(uring_t *ring)
+{
+    if (NULL != ring->submissions) {
+        munmap(ring->submissions, ring->submissions_mapping_size);
+        ring->submissions = NULL;
+    }
+
+    if (NULL != ring->completion_ring_mapping &&
+        ring->completion_ring_mapping != ring->submission_ring_mapping) {
+        munmap(ring->completion_ring_mapping, ring->completion_ring_mapping_size);
+    }
+    ring->completion_ring_mapping = NULL;
+
+    if (NULL != ring->submission_ring_mapping) {
+        munmap(ring->submission_ring_mapping, ring->submission_ring_mapping_size);
+        ring->submission_ring_mapping = NULL;
+    }
+
+    if (0 <= ring->ring_file_number) {
+        close(ring->ring_file_number);
+        ring->ring_file_number = -1;
+    }
+}
+
+/*
+    Returns a cleared submission entry or NULL when the submission ring is full.
+    The entry is not visible to the kernel until `_uring_commit_submission`.
+*/
+static struct io_uring_sqe *_uring_next_submission(uring_t *ring, uint8_t opcode, uint64_t user_data)
+{
+    unsigned head =
+        __atomic_load_n(ring->submission_head, __ATOMIC_ACQUIRE);
+    unsigned tail =
+        *ring->submission_tail;
+    if (tail - head >= ring->entries) {
+        return NULL;
+    }
+
+    struct io_uring_sqe *submission =
+        &ring->submissions[tail & *ring->submission_ring_mask];
+    memset(submission, 0, sizeof(*submission));
+
+    submission->opcode =
+        opcode;
+    submission->user_data =
+        user_data;
+
+    return submission;
+}
+
+/*
+    Publishes the entry `_uring_next_submission` returned last. The release store
+    of the tail orders every write to the entry before the kernel can see it.
+*/
+static void _uring_commit_submission(uring_t *ring)
+{
+    unsigned tail =
+        *ring->submission_tail;
+    unsigned index =
+        tail & *ring->submission_ring_mask;
+
+    ring->submission_array[index] =
+        index;
+    __atomic_store_n(ring->submission_tail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->queued_submissions;
+}
+
+static bool uring_queue_openat(
+                uring_t *ring,
+                const char *path,
+                int flags,
+                mode_t mode,
+                uint64_t user_data
+            )
+{
+    struct io_uring_sqe *submission =
+        _uring_next_submission(ring, IORING_OP_OPENAT, user_data);
+    if (NULL == submission) {
+        return false;
+    }
+
+    submission->fd =
+        AT_FDCWD;
+    submission->addr =
+        (uint64_t) (uintptr_t) path;
+    submission->len =
+        (uint32_t) mode;
+    submission->open_flags =
+        (uint32_t) flags;
+
+    _uring_commit_submission(ring);
+
+    return true;
+}
+
+static bool uring_queue_read(
+                uring_t *ring,
+                int file_number,
+                void *buffer,
+                size_t size,
+                uint64_t offset,
+                uint64_t user_data
+            )
+{
+    struct io_uring_sqe *submission =
+        _uring_next_submission(ring, IORING_OP_READ, user_data);
+    if (NULL == submission) {
+        return false;
+    }
+
+    submission->fd =
+        file_number;
+    submission->addr =
+        (uint64_t) (uintptr_t) buffer;
+    submission->len =
+        (uint32_t) size;
+    submission->off =
+        offset;
+
+    _uring_commit_submission(ring);
+
+    return true;
+}
+
+static bool uring_queue_readv(
+                uring_t *ring,
+                int file_number,
+                const struct iovec *vectors,
+                unsigned vector_count,
+                uint64_t offset,
+                uint64_t user_data
+            )
+{
+    struct io_uring_sqe *submission =
+        _uring_next_submission(ring, IORING_OP_READV, user_data);
+    if (NULL == submission) {
+        return false;
+    }
+
+    submission->fd =
+        file_number;
+    submission->addr =
+        (uint64_t) (uintptr_t) vectors;
+    submission->len =
+        vector_count;
+    submission->off =
+        offset;
+
+    _uring_commit_submission(ring);
+
+    return true;
+}
+
+static bool uring_queue_writev(
+                uring_t *ring,
+                int file_number,
+                const struct iovec *vectors,
+                unsigned vector_count,
+                uint64_t offset,
+                uint64_t user_data
+            )
+{
+    struct io_uring_sqe *submission =
+        _uring_next_submission(ring, IORING_OP_WRITEV, user_data);
+    if (NULL == submission) {
+        return false;
+    }
+
+    submission->fd =
+        file_number;
+    submission->addr =
+        (uint64_t) (uintptr_t) vectors;
+    submission->len =
+        vector_count;
+    submission->off =
+        offset;
+
+    _uring_commit_submission(ring);
+
+    return true;
+}
+
+/*
+    Submits everything queued so far and waits for the next completion. Fails
+    only when the kernel rejects the ring itself, failed operations report
+    their -errno in `completion->result`.
+*/
+static bool uring_wait_completion(uring_t *ring, uring_completion_t *completion)
+{
+    // Set once the kernel refuses submissions while the completion ring is full.
+    bool draining =
+        false;
+
+    for (;;) {
+        unsigned head =
+            *ring->completion_head;
+        unsigned tail =
+            __atomic_load_n(ring->completion_tail, __ATOMIC_ACQUIRE);
+        if (head != tail && (0 == ring->queued_submissions || draining)) {
+            struct io_uring_cqe *entry =
+                &ring->completions[head & *ring->completion_ring_mask];
+            completion->user_data =
+                entry->user_data;
+            completion->result =
+                entry->res;
+
+            __atomic_store_n(ring->completion_head, head + 1, __ATOMIC_RELEASE);
+
+            return true;
+        }
+
+        unsigned minimum_completion_count =
+            head != tail ? 0 : 1;
+        int submitted =
+            _uring_enter(
+                ring->ring_file_number,
+                draining ? 0 : ring->queued_submissions,
+                minimum_completion_count,
+                0 < minimum_completion_count ? IORING_ENTER_GETEVENTS : 0
+            );
+        if (0 > submitted) {
+            if (EINTR == errno || EAGAIN == errno) {
+                continue;
+            }
+
+            // Completions have to be reaped before anything more is taken.
+            // The ones in the ring are handed out first, an empty ring is
+            // refilled from the kernel's overflow by waiting without
+            // submitting.
+            if (EBUSY == errno && !draining) {
+                draining =
+                    true;
+
+                continue;
+            }
+
+            return false;
+        }
+
+        ring->queued_submissions -=
+            UTILS_MIN((unsigned) submitted, ring->queued_submissions);
+        draining =
+            false;
+    }
+}